@@ -51,6 +51,12 @@ isEmpty(UNIVERSAL) {
 # Let's optimize !
 QMAKE_CXXFLAGS += -O2
 
+# gcc only vectorizes loops at -O3 (or, since gcc 12, only the
+# trivial ones at -O2), this is needed for the array functions of
+# functions.cc. It does not change the results of the floating-point
+# operations.
+QMAKE_CXXFLAGS += -ftree-vectorize
+
 
 # We want icons
 
@@ -263,7 +269,17 @@ win32 {
   LIBS += -lpsapi
 }
 
-SOURCES += src/qmain.cc
+# Building with CONFIG+=batch produces qsoas-batch, a command-line
+# only executable that reads the commands from the standard input or
+# from --run/--run-script, writes the terminal output to the standard
+# output, and never connects to a display.
+batch {
+  message("Building the qsoas-batch executable")
+  TARGET = $$replace(TARGET, QSoas, qsoas-batch)
+  SOURCES += src/batchmain.cc
+} else {
+  SOURCES += src/qmain.cc
+}
 
 # mruby
 HEADERS += src/mruby.hh
@@ -280,6 +296,8 @@ SOURCES += \
         src/general-commands.cc \
         src/commandeffector.cc \
         src/commandwidget.cc \
+        src/commandserver.cc \
+        src/qsoasmain.cc \
         src/terminal.cc \
         src/general-arguments.cc \
         src/argument.cc \
@@ -329,6 +347,7 @@ SOURCES += \
         src/fft.cc \
         src/peaks.cc \
         src/datasetbrowser.cc \
+        src/thumbnailcache.cc \
         src/pointtracker.cc \
         src/misc-fits.cc \
         src/custom-fits.cc \
@@ -340,6 +359,7 @@ SOURCES += \
         src/combinedfit.cc \
         src/gslfunction.cc \
         src/odesolver.cc \
+        src/sparselu.cc \
         src/rubyodesolver.cc \
         src/kineticsystem.cc \
         src/kineticsystemevolver.cc \
@@ -430,7 +450,9 @@ SOURCES += \
         src/linearfunctions.cc \
         src/indexedfit.cc \
         src/svd-command.cc \
-        src/monotonefit.cc
+        src/monotonefit.cc \
+        src/taskscheduler.cc \
+        src/profiler.cc
 
 
 # Fit engines, grouped in an easy way to disable them:
@@ -455,6 +477,8 @@ HEADERS += src/headers.hh \
         src/commandeffector-templates.hh \
         src/possessive-containers.hh \
         src/commandwidget.hh \
+        src/commandserver.hh \
+        src/qsoasmain.hh \
         src/terminal.hh \
         src/general-arguments.hh \
         src/vector.hh \
@@ -493,6 +517,7 @@ HEADERS += src/headers.hh \
         src/fft.hh \
         src/peaks.hh \
         src/datasetbrowser.hh \
+        src/thumbnailcache.hh \
         src/pointtracker.hh \
         src/derivativefit.hh \
         src/formattedstring.hh \
@@ -502,6 +527,7 @@ HEADERS += src/headers.hh \
         src/combinedfit.hh \
         src/gslfunction.hh \
         src/odesolver.hh \
+        src/sparselu.hh \
         src/rubyodesolver.hh \
         src/kineticsystem.hh \
         src/kineticsystemevolver.hh \
@@ -581,7 +607,9 @@ HEADERS += src/headers.hh \
         src/gcguard.hh \
         src/contourlines.hh \
         src/filebrowser.hh \
-        src/linearfunctions.hh
+        src/linearfunctions.hh \
+        src/taskscheduler.hh \
+        src/profiler.hh
 
 
 # complex numbers
@@ -634,6 +662,8 @@ SOURCES += src/parameterspaceexplorers.cc
 SOURCES += src/formats/gpesprovider.cc \
         src/formats/chi.cc \
         src/formats/eclab.cc \
+        src/formats/eclab-mpr.cc \
+        src/formats/binarydataset.cc \
         src/formats/parametersbackend.cc \
         src/formats/ignorebackend.cc
 
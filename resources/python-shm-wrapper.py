@@ -0,0 +1,66 @@
+# python-shm-wrapper.py: Python code for wrapping external python
+# functions, exchanging the data through a shared memory segment
+# Copyright 2021 by CNRS/AMU
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301
+# USA
+
+## CODE
+
+import sys
+import mmap
+
+# The segment is a file mapped in memory by QSoas, whose name is
+# given as the first argument. It contains native doubles, in the
+# order: parameters, X values, computed Y values.
+#
+# The control messages are lines on the standard input:
+#
+# compute nb_params nb_x segment_size
+#
+# The answer is either "done" or "error message", on a single line.
+
+segment = open(sys.argv[1], "r+b")
+mapped = None
+values = None
+mapped_size = 0
+
+for l in sys.stdin:
+    cmd = l.split()
+    if len(cmd) == 0:
+        continue
+    if cmd[0] != "compute":
+        print("error unknown command: " + cmd[0], flush=True)
+        continue
+    nb_params = int(cmd[1])
+    nb_x = int(cmd[2])
+    size = int(cmd[3])
+    if size != mapped_size:
+        if values is not None:
+            values.release()
+            mapped.close()
+        mapped = mmap.mmap(segment.fileno(), size)
+        values = memoryview(mapped).cast("d")
+        mapped_size = size
+    try:
+        params = values[0:nb_params].tolist()
+        base = nb_params + nb_x
+        i = nb_params
+        for x in values[nb_params:base].tolist():
+            values[i + nb_x] = float(func(x, *params))
+            i += 1
+        print("done", flush=True)
+    except Exception as ex:
+        print("error " + str(ex).replace("\n", " "), flush=True)
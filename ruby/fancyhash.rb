@@ -30,6 +30,100 @@ class FancyHash < Hash
 
 end
 
+# A FancyHash whose values are only computed when they are needed.
+# Subclasses must provide two methods:
+# * __keys__, that returns all the keys that can be computed
+# * __fetch__(key), that computes the value for the key, stores it
+#   in the hash (possibly along with other values) and returns it,
+#   or nil if there is no such key.
+class LazyHash < FancyHash
+  def [](k)
+    if has_key?(k)
+      return super
+    end
+    return __fetch__(k)
+  end
+
+  def key?(k)
+    return has_key?(k) || __keys__.include?(k)
+  end
+
+  # Computes all the values, and sorts them in the order of __keys__
+  def __fill__
+    ks = __keys__
+    if ! ks.all? { |k| has_key?(k) }
+      vals = ks.map { |k| self[k] }
+      clear
+      ks.each_index { |i| self[ks[i]] = vals[i] }
+    end
+    self
+  end
+
+  # All the functions that need to see the whole hash
+  def size
+    __keys__.size
+  end
+
+  def length
+    __keys__.size
+  end
+
+  def keys
+    __fill__
+    super
+  end
+
+  def values
+    __fill__
+    super
+  end
+
+  def each(&blk)
+    __fill__
+    super
+  end
+
+  def each_key(&blk)
+    __fill__
+    super
+  end
+
+  def each_value(&blk)
+    __fill__
+    super
+  end
+
+  def to_a
+    __fill__
+    super
+  end
+
+  def inspect
+    __fill__
+    super
+  end
+
+  def to_s
+    __fill__
+    super
+  end
+
+  def ==(other)
+    __fill__
+    super
+  end
+
+  def dup
+    __fill__
+    super
+  end
+
+  def merge(other)
+    __fill__
+    super
+  end
+end
+
 # a = FancyHash.new
 # p a
 # a["stuff"] = 23
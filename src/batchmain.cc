@@ -0,0 +1,27 @@
+/**
+   \file batchmain.cc
+   entry point of qsoas-batch, the non-interactive version of QSoas
+   Copyright 2021 by CNRS/AMU
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#include <headers.hh>
+#include <qsoasmain.hh>
+
+int main(int argc, char ** argv)
+{
+  return qsoasMain(argc, argv, true);
+}
@@ -34,7 +34,7 @@ BSplines::BSplines(const Vector & xvalues,
 #if GSL_MAJOR_VERSION <  2
   derivWS(NULL),
 #endif
-  fitWS(NULL), coeffs(NULL), storage(NULL), cov(NULL), nbCoeffs(-1), nb(-1),
+  coeffs(NULL), storage(NULL), nbCoeffs(-1), nb(-1),
   order(o), maxOrder(mo), x(xvalues), y(yvalues)
 {
 }
@@ -44,7 +44,7 @@ BSplines::BSplines(const DataSet * ds, int o, int mo) :
 #if GSL_MAJOR_VERSION <  2
   derivWS(NULL),
 #endif
-  fitWS(NULL), coeffs(NULL), storage(NULL), cov(NULL), nbCoeffs(-1), nb(-1),
+  coeffs(NULL), storage(NULL), nbCoeffs(-1), nb(-1),
   order(o), maxOrder(mo), x(ds->x()), y(ds->y())
 {
 }
@@ -73,30 +73,28 @@ void BSplines::allocateWS()
     throw InternalError("X and Y size differ");
 
 
-  for(int i = 0; i <= maxOrder; i++)
-    splines << gsl_matrix_alloc(nb, nbCoeffs);
+  splines = Vector(nb * (maxOrder + 1) * order, 0);
+  firstSpline = QVector<int>(nb, 0);
 
-  storage = gsl_matrix_alloc(nbCoeffs, maxOrder + 1);
-
-  fitWS = gsl_multifit_linear_alloc(nb, nbCoeffs);
+  storage = gsl_matrix_alloc(order, maxOrder + 1);
 
   coeffs = gsl_vector_alloc(nbCoeffs);
-  cov = gsl_matrix_alloc(nbCoeffs, nbCoeffs);
+  rMatrix = Vector(nbCoeffs * order, 0);
+  rhs = Vector(nbCoeffs, 0);
 }
 
 void BSplines::freeWS()
 {
   if(! splinesWS)
     return;
-  for(int i = 0; i <= maxOrder; i++)
-    gsl_matrix_free(splines[i]);
   splines.clear();
-  gsl_matrix_free(cov);
+  firstSpline.clear();
+  pointOrder.clear();
+  rMatrix.clear();
+  rhs.clear();
   gsl_matrix_free(storage);
   gsl_vector_free(coeffs);
 
-  
-  gsl_multifit_linear_free(fitWS);
   gsl_bspline_free(splinesWS);
   
 #if GSL_MAJOR_VERSION < 2
@@ -129,22 +127,39 @@ void BSplines::setBreakPoints(const Vector & bps)
 
 
   const double * xvals = x.data();
+  const int stride = (maxOrder + 1) * order;
 
   for(int i = 0; i < nb; i++) {
+    firstSpline[i] = evaluateNonZero(xvals[i], maxOrder, storage);
+    double * tg = splines.data() + i * stride;
+    for(int j = 0; j <= maxOrder; j++)
+      for(int k = 0; k < order; k++)
+        tg[j * order + k] = gsl_matrix_get(storage, k, j);
+  }
+
+  pointOrder.resize(nb);
+  for(int i = 0; i < nb; i++)
+    pointOrder[i] = i;
+  std::stable_sort(pointOrder.begin(), pointOrder.end(),
+                   [this](int a, int b) {
+                     return firstSpline[a] < firstSpline[b];
+                   });
+}
+
+int BSplines::evaluateNonZero(double x, int nderiv, gsl_matrix * target) const
+{
+  size_t istart, iend;
+  // I need those const casts here... (probably better than mark the
+  // workspaces as mutable)
 #if GSL_MAJOR_VERSION >= 2
-    gsl_bspline_deriv_eval(xvals[i], maxOrder, storage, 
-                           splinesWS);
+  gsl_bspline_deriv_eval_nonzero(x, nderiv, target, &istart, &iend,
+                                 const_cast<gsl_bspline_workspace *>(splinesWS));
 #else
-    gsl_bspline_deriv_eval(xvals[i], maxOrder, storage, 
-                           splinesWS, derivWS);
+  gsl_bspline_deriv_eval_nonzero(x, nderiv, target, &istart, &iend,
+                                 const_cast<gsl_bspline_workspace *>(splinesWS),
+                                 const_cast<gsl_bspline_deriv_workspace*>(derivWS));
 #endif
-    for(int j = 0; j <= maxOrder; j++) {
-      gsl_vector_view s = gsl_matrix_column(storage, j);
-      gsl_vector_view v = gsl_matrix_row(splines[j], i);
-      gsl_vector_memcpy(&v.vector, &s.vector);
-    }
-  }
-
+  return istart;
 }
 
 void BSplines::setOrder(int no)
@@ -171,23 +186,90 @@ void BSplines::autoBreakPoints(int nbPoints)
 
 double BSplines::computeCoefficients()
 {
-  double chisq;
-  gsl_vector_const_view yv = 
-    gsl_vector_const_view_array(y.data(), nb);
-
-  if(weights.size() > 0)
-    gsl_multifit_wlinear(splines[0], weights.toGSLVector(),
-                         &yv.vector,
-                         coeffs, cov, &chisq, fitWS);
-  else
-    gsl_multifit_linear(splines[0], &yv.vector,
-                        coeffs, cov, &chisq, fitWS);
+  // We solve the least-squares problem by accumulating the rows one
+  // by one into the banded upper triangular matrix R using Givens
+  // rotations. The part of the right-hand side rotated out of R
+  // gives the residuals. This only works if the rows come by
+  // increasing index of their first spline, hence pointOrder.
+  rMatrix.fill(0);
+  rhs.fill(0);
+  double * r = rMatrix.data();
+  double * b = rhs.data();
+  const int stride = (maxOrder + 1) * order;
+  bool weighted = weights.size() > 0;
+
+  double chisq = 0;
+  QVarLengthArray<double, 32> row(order);
+  for(int idx = 0; idx < nb; idx++) {
+    int i = pointOrder[idx];
+    double w = weighted ? sqrt(weights[i]) : 1;
+    const double * vals = splines.data() + i * stride;
+    for(int k = 0; k < order; k++)
+      row[k] = w * vals[k];
+    double v = w * y[i];
+    int first = firstSpline[i];
+
+    for(int k = 0; k < order; k++) {
+      if(row[k] == 0)
+        continue;
+      double * rj = r + (first + k) * order;
+      double & bj = b[first + k];
+      if(rj[0] == 0) {
+        // Empty row in R, the current row goes there
+        for(int m = k; m < order; m++) {
+          rj[m - k] = row[m];
+          row[m] = 0;
+        }
+        bj = v;
+        v = 0;
+        break;
+      }
+      double h = hypot(rj[0], row[k]);
+      double c = rj[0]/h;
+      double sn = row[k]/h;
+      rj[0] = h;
+      row[k] = 0;
+      for(int m = k + 1; m < order; m++) {
+        double a = rj[m - k];
+        rj[m - k] = c * a + sn * row[m];
+        row[m] = c * row[m] - sn * a;
+      }
+      double a = bj;
+      bj = c * a + sn * v;
+      v = c * v - sn * a;
+    }
+    chisq += v*v;
+  }
+
+  // Back-substitution. Coefficients of splines without data are set
+  // to 0.
+  double maxDiag = 0;
+  for(int j = 0; j < nbCoeffs; j++)
+    maxDiag = std::max(maxDiag, fabs(r[j * order]));
+  for(int j = nbCoeffs - 1; j >= 0; j--) {
+    const double * rj = r + j * order;
+    double sum = b[j];
+    for(int k = 1; k < order && j + k < nbCoeffs; k++)
+      sum -= rj[k] * gsl_vector_get(coeffs, j + k);
+    double d = rj[0];
+    gsl_vector_set(coeffs, j,
+                   fabs(d) > 1e-13 * maxDiag ? sum/d : 0);
+  }
   return chisq;
 }
 
 void BSplines::computeValues(gsl_vector * target, int order) const
 {
-  gsl_blas_dgemv(CblasNoTrans, 1, splines[order], coeffs, 0, target);
+  const int stride = (maxOrder + 1) * this->order;
+  const double * c = coeffs->data;
+  for(int i = 0; i < nb; i++) {
+    const double * vals = splines.data() + i * stride + order * this->order;
+    const double * ci = c + firstSpline[i] * coeffs->stride;
+    double v = 0;
+    for(int k = 0; k < this->order; k++)
+      v += vals[k] * ci[k * coeffs->stride];
+    gsl_vector_set(target, i, v);
+  }
 }
 
 Vector BSplines::computeValues(int order) const
@@ -207,23 +289,16 @@ void BSplines::setWeights(const Vector & w)
 Vector BSplines::computeValues(const Vector & x, int order) const
 {
   Vector y(x.size(), 0);
-  QVarLengthArray<double, 5000> eval((order+1) * nbCoeffs);
+  QVarLengthArray<double, 256> eval((order+1) * this->order);
+  gsl_matrix_view m = gsl_matrix_view_array(eval.data(), this->order,
+                                            order+1);
   for(int i = 0; i < x.size(); i++) {
-    gsl_matrix_view m = gsl_matrix_view_array(eval.data(), nbCoeffs, 
-                                              order+1);
-    gsl_matrix_set_zero(&m.matrix);
-    // I need those const casts here... (probably better than mark the
-    // workspaces as mutable)
-#if GSL_MAJOR_VERSION >= 2
-    gsl_bspline_deriv_eval(x[i], order, &m.matrix, 
-                           const_cast<gsl_bspline_workspace *>(splinesWS));
-#else
-    gsl_bspline_deriv_eval(x[i], order, &m.matrix, 
-                           const_cast<gsl_bspline_workspace *>(splinesWS), 
-                           const_cast<gsl_bspline_deriv_workspace*>(derivWS));
-#endif
-    gsl_vector_view v = gsl_matrix_column(&m.matrix, order);
-    gsl_blas_ddot(&v.vector, coeffs, &y[i]);
+    int first = evaluateNonZero(x[i], order, &m.matrix);
+    double v = 0;
+    for(int k = 0; k < this->order; k++)
+      v += gsl_matrix_get(&m.matrix, k, order) *
+        gsl_vector_get(coeffs, first + k);
+    y[i] = v;
   }
     
   return y;
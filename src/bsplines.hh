@@ -25,7 +25,6 @@
 #include <vector.hh>
 
 #include <gsl/gsl_bspline.h>
-#include <gsl/gsl_multifit.h>
 
 #include <gsl/gsl_version.h>
 
@@ -33,6 +32,10 @@ class DataSet;
 
 /// This class provides filtering based on BSplines
 ///
+/// As each point only depends on @a order splines, the values of the
+/// splines are stored in a compact form, and the coefficients are
+/// determined by a banded QR decomposition.
+///
 /// @todo This class should attempt (upon request) to handle each
 /// monotonic part one by one. Or should the invocation should handle
 /// it smoothly ?
@@ -46,20 +49,30 @@ class BSplines {
   gsl_bspline_deriv_workspace * derivWS;
 #endif
 
-  /// The workspace for fits:
-  gsl_multifit_linear_workspace * fitWS;
-
   /// Vector space for the coefficients
   gsl_vector * coeffs;
 
-  /// Storage space for the spline functions and the derivatives
-  QList<gsl_matrix *> splines;
+  /// The index of the first non-zero spline for each point
+  QVector<int> firstSpline;
+
+  /// The indices of the points, sorted by increasing firstSpline,
+  /// which is the order in which the rows must be accumulated into
+  /// the R matrix by computeCoefficients(). X need not be sorted.
+  QVector<int> pointOrder;
+
+  /// The values of the non-zero splines and their derivatives, for
+  /// each point: the value of the k-th non-zero spline for the
+  /// derivative d at point i is splines[(i * (maxOrder+1) + d) *
+  /// order + k]
+  Vector splines;
 
   /// Storage space for the all-orders-in-one-go splines evaluation
   gsl_matrix * storage;
 
-  /// Storage space for the covariance matrix
-  gsl_matrix * cov;
+  /// Storage space for the banded R matrix of the QR decomposition
+  /// (nbCoeffs x order, the element k of row j being R(j, j+k)), and
+  /// for the corresponding transformed right-hand side.
+  Vector rMatrix, rhs;
 
   /// Total number of coefficients
   int nbCoeffs;
@@ -92,6 +105,11 @@ class BSplines {
   /// Allocates all the necessary things
   void allocateWS();
 
+  /// Evaluates the non-zero splines (and their derivatives up to @a
+  /// nderiv) at @a x, into @a target, a order x (nderiv + 1) matrix,
+  /// and returns the index of the first one.
+  int evaluateNonZero(double x, int nderiv, gsl_matrix * target) const;
+
 public:
 
   BSplines(const Vector & xvalues, 
@@ -0,0 +1,259 @@
+/*
+  commandserver.cc: running commands sent through a local socket
+  Copyright 2021 by CNRS/AMU
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <headers.hh>
+#include <commandserver.hh>
+
+#include <commandwidget.hh>
+#include <commandlineparser.hh>
+#include <terminal.hh>
+#include <soas.hh>
+#include <datastack.hh>
+#include <dataset.hh>
+#include <statistics.hh>
+#include <mainwin.hh>
+#include <exceptions.hh>
+
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QBuffer>
+
+static QString serverName;
+
+static CommandLineOption srv("--server", [](const QStringList & args) {
+    serverName = args[0];
+  }, 1, "listens for scripts to run on the given local socket");
+
+CommandServer * CommandServer::theServer = NULL;
+
+
+ServerOutput::ServerOutput(QLocalSocket * c) : client(c)
+{
+  open(QIODevice::WriteOnly);
+}
+
+qint64 ServerOutput::readData(char * /*data*/, qint64 /*maxSize*/)
+{
+  return -1;
+}
+
+qint64 ServerOutput::writeData(const char * data, qint64 size)
+{
+  QString text = QString::fromUtf8(data, size);
+  // The socket can only be used from its own thread.
+  if(QThread::currentThread() == thread())
+    sendOutput(text);
+  else
+    QMetaObject::invokeMethod(this, "sendOutput", Qt::QueuedConnection,
+                              Q_ARG(QString, text));
+  return size;
+}
+
+void ServerOutput::sendOutput(const QString & text)
+{
+  if(client) {
+    QJsonObject obj;
+    obj["output"] = text;
+    CommandServer::sendObject(client, obj);
+  }
+}
+
+void ServerOutput::flushPending()
+{
+  QCoreApplication::sendPostedEvents(this, QEvent::MetaCall);
+}
+
+//////////////////////////////////////////////////////////////////////
+
+CommandServer::CommandServer(const QString & name) :
+  busy(false)
+{
+  server = new QLocalServer(this);
+  server->setSocketOptions(QLocalServer::UserAccessOption);
+  if(! server->listen(name)) {
+    // The socket may be left over by a server that crashed, in which
+    // case nothing answers, and we can remove it.
+    QLocalSocket probe;
+    probe.connectToServer(name);
+    if(probe.waitForConnected(200))
+      throw RuntimeError("A server is already listening on '%1'").
+        arg(name);
+    QLocalServer::removeServer(name);
+    if(! server->listen(name))
+      throw RuntimeError("Could not listen on '%1': %2").
+        arg(name).arg(server->errorString());
+  }
+  connect(server, SIGNAL(newConnection()), SLOT(acceptConnections()));
+  Terminal::out << "Listening for scripts on: "
+                << server->fullServerName() << endl;
+}
+
+CommandServer::~CommandServer()
+{
+  server->close();
+}
+
+bool CommandServer::startServer()
+{
+  if(serverName.isEmpty())
+    return false;
+  if(! theServer)
+    theServer = new CommandServer(serverName);
+  return true;
+}
+
+void CommandServer::sendObject(QLocalSocket * client,
+                               const QJsonObject & obj)
+{
+  client->write(QJsonDocument(obj).toJson(QJsonDocument::Compact) + "\n");
+  // The scripts are run synchronously, so we need to push the data
+  // as soon as possible.
+  client->flush();
+}
+
+void CommandServer::acceptConnections()
+{
+  while(server->hasPendingConnections()) {
+    QLocalSocket * client = server->nextPendingConnection();
+    connect(client, SIGNAL(readyRead()), SLOT(readRequests()));
+    connect(client, SIGNAL(disconnected()), client, SLOT(deleteLater()));
+  }
+}
+
+void CommandServer::readRequests()
+{
+  QLocalSocket * client = qobject_cast<QLocalSocket *>(sender());
+  if(! client)
+    return;
+  while(client->canReadLine()) {
+    QByteArray line = client->readLine();
+    QJsonParseError err;
+    QJsonDocument doc = QJsonDocument::fromJson(line, &err);
+    if(! doc.isObject()) {
+      QJsonObject obj;
+      obj["status"] = "error";
+      obj["message"] = QString("Invalid request: %1").
+        arg(doc.isNull() ? err.errorString() :
+            QString("not a JSON object"));
+      sendObject(client, obj);
+      continue;
+    }
+    QJsonObject obj = doc.object();
+    Request rq;
+    rq.client = client;
+    rq.script = obj["script"].toString();
+    for(const QJsonValue & v : obj["args"].toArray())
+      rq.args << v.toString();
+    rq.directory = obj["directory"].toString();
+    rq.shutdown = obj["shutdown"].toBool();
+    queue << rq;
+  }
+  QMetaObject::invokeMethod(this, "processQueue", Qt::QueuedConnection);
+}
+
+void CommandServer::processQueue()
+{
+  if(busy)
+    return;                     // will be processed by the running loop
+  busy = true;
+  while(queue.size() > 0) {
+    Request rq = queue.takeFirst();
+    runRequest(rq);
+  }
+  busy = false;
+}
+
+void CommandServer::runRequest(const Request & request)
+{
+  if(! request.client)
+    return;                     // The client is gone
+
+  QJsonObject result;
+  if(request.shutdown) {
+    result["status"] = "success";
+    sendObject(request.client, result);
+    request.client->waitForBytesWritten(1000);
+    qApp->quit();
+    return;
+  }
+
+  int errorsBefore = soas().runtimeErrors + soas().internalErrors +
+    soas().headlessErrors;
+
+  ServerOutput output(request.client);
+  QTextStream * spy = new QTextStream(&output);
+  spy->setCodec("UTF-8");
+  Terminal::out.addSpy(spy);
+
+  // The directory is restored at the end of the request, so that it
+  // does not carry over to the next one.
+  QString previousDirectory = QDir::currentPath();
+
+  try {
+    if(! request.directory.isEmpty() &&
+       ! QDir::setCurrent(request.directory))
+      throw RuntimeError("Could not cd to '%1'").arg(request.directory);
+    QByteArray script = request.script.toUtf8();
+    QBuffer source(&script);
+    source.open(QIODevice::ReadOnly);
+    switch(soas().prompt().runCommandFile(&source, request.args)) {
+    case CommandWidget::Success:
+      result["status"] = "success";
+      break;
+    case CommandWidget::Error:
+      result["status"] = "error";
+      break;
+    case CommandWidget::ControlOut:
+      result["status"] = "stopped";
+      break;
+    }
+  }
+  catch(const Exception & e) {
+    result["status"] = "error";
+    result["message"] = e.message();
+  }
+  Terminal::out << flush;
+  Terminal::out.removeSpy(spy);
+  delete spy;
+  output.flushPending();
+
+  if(QDir::currentPath() != previousDirectory) {
+    if(! QDir::setCurrent(previousDirectory))
+      Terminal::out << "Could not go back to '" << previousDirectory
+                    << "'" << endl;
+    soas().mainWin().updateWindowName();
+  }
+
+  if(! request.client)
+    return;
+
+  result["errors"] = soas().runtimeErrors + soas().internalErrors +
+    soas().headlessErrors - errorsBefore;
+  result["stack"] = soas().stack().totalSize();
+  const DataSet * ds = soas().stack().currentDataSet(true);
+  if(ds) {
+    Statistics st(ds);
+    ValueHash stats = st.stats();
+    QJsonObject s;
+    for(QHash<QString, QVariant>::const_iterator it = stats.constBegin();
+        it != stats.constEnd(); ++it)
+      s[it.key()] = QJsonValue::fromVariant(it.value());
+    result["stats"] = s;
+  }
+  sendObject(request.client, result);
+}
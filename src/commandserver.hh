@@ -0,0 +1,133 @@
+/**
+   \file commandserver.hh
+   A server running commands sent through a local socket
+   Copyright 2021 by CNRS/AMU
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <headers.hh>
+#ifndef __COMMANDSERVER_HH
+#define __COMMANDSERVER_HH
+
+class QLocalServer;
+class QLocalSocket;
+
+/// Forwards the terminal output to a client of the server. It can be
+/// written to from any thread, but the output is always sent to the
+/// client from the thread of the output object.
+class ServerOutput : public QIODevice {
+  Q_OBJECT;
+
+  QPointer<QLocalSocket> client;
+protected:
+  virtual qint64 readData(char * data, qint64 maxSize) override;
+
+  virtual qint64 writeData(const char * data, qint64 size) override;
+
+protected slots:
+  /// Sends the given text as an "output" element to the client
+  void sendOutput(const QString & text);
+
+public:
+  explicit ServerOutput(QLocalSocket * c);
+
+  /// Sends the output written from other threads that is still
+  /// waiting.
+  void flushPending();
+};
+
+/// Listens on a local socket (a UNIX domain socket on Unix systems)
+/// for scripts to run in the current QSoas session, so that the
+/// stack, the fits and the caches are kept from one script to the
+/// next.
+///
+/// The protocol is line-based: each line sent by a client is a JSON
+/// object describing a request:
+/// @li "script": the text of the script to run;
+/// @li "args": the arguments of the script, as for @ (optional);
+/// @li "directory": the directory in which to run the script
+/// (optional); the current directory is restored after each request;
+/// @li "shutdown": if true, stops the server and quits QSoas.
+///
+/// The requests are run one at a time, in the order in which they
+/// arrive, regardless of the client. While the script runs, the
+/// server sends {"output": "..."} lines with the terminal output, and
+/// finishes with a line containing a "status" element ("success",
+/// "error" or "stopped"), the number of "errors", an error "message"
+/// if the script failed with an exception, the size of the "stack"
+/// and the "stats" of the current dataset.
+class CommandServer : public QObject {
+  Q_OBJECT;
+
+  /// A request waiting to be run
+  class Request {
+  public:
+    /// The client, which may have disconnected in the meantime
+    QPointer<QLocalSocket> client;
+
+    /// The script
+    QString script;
+
+    /// Its arguments
+    QStringList args;
+
+    /// The directory
+    QString directory;
+
+    /// Whether the request is to shut down the server
+    bool shutdown;
+
+    Request() : shutdown(false) {
+    };
+  };
+
+  /// The server
+  QLocalServer * server;
+
+  /// The requests waiting to be run
+  QList<Request> queue;
+
+  /// Whether a request is currently running. The scripts process
+  /// events, so new requests may arrive while one is running.
+  bool busy;
+
+  /// Runs the given request
+  void runRequest(const Request & request);
+
+  /// Sends the given object as a line to the client
+  static void sendObject(QLocalSocket * client, const QJsonObject & obj);
+
+  static CommandServer * theServer;
+
+  explicit CommandServer(const QString & name);
+
+protected slots:
+  void acceptConnections();
+
+  void readRequests();
+
+  void processQueue();
+
+public:
+  ~CommandServer();
+
+  /// Starts the server if a name was given on the command-line using
+  /// --server. Returns true if the server was started.
+  static bool startServer();
+
+  friend class ServerOutput;
+};
+
+#endif
@@ -35,6 +35,7 @@
 #include <mruby.hh>
 
 #include <debug.hh>
+#include <profiler.hh>
 #include <commandlineparser.hh>
 #include <file.hh>
 
@@ -213,7 +214,7 @@ CommandWidget::CommandWidget(CommandContext * c) :
       }
       QFile * f = new QFile(logFileName);
       f->open(QIODevice::Append);
-      Terminal::out.addSpy(f);
+      Terminal::out.addLogFile(f);
       Terminal::out << "Opening log file: " << logFileName << endl;
     }
 
@@ -356,6 +357,7 @@ bool CommandWidget::runCommand(const QStringList & raw, bool doFullPrompt)
         throw HeadlessError("Cannot run interactive command '%1' in headless mode").arg(name);
 
     }
+    ProfilerSection section(name);
     command->runCommand(name, arguments, options);
   }
   catch(const RuntimeError & error) {
@@ -411,6 +413,7 @@ bool CommandWidget::runCommand(const QStringList & raw, bool doFullPrompt)
                   << "\nThis is probably not going to end well" << endl;
   }
   Debug::debug().endCommand(raw);
+  mr->collectAtCommandBoundary();
   commandLine->busy(lastMessage);
   stopButton->setEnabled(! lastMessage.isEmpty());
   return status;
@@ -634,6 +637,7 @@ void CommandWidget::printCurrentDataSetInfo()
 
 QString CommandWidget::terminalContents() const
 {
+  Terminal::out.flushDisplay();
   return terminalDisplay->toPlainText();
 }
 
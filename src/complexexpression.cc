@@ -143,22 +143,26 @@ mrb_value ComplexExpression::rubyEvaluation(const double * values) const
 {
   MRuby * mr = MRuby::ruby();
   // QTextStream o(stdout);
+  bool reuse = MRuby::reuseFloatArguments();
+  QVarLengthArray<mrb_value, 16> a(argsSize);
   for(int i = 0; i < argsSize; i++) {
     if(i == 0) {
       gsl_complex * c = mr->complexInternal(args[i]);
       GSL_SET_COMPLEX(c, values[0], values[1]);
+      a[i] = args[i];
       // o << " * s = " << values[0] << "\tI+\t" << values[1] << endl;
     }
     else {
       // +1 since the first variable takes two spots
       double val = values[indexInVariables[i] + 1];
-      SET_FLOAT_VALUE(mr->mrb, args[i], val);
+      a[i] = MRuby::floatArgument(mr->mrb, args[i], val, reuse);
       // o << " * #" << i << ": " << val << endl;
     }
     // mrb_p(mr->mrb, args[i]);
   }
 
-  mrb_value rv = mr->funcall(code, Expression::callSym(), argsSize, args);
+  mrb_value rv = mr->funcall(code, Expression::callSym(), argsSize,
+                             a.constData());
   // mrb_p(mr->mrb, rv);
   return rv;
 }
@@ -45,6 +45,9 @@
 #include <datasetoptions.hh>
 #include <metadataprovider.hh>
 #include <metadatafile.hh>
+#include <profiler.hh>
+#include <taskscheduler.hh>
+#include <idioms.hh>
 
 // I guess I have to include it from here...
 #include <datasetbrowser.hh>
@@ -199,47 +202,112 @@ DataBackend * DataBackend::backendForStream(QIODevice * stream,
   return backend;
 }
 
-QList<DataSet *> DataBackend::loadFile(const QString & fileName, 
-                                       const CommandOptions & opts, 
-                                       bool verbose)
-{
-  File file(fileName, File::BinaryRead);
+/// The result of reading a file in advance.
+class PreloadedFile {
+public:
+  /// Whether the file was read in advance at all
+  bool read;
+
+  /// The datasets read
+  QList<DataSet *> datasets;
 
-  bool ignoreCache = false;
-  updateFromOptions(opts, "ignore-cache", ignoreCache);
+  /// The backend detected
+  DataBackend * backend;
+
+  /// The error message, if reading failed.
+  QString error;
+
+  /// The messages that would have been written to the terminal
+  QStringList messages;
+
+  PreloadedFile() : read(false), backend(NULL) {;};
+
+  /// Writes the messages to the terminal, and throws the error if
+  /// there was one.
+  void report() const {
+    for(const QString & m : messages)
+      Terminal::out << m << endl;
+    if(! error.isEmpty())
+      throw RuntimeError(error);
+  };
+};
+
+CachedDataSets * DataBackend::validCache(const QString & fileName,
+                                         const CommandOptions & opts,
+                                         QString * key, bool * ignoreCache)
+{
+  *ignoreCache = false;
+  updateFromOptions(opts, "ignore-cache", *ignoreCache);
 
   for(CommandOptions::const_iterator i = opts.begin(); i != opts.end(); ++i) {
     if(! nonBackendOptions.contains(i.key()))
-       ignoreCache = true;
+       *ignoreCache = true;
   }
 
   /// @todo Switch to using a File-based class...
+  File file(fileName, File::BinaryRead);
   FileInfo info = file.info();
-  QString key = info.canonicalFilePath();
+  *key = info.canonicalFilePath();
   QDateTime lastModified = info.lastModified();
   QDateTime metaModified = MetaDataFile::metaDataLastModified(fileName);
   if(metaModified.isValid() && metaModified > lastModified)
     lastModified = metaModified; // so we reload if the meta is too young.
 
-  QList<DataSet *> datasets;
+  CachedDataSets * cached = cacheForFile(*key);
+  if(! cached || cached->date < lastModified || *ignoreCache)
+    return NULL;
+  return cached;
+}
 
-  if(verbose)
-    Terminal::out << "Loading file: '" << fileName << "' ";
-  
-  CachedDataSets * cached = cacheForFile(key);
+QList<DataSet *> DataBackend::detectAndRead(const QString & fileName,
+                                            const CommandOptions & opts,
+                                            DataBackend ** backend)
+{
+  ProfilerTimer t(Profiler::IO);
+  File file(fileName, File::BinaryRead);
+  DataBackend * b = backendForStream(file, fileName);
+  if(! b)
+    throw RuntimeError(QObject::tr("No backend found to load '%1'").
+                       arg(fileName));
+  QList<DataSet *> datasets = b->readFromStream(file, fileName, opts);
+
+  for(DataSet * d : datasets)
+    d->setMetaData("backend", b->name);
+  *backend = b;
+  return datasets;
+}
 
-  if(! cached || cached->date < lastModified || ignoreCache) {
-    // Utils::open(&file, QIODevice::ReadOnly);
+QList<DataSet *> DataBackend::loadFile(const QString & fileName, 
+                                       const CommandOptions & opts, 
+                                       bool verbose)
+{
+  return loadFile(fileName, opts, verbose, NULL);
+}
 
-    DataBackend * b = backendForStream(file, fileName);
-    if(! b)
-      throw RuntimeError(QObject::tr("No backend found to load '%1'").
-                         arg(fileName));
-    datasets = b->readFromStream(file, fileName, opts);
+QList<DataSet *> DataBackend::loadFile(const QString & fileName, 
+                                       const CommandOptions & opts, 
+                                       bool verbose,
+                                       PreloadedFile * preloaded)
+{
+  QString key;
+  bool ignoreCache;
+  CachedDataSets * cached = validCache(fileName, opts, &key, &ignoreCache);
 
-    for(DataSet * d : datasets)
-      d->setMetaData("backend", b->name);
+  QList<DataSet *> datasets;
 
+  if(verbose)
+    Terminal::out << "Loading file: '" << fileName << "' ";
+  
+  if(! cached) {
+    DataBackend * b = NULL;
+    if(preloaded && preloaded->read) {
+      preloaded->report();
+      datasets = preloaded->datasets;
+      preloaded->datasets.clear();
+      b = preloaded->backend;
+    }
+    else
+      datasets = detectAndRead(fileName, opts, &b);
 
     if(verbose)
       Terminal::out << "using backend " << b->name << endl;
@@ -262,9 +330,23 @@ ArgumentList DataBackend::loadOptions() const
   return ArgumentList();
 }
 
+QList<DataSet *> DataBackend::readFile(const QString & fileName, 
+                                       const CommandOptions & opts,
+                                       PreloadedFile * preloaded) const
+{
+  if(preloaded && preloaded->read) {
+    preloaded->report();
+    QList<DataSet *> datasets = preloaded->datasets;
+    preloaded->datasets.clear();
+    return datasets;
+  }
+  return readFile(fileName, opts);
+}
+
 QList<DataSet *> DataBackend::readFile(const QString & fileName, 
                                        const CommandOptions & opts) const
 {
+  ProfilerTimer t(Profiler::IO);
   File file(fileName, File::BinaryRead);
   QList<DataSet *> datasets = readFromStream(file, fileName, opts);
   for(DataSet * d : datasets)
@@ -274,6 +356,83 @@ QList<DataSet *> DataBackend::readFile(const QString & fileName,
 
 
 
+QVector<PreloadedFile> DataBackend::preloadFiles(const QStringList & files,
+                                                const CommandOptions & opts,
+                                                DataBackend * backend)
+{
+  QVector<PreloadedFile> rv(files.size());
+  if(files.size() < 2 || TaskScheduler::scheduler()->threadNumber() < 2)
+    return rv;
+
+  // First, on the main thread, the list of files that need reading.
+  // Inline files and files within archives go through the normal,
+  // sequential, path.
+  QList<int> toRead;
+  for(int i = 0; i < files.size(); i++) {
+    const QString & f = files[i];
+    if(! File::inlineFileName(f).isEmpty())
+      continue;
+    if(! QFileInfo(Utils::expandTilde(f)).isFile())
+      continue;
+    if(! backend) {
+      QString key;
+      bool ignoreCache;
+      if(validCache(f, opts, &key, &ignoreCache))
+        continue;
+    }
+    toRead << i;
+  }
+  if(toRead.size() < 2)
+    return rv;
+
+  TaskGroup group("load");
+  for(int i : toRead) {
+    PreloadedFile * target = &rv[i];
+    QString fileName = files[i];
+    group.run([target, fileName, &opts, backend]() {
+        // The messages are only written when the main thread gets
+        // to that file.
+        TemporaryThreadLocalChange<QStringList *>
+          msgs(MetaDataProvider::deferredMessages, &target->messages);
+        TemporaryThreadLocalChange<QStringList *>
+          out(Terminal::deferredOutput, &target->messages);
+        // Whatever goes wrong only affects this file.
+        try {
+          if(backend)
+            target->datasets = backend->readFile(fileName, opts);
+          else
+            target->datasets = detectAndRead(fileName, opts,
+                                             &target->backend);
+        }
+        catch(const RuntimeError & e) {
+          target->error = e.message();
+        }
+        catch(const Exception & e) {
+          target->error = QString("Internal error: %1").arg(e.message());
+        }
+        catch(const std::bad_alloc &) {
+          target->error = "Out of memory";
+        }
+        catch(const std::exception & e) {
+          target->error = QString("Unexpected error: %1").arg(e.what());
+        }
+        catch(...) {
+          target->error = "Unknown error";
+        }
+        target->read = true;
+      });
+  }
+  try {
+    group.wait();
+  }
+  catch(...) {
+    for(PreloadedFile & p : rv)
+      qDeleteAll(p.datasets);
+    throw;
+  }
+  return rv;
+}
+
 void DataBackend::loadFilesAndDisplay(bool update, QStringList files, 
                                       const CommandOptions & opts,
                                       DataBackend * backend)
@@ -292,11 +451,13 @@ void DataBackend::loadFilesAndDisplay(bool update, QStringList files,
   int expected = -1;
   updateFromOptions(opts, "expected", expected);
 
+  QVector<PreloadedFile> preloaded = preloadFiles(files, opts, backend);
+
   for(int i = 0; i < files.size(); i++) {
     try {
       QList<DataSet *> dss = 
-        (backend ? backend->readFile(files[i], opts) : 
-         DataBackend::loadFile(files[i], opts));
+        (backend ? backend->readFile(files[i], opts, &preloaded[i]) : 
+         DataBackend::loadFile(files[i], opts, true, &preloaded[i]));
 
       if(dss.size() > 1)
         Terminal::out << " -> got " << dss.size() << " datasets" << endl;
@@ -30,6 +30,10 @@ class DataSet;
 /// This is an element of the cache. Implementation internal.
 class CachedDataSets;
 
+/// The result of reading a file in advance, on a worker
+/// thread. Implementation internal.
+class PreloadedFile;
+
 
 /// The base class of a series that reads data from files.
 ///
@@ -70,6 +74,43 @@ class DataBackend {
   /// Adds the given results for the given file
   static void addToCache(const QString & file,
                          const QList<DataSet *> & datasets);
+
+  /// Returns the cached datasets for the given file if they are
+  /// still valid and the options allow using the cache, or NULL if
+  /// the file must be read again. \a key is set to the key for the
+  /// cache, and \a ignoreCache to whether the results should not be
+  /// cached.
+  static CachedDataSets * validCache(const QString & fileName,
+                                     const CommandOptions & opts,
+                                     QString * key, bool * ignoreCache);
+
+  /// Detects the backend and reads the file, without the cache.
+  static QList<DataSet *> detectAndRead(const QString & fileName,
+                                        const CommandOptions & opts,
+                                        DataBackend ** backend);
+
+  /// Reads in advance, concurrently using the TaskScheduler, all the
+  /// \a files that need reading (i.e. that are not in the cache) and
+  /// that can be read from a worker thread.
+  ///
+  /// The returned list has the same size as \a files, the
+  /// corresponding elements are used by loadFile() and readFile().
+  static QVector<PreloadedFile> preloadFiles(const QStringList & files,
+                                             const CommandOptions & opts,
+                                             DataBackend * backend);
+
+  /// Same as loadFile(), but using the results of preloadFiles() if
+  /// available.
+  static QList<DataSet *> loadFile(const QString & fileName, 
+                                   const CommandOptions & opts, 
+                                   bool verbose,
+                                   PreloadedFile * preloaded);
+
+  /// Same as readFile(), but using the results of preloadFiles() if
+  /// available.
+  QList<DataSet *> readFile(const QString & fileName, 
+                            const CommandOptions & opts,
+                            PreloadedFile * preloaded) const;
   
 
 protected:
@@ -183,6 +224,10 @@ public:
 
   /// Load files using the given backend (or with backend detection
   /// should the backend pointer be NULL) and display them.
+  ///
+  /// When there are several files, they are read concurrently on
+  /// the worker threads of the TaskScheduler, but the datasets are
+  /// processed and pushed in the order of \a files.
   static void loadFilesAndDisplay(bool update, QStringList files, 
                                   const CommandOptions & opts,
                                   DataBackend * backend = NULL);
@@ -1985,15 +1985,16 @@ static void statsOn(const DataSet * ds, const CommandOptions & opts,
   Statistics stats(ds);
 
   ValueHash os;
-  QList<ValueHash> byCols = stats.statsByColumns(&os);
 
   if(sns.isEmpty()) {
+    QList<ValueHash> byCols = stats.statsByColumns(&os);
     Terminal::out << "Statistics on dataset: " << ds->name << ":";
     for(int i = 0; i < ds->nbColumns(); i++)
       Terminal::out << "\n" << byCols[i].prettyPrint();
   }
   else {
-    os = os.select(sns);
+    // Only compute what is needed
+    os = stats.selectedStats(sns);
     Terminal::out << ds->name << "\t" << os.toString(QString("\t"));
   }
 
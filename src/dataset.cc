@@ -43,6 +43,9 @@
 #include <file.hh>
 
 #include <mruby.hh>
+
+#include <taskscheduler.hh>
+
 #include <idioms.hh>
 #include <statistics.hh>
 
@@ -87,10 +90,35 @@ Vector & DataSet::column(int i) {
   if(i >= columns.size())
     throw RuntimeError("Trying to access the %1th column, when dataset has only %2").
       arg(i+1).arg(columns.size());
-  invalidateCache();
+  invalidateColumnCache(i);
   return columns[i];
 }
 
+QMutex DataSet::cacheMutex(QMutex::Recursive);
+
+void DataSet::invalidateColumnCache(int col)
+{
+  cache.valid.storeRelease(0);
+  if(col < cache.upToDate.size())
+    cache.upToDate[col] = false;
+
+  if(cache.statistics.isEmpty())
+    return;
+  if(col == 0) {
+    // Many column stats depend on X
+    cache.statistics.clear();
+    return;
+  }
+  QHash<QPair<const StatisticsValue *, int>, QList<QVariant> >::iterator it =
+    cache.statistics.begin();
+  while(it != cache.statistics.end()) {
+    if(it.key().second == col)
+      it = cache.statistics.erase(it);
+    else
+      ++it;
+  }
+}
+
 
 
 void DataSet::dump() const
@@ -145,24 +173,53 @@ QString DataSet::stringDescription(bool longDesc) const
 
 void DataSet::regenerateCache() const
 {
+  // Recursive, as the thread waiting for the tasks below may run
+  // tasks that regenerate the cache of other datasets.
+  QMutexLocker l(&cacheMutex);
   if(isCacheValid())
     return;
 
   int size = columns.size();
-  cache.minima.resize(size);
-  cache.maxima.resize(size);
+  if(cache.upToDate.size() != size) {
+    cache.upToDate.fill(false, size);
+    cache.minima.resize(size);
+    cache.maxima.resize(size);
 
-  cache.finiteMinima.resize(size);
-  cache.finiteMaxima.resize(size);
+    cache.finiteMinima.resize(size);
+    cache.finiteMaxima.resize(size);
+  }
 
+  QVector<int> todo;
+  qint64 points = 0;
   for(int i = 0; i < size; i++) {
-    cache.minima[i] = columns[i].min();
-    cache.maxima[i] = columns[i].max();
-    cache.finiteMinima[i] = columns[i].finiteMin();
-    cache.finiteMaxima[i] = columns[i].finiteMax();
+    if(! cache.upToDate[i]) {
+      todo << i;
+      points += columns[i].size();
+    }
   }
-  
-  cache.valid = true;
+
+  double * mn = cache.minima.data();
+  double * mx = cache.maxima.data();
+  double * fmn = cache.finiteMinima.data();
+  double * fmx = cache.finiteMaxima.data();
+
+  // Only worth using threads for large datasets, in which case there
+  // is one task per column.
+  if(points < 1000000 || todo.size() < 2) {
+    for(int i : todo)
+      columns[i].minMax(mn + i, mx + i, fmn + i, fmx + i);
+  }
+  else {
+    TaskGroup tasks("dataset-cache");
+    for(int i : todo)
+      tasks.run([this, i, mn, mx, fmn, fmx]() {
+          columns[i].minMax(mn + i, mx + i, fmn + i, fmx + i);
+        });
+    tasks.wait();
+  }
+
+  cache.upToDate.fill(true);
+  cache.valid.storeRelease(1);
 }
 
 QRectF DataSet::boundingBox() const
@@ -27,6 +27,8 @@
 #include <valuehash.hh>
 #include <datasetoptions.hh>
 
+class StatisticsValue;
+
 /// A small helper class that maintains an ordered list of integers
 /// (duplicates being possible)
 ///
@@ -86,24 +88,50 @@ class DataSet : public Guardable {
   /// A private cache
   class Cache {
   public:
-    bool valid;
-    Cache() : valid(false) {;};
+    /// Whether the minima and maxima are valid. Atomic, since
+    /// datasets are read from worker threads.
+    QAtomicInt valid;
+    Cache() : valid(0) {;};
+
+    /// Whether the values of each column are up-to-date. When its
+    /// size does not match the number of columns, all the columns
+    /// are considered out of date.
+    QVector<bool> upToDate;
 
     QVector<double> minima;
     QVector<double> finiteMinima;
     QVector<double> maxima;
     QVector<double> finiteMaxima;
+
+    /// The values of the column statistics computed so far, indexed
+    /// by statistics and column. It is handled by Statistics, and is
+    /// not subject to the valid flag.
+    QHash<QPair<const StatisticsValue *, int>, QList<QVariant> > statistics;
   };
 
   /// An internal cache to speed up various computations.
   mutable Cache cache;
 
+  /// Serializes the updates of the caches of all the datasets, which
+  /// are done from const functions that may run in several threads
+  /// at the same time.
+  static QMutex cacheMutex;
+
+  friend class Statistics;
+
   void invalidateCache() {
-    cache.valid = false;
+    cache.valid.storeRelease(0);
+    if(! cache.upToDate.isEmpty())
+      cache.upToDate.clear();
+    if(! cache.statistics.isEmpty())
+      cache.statistics.clear();
   };
 
+  /// Invalidates the cache only for the given column.
+  void invalidateColumnCache(int col);
+
   bool isCacheValid() const {
-    return cache.valid;
+    return cache.valid.loadAcquire();
   };
 
   /// Regenerate the cache
@@ -393,7 +421,7 @@ public:
 
 
   Vector & x() {
-    invalidateCache();
+    invalidateColumnCache(0);
     return columns[0];
   };
 
@@ -402,7 +430,7 @@ public:
   };
 
   Vector & y() {
-    invalidateCache();
+    invalidateColumnCache(1);
     return columns[1];
   };
 
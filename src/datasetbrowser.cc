@@ -25,6 +25,7 @@
 
 #include <checkablewidget.hh>
 #include <nupwidget.hh>
+#include <thumbnailcache.hh>
 #include <utils.hh>
 
 #include <actioncombo.hh>
@@ -66,6 +67,9 @@ void DatasetBrowser::cleanupViews()
   for(int i = 0; i < views.size(); i++)
     delete views[i];
   views.clear();
+  for(int i = 0; i < thumbnails.size(); i++)
+    delete thumbnails[i];
+  thumbnails.clear();
   datasets.clear();
 }
 
@@ -148,6 +152,51 @@ void DatasetBrowser::pageChanged(int newpage)
   bufferDisplay->setText(QString("%1/%2").
                          arg(newpage+1).
                          arg(nup->totalPages()));
+  if(useThumbnails()) {
+    // Don't bother rendering the pages we went through
+    ThumbnailCache::cache()->dropPending();
+    schedulePrefetch();
+  }
+}
+
+void DatasetBrowser::schedulePrefetch()
+{
+  // The thumbnails only get their final size once the layout of the
+  // new page has been processed, which happens in the event loop.
+  QTimer::singleShot(0, this, SLOT(prefetchNextPage()));
+}
+
+void DatasetBrowser::prefetchNextPage()
+{
+  if(! useThumbnails())
+    return;
+  int nb = nup->nupWidth() * nup->nupHeight();
+  prefetchPage(nup->widgetIndex()/nb + 1);
+}
+
+void DatasetBrowser::resizeEvent(QResizeEvent * event)
+{
+  QDialog::resizeEvent(event);
+  if(useThumbnails())
+    schedulePrefetch();
+}
+
+bool DatasetBrowser::useThumbnails() const
+{
+  return nup->nupWidth() * nup->nupHeight() > 1;
+}
+
+void DatasetBrowser::prefetchPage(int page)
+{
+  // We can only guess the size from the current thumbnails
+  if(thumbnails.size() == 0)
+    return;
+  ThumbnailView * v = thumbnails[0]->subWidget<ThumbnailView>();
+  if(! v->isVisible())
+    return;
+  int nb = nup->nupWidth() * nup->nupHeight();
+  for(int i = page * nb; i < (page + 1) * nb && i < datasets.size(); i++)
+    ThumbnailCache::cache()->thumbnail(datasets[i], v->size());
 }
 
 void DatasetBrowser::displayDataSets(const QList<const DataSet *> &ds,
@@ -170,6 +219,18 @@ void DatasetBrowser::displayDataSets(const QList<const DataSet *> &ds,
 
 CheckableWidget * DatasetBrowser::viewForDataset(int index, int inWindow)
 {
+  if(useThumbnails()) {
+    // Curves are rendered in the background when many of them are
+    // displayed at once
+    while(thumbnails.size() <= inWindow)
+      thumbnails << new CheckableWidget(new ThumbnailView(this), this);
+    CheckableWidget * w = thumbnails[inWindow];
+    w->subWidget<ThumbnailView>()->showDataSet(datasets[index]);
+    w->useSet(&selected, index);
+    connect(w, SIGNAL(stateChanged(int)), SLOT(selectionChanged()),
+            Qt::UniqueConnection);
+    return w;
+  }
   while(views.size() <= inWindow) {
     views << new CheckableWidget(new CurveView(this), this);
   }
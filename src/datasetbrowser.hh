@@ -43,6 +43,21 @@ private:
   /// nup (were at the maximum).
   QList<CheckableWidget *> views;
 
+  /// The thumbnail views, used instead of the views when more than
+  /// one dataset is displayed at a time.
+  QList<CheckableWidget *> thumbnails;
+
+  /// Whether the thumbnails are used for the current nup.
+  bool useThumbnails() const;
+
+  /// Asks the ThumbnailCache for the thumbnails of the given page,
+  /// so that they are ready when the page is shown.
+  void prefetchPage(int page);
+
+  /// Prefetches the page following the current one once the layout
+  /// has settled.
+  void schedulePrefetch();
+
   /// The index of the currently selected datasets.
   QSet<int> selected;
 
@@ -76,6 +91,9 @@ public:
 signals:
   void currentDataSetChanged(int ds);
 
+protected:
+  void resizeEvent(QResizeEvent * event) override;
+
 public:
   void displayDataSets(const QList<const DataSet *> &ds, 
                        bool extendedSelection = true);
@@ -89,6 +107,9 @@ protected slots:
 
   void pageChanged(int newpage);
 
+  /// Prefetches the page following the current one.
+  void prefetchNextPage();
+
   /// Runs the numbered hook
   void runHook(int hook);
 
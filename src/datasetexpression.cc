@@ -57,9 +57,9 @@ void DataSetExpression::prepareVariables()
 {
   MRuby * mr = MRuby::ruby();
   if(useStats && !globals.contains("$stats")) {
-    Statistics st(dataset);
-    setGlobal("$stats", st.toRuby());
-    setGlobal("$nstats", st.toRuby(true));
+    // The statistics are only computed when they are used
+    setGlobal("$stats", Statistics::lazyRuby(dataset));
+    setGlobal("$nstats", Statistics::lazyRuby(dataset, true));
   }
 
   if(useMeta && !globals.contains("$meta"))
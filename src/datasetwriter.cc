@@ -23,13 +23,24 @@
 #include <file.hh>
 
 #include <utils.hh>
+#include <profiler.hh>
+#include <exceptions.hh>
 
 #include <general-arguments.hh>
 
+#include <QtEndian>
+#include <limits>
 
 
+
+const char DataSetWriter::binaryMagic[9] = "QSOASBIN";
+
+const quint32 DataSetWriter::binaryVersion = 1;
+
+const int DataSetWriter::binaryHeaderSize = 32;
+
 DataSetWriter::DataSetWriter() :
-  writeRowNames(false), separator("\t"), commentPrefix("#"),
+  binary(false), writeRowNames(false), separator("\t"), commentPrefix("#"),
   columnNamesPrefix("##")
 {
 }
@@ -37,6 +48,7 @@ DataSetWriter::DataSetWriter() :
 void DataSetWriter::writeData(QIODevice * target,
                               const DataSet * ds) const
 {
+  ProfilerTimer t(Profiler::IO);
   QTextStream o(target);
   o << commentPrefix  <<" saved from Soas buffer name " << ds->name << endl;
 
@@ -75,10 +87,58 @@ void DataSetWriter::writeData(QIODevice * target,
   }
 }
 
+void DataSetWriter::writeBinaryData(QIODevice * target,
+                                    const DataSet * ds) const
+{
+  ProfilerTimer t(Profiler::IO);
+  quint32 nbCols = ds->columns.size();
+  quint64 nbRows = ds->nbRows();
+  if(nbCols > 0 &&
+     nbRows > (std::numeric_limits<quint64>::max() - binaryHeaderSize)/
+     (8 * (quint64) nbCols))
+    throw RuntimeError("Dataset '%1' is too large to be saved in the binary format").
+      arg(ds->name);
+
+  uchar header[binaryHeaderSize];
+  memcpy(header, binaryMagic, 8);
+  qToLittleEndian<quint32>(binaryVersion, header + 8);
+  qToLittleEndian<quint32>(nbCols, header + 12);
+  qToLittleEndian<quint64>(nbRows, header + 16);
+  qToLittleEndian<quint64>(binaryHeaderSize + nbCols * nbRows * 8,
+                           header + 24);
+  target->write(reinterpret_cast<const char *>(header), binaryHeaderSize);
+
+  Vector buffer(nbRows, 0);
+  for(const Vector & col : ds->columns) {
+    // Columns shorter than the dataset are padded with NaNs
+    quint64 sz = std::min(nbRows, (quint64) col.size());
+    std::copy(col.constData(), col.constData() + sz, buffer.data());
+    std::fill(buffer.data() + sz, buffer.data() + nbRows,
+              std::nan(""));
+#if Q_BYTE_ORDER != Q_LITTLE_ENDIAN
+    for(double & v : buffer)
+      qToLittleEndian<quint64>(*reinterpret_cast<quint64*>(&v),
+                               reinterpret_cast<uchar *>(&v));
+#endif
+    target->write(reinterpret_cast<const char *>(buffer.constData()),
+                  nbRows * 8);
+  }
+
+  QDataStream o(target);
+  o.setVersion(QDataStream::Qt_4_8);
+  o << ds->name << ds->segments << ds->metaData
+    << ds->perpCoords << ds->flags << ds->options
+    << ds->columnNames << ds->rowNames << ds->perpCoordNames;
+}
+
 
 void DataSetWriter::writeDataSet(File * file,
                                  const DataSet * dataset) const
 {
+  if(binary) {
+    writeBinaryData(*file, dataset);
+    return;
+  }
   writeData(*file, dataset);
   writeDataSetMeta(file->info().absoluteFilePath(), dataset);
 }
@@ -134,3 +194,19 @@ void DataSetWriter::setFromOptions(const CommandOptions & opts)
   updateFromOptions(opts, "number-format", format);
   updateFromOptions(opts, "comments", commentPrefix);
 }
+
+Argument * DataSetWriter::fileFormatOption(const char * name)
+{
+  return new ChoiceArgument(QStringList() << "text" << "binary",
+                            name,
+                            "File format",
+                            "format of the file: `text` (the default) or `binary`, the native binary format of QSoas, faster to read and write, and which keeps all the meta-data within the file");
+}
+
+void DataSetWriter::setFileFormat(const CommandOptions & opts,
+                                  const char * name)
+{
+  QString fmt = binary ? "binary" : "text";
+  updateFromOptions(opts, name, fmt);
+  binary = (fmt == "binary");
+}
@@ -39,8 +39,41 @@ class DataSetWriter {
 
   /// Writes the dataset to the given device
   void writeData(QIODevice * device, const DataSet * dataset) const;
+
+  /// Writes the dataset to the given device, in binary format.
+  void writeBinaryData(QIODevice * device, const DataSet * dataset) const;
 public:
 
+  /// @name Binary format
+  ///
+  /// The binary format is made of:
+  /// @li a 32 bytes header, with the magic string (8 bytes), the
+  /// version (32 bits), the number of columns (32 bits), the number of
+  /// rows (64 bits) and the position of the trailer (64 bits);
+  /// @li the columns, one after the other, as raw little-endian
+  /// doubles;
+  /// @li the trailer, a QDataStream with the name, the segments, the
+  /// meta-data, the perpendicular coordinates, the flags, the options
+  /// and the column, row and perpendicular coordinates names.
+  ///
+  /// All integers are little-endian.
+  ///
+  /// @{
+
+  /// The magic string at the beginning of binary files
+  static const char binaryMagic[9];
+
+  /// The current version of the binary format
+  static const quint32 binaryVersion;
+
+  /// The size of the header
+  static const int binaryHeaderSize;
+
+  /// @}
+
+  /// Whether to write in the binary format rather than in text
+  bool binary;
+
   /// Whether to write row names or not
   bool writeRowNames;
 
@@ -56,7 +89,8 @@ public:
   /// A sprintf format for outputting the numbers
   QString format;
 
-  /// Writes the dataset to the given File.
+  /// Writes the dataset to the given File. Unless in binary format,
+  /// the meta-data is written to a separate file.
   void writeDataSet(File * file, const DataSet * dataset) const;
 
   /// Writes the metadata of the given dataset to the given file
@@ -73,6 +107,13 @@ public:
 
   /// Sets the writing parameters from the given options.
   void setFromOptions(const CommandOptions & opts);
+
+  /// The option to choose the file format, under the given name.
+  static Argument * fileFormatOption(const char * name);
+
+  /// Sets the file format from the option given by
+  /// fileFormatOption().
+  void setFileFormat(const CommandOptions & opts, const char * name);
 };
 
 #endif
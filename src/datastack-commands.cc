@@ -62,9 +62,10 @@ static Group stack("view", 1,
 static void saveCommand(const QString &, QString file, 
                         const CommandOptions & opts)
 {
-  File f(file, File::TextWrite, opts);
   DataSetWriter writer;
   writer.setFromOptions(opts);
+  writer.setFileFormat(opts, "format");
+  File f(file, writer.binary ? File::BinaryWrite : File::TextWrite, opts);
   DataSet * ds = soas().currentDataSet();
   writer.writeDataSet(&f, ds);
   ds->name = file;
@@ -87,6 +88,7 @@ static ArgumentList
 saveOpts(QList<Argument *>() 
          << File::fileOptions(File::OverwriteOption|File::MkPathOption)
          << DataSetWriter::writeOptions()
+         << DataSetWriter::fileFormatOption("format")
          );
 
 
@@ -129,6 +131,7 @@ static void saveBuffersCommand(const QString &,
 
   DataSetWriter writer;
   writer.setFromOptions(opts);
+  writer.setFileFormat(opts, "file-format");
   DataSet * ds = soas().currentDataSet();
 
   
@@ -156,7 +159,8 @@ static void saveBuffersCommand(const QString &,
       /// @todo This should be handled by File
       if(mkpath)
         QDir::current().mkpath(QFileInfo(nm).dir().path());
-      File f(nm, File::TextOverwrite, opts);
+      File f(nm, writer.binary ? File::BinaryOverwrite :
+             File::TextOverwrite, opts);
       writer.writeDataSet(&f, datasets[i]);
     }
   }
@@ -187,6 +191,7 @@ sBOpts(QList<Argument *>()
                            "Overwrite",
                            "if false, will not overwrite existing files (warning: default is true)")
        << DataSetWriter::writeOptions()
+       << DataSetWriter::fileFormatOption("file-format")
        );
 
 
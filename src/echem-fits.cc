@@ -32,6 +32,7 @@
 
 #include <soas.hh>
 #include <fitdata.hh>
+#include <functions.hh>
 
 #include <gsl/gsl_const_mksa.h>
 
@@ -170,6 +171,62 @@ public:
     return rv;
   };
 
+  /// Same computation as above, but for all the points at once,
+  /// computing the exponentials by arrays.
+  virtual void function(const double * a, FitData * data,
+                        const DataSet * ds,
+                        gsl_vector * target) const override {
+    Storage * s = storage<Storage>(data);
+
+    double fara = GSL_CONST_MKSA_FARADAY /
+      (a[0] * GSL_CONST_MKSA_MOLAR_GAS);
+
+    const Vector & xv = ds->x();
+    const double * x = xv.constData();
+    int sz = xv.size();
+    Vector values(sz, 0), exps(sz, 0), rels(sz, 0),
+      numers(sz, 0), denoms(sz, 0);
+    double * rv = values.data();
+    double * ex = exps.data();
+    double * rel = rels.data();
+    double * numer = numers.data();
+    double * denom = denoms.data();
+
+    int offset = 1;
+    int nbs = s->number.size();
+    for(int j = 0; j < nbs; j++) {
+      int nb = s->number[j];
+      const double * ampl = a+offset;
+      const double * couples = ampl + nb;
+      offset += 3*nb - 2;
+
+      for(int k = 0; k < sz; k++) {
+        rel[k] = 1;
+        denom[k] = 1;
+        numer[k] = *ampl;
+      }
+      ++ampl;
+      for(int i = 1; i < nb; i++) {
+        double fn = fara * couples[1];
+        double e0 = couples[0];
+        for(int k = 0; k < sz; k++)
+          ex[k] = fn * (x[k] - e0);
+        Functions::expArray(ex, ex, sz);
+        for(int k = 0; k < sz; k++) {
+          rel[k] *= ex[k];
+          denom[k] += rel[k];
+          numer[k] += *ampl * rel[k];
+        }
+        couples += 2;
+        ++ampl;
+      }
+      for(int k = 0; k < sz; k++)
+        rv[k] += numer[k]/denom[k];
+    }
+    for(int k = 0; k < sz; k++)
+      gsl_vector_set(target, k, rv[k]);
+  };
+
   virtual void initialGuess(FitData * data, 
                             const DataSet *ds,
                             double * a) const override
@@ -473,44 +530,59 @@ protected:
       (a[0] * GSL_CONST_MKSA_MOLAR_GAS);
     const double & scan_rate = a[1];
 
-    for(int i = 0; i < xv.size(); i++) {
-      double cur = 0;
-
+    // The species are computed one at a time over all the points, so
+    // that the exponentials can be computed by arrays.
+    int sz = xv.size();
+    const double * x = xv.constData();
+    Vector currents(sz, 0), exps(sz, 0);
+    double * cur = currents.data();
+    double * e = exps.data();
       
-      int idx = (s->distinct ? 2 : 3);
-
-      // These are always considered 1-el peaks :
-      for(int j = 0; j < s->number; j++) {
-        // Assignments for readability, I hope they're optimized out.
-        const double & gamma = a[s->distinct ? idx++ : 2];
-        const double & e0 = a[idx++];
-        const double & n = a[idx++];
-        double e = exp(fara * n * (xv[i] - e0));
+    int idx = (s->distinct ? 2 : 3);
+
+    // These are always considered 1-el peaks :
+    for(int j = 0; j < s->number; j++) {
+      // Assignments for readability, I hope they're optimized out.
+      const double & gamma = a[s->distinct ? idx++ : 2];
+      const double & e0 = a[idx++];
+      const double & n = a[idx++];
+      double fn = fara * n;
+      for(int i = 0; i < sz; i++)
+        e[i] = fn * (x[i] - e0);
+      Functions::expArray(e, e, sz);
+      for(int i = 0; i < sz; i++) {
         double spec = scan_rate * n * 1 * GSL_CONST_MKSA_FARADAY * 
-          fara * gamma * e/((1 + e)*(1 + e)) * sign;
+          fara * gamma * e[i]/((1 + e[i])*(1 + e[i])) * sign;
         if(annotations)
           (*annotations)[j][i] = spec;
-        cur += spec;
+        cur[i] += spec;
       }
+    }
 
-      for(int j = s->number; j < s->number + s->twoElectrons; j++) {
-        const double & gamma = a[s->distinct ? idx++ : 2];
-        const double & e0 = a[idx++];
-        const double & deltae = a[idx++];
-
-        double sqrt_k = exp(fara * 0.5 * deltae);
-        double sqrt_eps = exp(fara * (xv[i] - e0));
+    for(int j = s->number; j < s->number + s->twoElectrons; j++) {
+      const double & gamma = a[s->distinct ? idx++ : 2];
+      const double & e0 = a[idx++];
+      const double & deltae = a[idx++];
+
+      double sqrt_k = exp(fara * 0.5 * deltae);
+      for(int i = 0; i < sz; i++)
+        e[i] = fara * (x[i] - e0);
+      Functions::expArray(e, e, sz);
+      for(int i = 0; i < sz; i++) {
+        double sqrt_eps = e[i];
         double denom = sqrt_eps + sqrt_k + 1/sqrt_eps;
         double spec = scan_rate * GSL_CONST_MKSA_FARADAY * 
           fara * gamma * sqrt_k * (sqrt_eps + 4/sqrt_k + 1/sqrt_eps)/
           (denom * denom);
         if(annotations)
           (*annotations)[j][i] = spec;
-        cur += spec;
+        cur[i] += spec;
       }
+    }
 
-      if(target)
-        gsl_vector_set(target, i, cur);
+    if(target) {
+      for(int i = 0; i < sz; i++)
+        gsl_vector_set(target, i, cur[i]);
     }
   };
 
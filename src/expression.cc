@@ -22,6 +22,7 @@
 #include <exceptions.hh>
 
 #include <mruby.hh>
+#include <profiler.hh>
 
 mrb_sym Expression::callSymCache = 0;
 
@@ -232,12 +233,18 @@ const QStringList & Expression::locals() const
 
 mrb_value Expression::rubyEvaluation(const double * values) const
 {
+  ProfilerTimer t(Profiler::RubyEvaluation);
   // Should this be cached at the Expression level ?
   MRuby * mr = MRuby::ruby();
+  // The preallocated floats in args are always kept, the arguments
+  // actually passed are either them or new floats.
+  bool reuse = MRuby::reuseFloatArguments();
+  QVarLengthArray<mrb_value, 16> a(argsSize);
   for(int i = 0; i < argsSize; i++)
-    SET_FLOAT_VALUE(mr->mrb, args[i], values[indexInVariables[i]]);
+    a[i] = MRuby::floatArgument(mr->mrb, args[i],
+                                values[indexInVariables[i]], reuse);
 
-  mrb_value rv = mr->funcall(code, callSym(), argsSize, args);
+  mrb_value rv = mr->funcall(code, callSym(), argsSize, a.constData());
   return rv;
 }
 
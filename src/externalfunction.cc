@@ -28,35 +28,38 @@ QHash<QString, double> ExternalFunction::defaultValues() const
   return rv;
 }
 
+int ExternalFunction::concurrency() const
+{
+  return 1;
+}
+
 ExternalFunction::~ExternalFunction()
 {
 }
 
 //////////////////////////////////////////////////////////////////////
 
-
-/// This class implements an ExternalFunction using a client/server
-/// model ith simple JSON exchange.
-///
-/// The client sends a JSON dict with an array of X values and an
-/// array for the parameters (same size as what is returned by
-/// parameters()). The server replies with a JSON array of the
-/// computed values.
+/// An ExternalWorker is a single external process doing the
+/// computations for an ExternalFunction.
 ///
-/// In both directions, the communication is finished by sending a
-/// '// -> DONE' string terminated with a newline.
-///
-/// The object sent contains two elements: "parameters" and "xvalues"
+/// A worker is not thread-safe: it must only be used by one thread
+/// at a time, which must call attachToCurrentThread() before using
+/// it, and detach() when it is done.
 ///
 /// @todo Implement timeout.
-class JSONBasedFunction : public ExternalFunction {
+class ExternalWorker {
 protected:
 
   QProcess * process;
 
-  /// This function starts the process, or restarts it in case it died
-  /// unexpectedly.
-  virtual void spawn() = 0;
+  /// Starts the process
+  void start(const QString & program, const QStringList & args) {
+    process = new QProcess();
+    process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    process->start(program, args,
+                   QIODevice::ReadWrite|QIODevice::Unbuffered);
+    process->waitForStarted();
+  };
 
   /// Reads a line from the subprocess
   QByteArray readLine() {
@@ -75,12 +78,36 @@ protected:
     return rv;
   };
 
+  /// Waits until a full line is available from the subprocess, and
+  /// returns it.
+  QByteArray waitForLine() {
+    QByteArray rv;
+    while(true) {
+      rv += readLine();
+      if(rv.endsWith('\n'))
+        return rv;
+      if(process->state() == QProcess::NotRunning)
+        throw RuntimeError("Premature end of subprocess %1 %2").
+          arg(process->program()).arg(process->arguments().join(" "));
+      process->waitForReadyRead();
+    }
+    return rv;
+  };
+
+  /// Writes a command to the subprocess
+  void send(const QByteArray & cmd) {
+    if(process->state() == QProcess::NotRunning)
+      throw RuntimeError("Subprocess %1 %2 is not running").
+        arg(process->program()).arg(process->arguments().join(" "));
+    process->write(cmd);
+    process->waitForBytesWritten();
+  };
 
 public:
-  JSONBasedFunction() : process(NULL) {
+  ExternalWorker() : process(NULL) {
   };
 
-  ~JSONBasedFunction() {
+  virtual ~ExternalWorker() {
     if(process) {
       process->closeWriteChannel();
       // Wait 10 ms before closing
@@ -89,44 +116,71 @@ public:
     }
   };
 
-  Vector compute(const Vector & xv, const double * params) override {
-    if(! process)
-      spawn();
-    if(! process)
-      throw InternalError("Process creation failed for some reason");
+  /// Makes the process usable from the current thread. The worker
+  /// must not be attached to another thread.
+  void attachToCurrentThread() {
+    if(process)
+      process->moveToThread(QThread::currentThread());
+  };
+
+  /// Detaches the process from the current thread, so that another
+  /// thread can attach it.
+  void detach() {
+    if(process)
+      process->moveToThread(NULL);
+  };
+
+  /// Whether the subprocess is still running
+  bool isRunning() const {
+    return process && process->state() != QProcess::NotRunning;
+  };
+
+  /// Computes the function at the given X values, with the @a nb
+  /// given parameters.
+  virtual Vector compute(const Vector & x, const double * params,
+                         int nb) = 0;
+};
+
+
+/// This class implements an ExternalWorker using a client/server
+/// model with simple JSON exchange.
+///
+/// The client sends a JSON dict with an array of X values and an
+/// array for the parameters (same size as what is returned by
+/// parameters()). The server replies with a JSON array of the
+/// computed values.
+///
+/// In both directions, the communication is finished by sending a
+/// '// -> DONE' string terminated with a newline.
+///
+/// The object sent contains two elements: "parameters" and "xvalues"
+class JSONWorker : public ExternalWorker {
+public:
+
+  JSONWorker(const QString & program, const QStringList & args) {
+    start(program, args);
+  };
 
+  Vector compute(const Vector & xv, const double * params,
+                 int sz) override {
     QJsonObject obj;
     QJsonArray vals, vals2;
     for(double x : xv)
       vals << x;
     obj["xvalues"] = vals;
-    int sz = parameters().size();
     for(int i = 0; i < sz; i++)
       vals2 << params[i];
     obj["parameters"] = vals2;
     QJsonDocument doc(obj);
-    process->waitForStarted();
-    process->write(doc.toJson(QJsonDocument::Compact) + "\n");
-    process->waitForBytesWritten();
+    send(doc.toJson(QJsonDocument::Compact) + "\n");
 
     // Now read the response
-
     QByteArray resp;
     while(true) {
-      // if(process->atEnd())
-      //   throw RuntimeError("Premature end of subprocess %1 %2").
-      //     arg(process->program()).arg(process->arguments().join(" "));
-      QByteArray ln = readLine();
+      QByteArray ln = waitForLine();
       if(ln.startsWith("// -> DONE"))
         break;
-      if(ln.size() == 0) {
-        if(process->state() == QProcess::NotRunning)
-            throw RuntimeError("Premature end of subprocess %1 %2").
-              arg(process->program()).arg(process->arguments().join(" "));
-        process->waitForReadyRead();
-      }
-      else 
-        resp += ln;
+      resp += ln;
     }
     QJsonParseError err;
     doc = QJsonDocument::fromJson(resp, &err);
@@ -150,9 +204,98 @@ public:
       rv << v.toDouble();
     return rv;
   };
+};
+
+#include <QTemporaryFile>
+#include <QDir>
+
+/// This class implements an ExternalWorker that exchanges the data
+/// through a memory-mapped file, which is given as the last argument
+/// to the subprocess. Only a short control line goes through the
+/// pipe:
+/// 
+/// compute nb_params nb_x segment_size
+///
+/// Before sending the line, the segment is filled with the
+/// parameters followed by the X values, as native doubles. The
+/// subprocess writes the Y values just after the X values, and
+/// answers with a line containing either "done" or "error" followed by
+/// the error message.
+///
+/// On Linux, the segment lives in /dev/shm when possible, so that it
+/// is never written to the disk.
+class SharedMemoryWorker : public ExternalWorker {
+
+  /// The file backing the segment
+  QTemporaryFile segment;
+
+  /// The mapped memory
+  uchar * data;
+
+  /// The current size of the segment
+  qint64 size;
+
+  /// Makes sure the segment is at least @a sz bytes long.
+  void ensureSize(qint64 sz) {
+    if(sz <= size)
+      return;
+    if(data)
+      segment.unmap(data);
+    data = NULL;
+    qint64 ns = std::max(sz, 2*size);
+    // Round up to a 4kB page
+    ns = ((ns + 4095)/4096) * 4096;
+    if(! segment.resize(ns))
+      throw RuntimeError("Could not resize the shared memory segment '%1' to %2 bytes").
+        arg(segment.fileName()).arg(ns);
+    data = segment.map(0, ns);
+    if(! data)
+      throw RuntimeError("Could not map the shared memory segment '%1': %2").
+        arg(segment.fileName()).arg(segment.errorString());
+    size = ns;
+  };
+
+public:
+
+  SharedMemoryWorker(const QString & program, const QStringList & args) :
+    data(NULL), size(0) {
+    QString dir = QDir::tempPath();
+#ifdef Q_OS_LINUX
+    if(QDir("/dev/shm").exists())
+      dir = "/dev/shm";
+#endif
+    segment.setFileTemplate(dir + "/qsoas-segment-XXXXXX");
+    if(! segment.open())
+      throw RuntimeError("Could not create the shared memory segment: %1").
+        arg(segment.errorString());
+    ensureSize(4096);
+    start(program, QStringList(args) << segment.fileName());
+  };
+
+  ~SharedMemoryWorker() {
+    if(data)
+      segment.unmap(data);
+  };
 
-  
-  
+  Vector compute(const Vector & xv, const double * params,
+                 int sz) override {
+    int nb = xv.size();
+    ensureSize(sizeof(double) * (sz + 2 * nb));
+    double * values = reinterpret_cast<double *>(data);
+    std::copy(params, params + sz, values);
+    std::copy(xv.data(), xv.data() + nb, values + sz);
+    send(QString("compute %1 %2 %3\n").arg(sz).arg(nb).arg(size).
+         toLocal8Bit());
+
+    QByteArray ln = waitForLine().trimmed();
+    if(ln.startsWith("error"))
+      throw RuntimeError("Error executing function: %1").
+        arg(QString::fromUtf8(ln.mid(5).trimmed()));
+    if(ln != "done")
+      throw RuntimeError("Unexpected answer from subprocess: '%1'").
+        arg(QString::fromUtf8(ln));
+    return Vector(values + sz + nb, nb);
+  };
 };
 
 
@@ -160,11 +303,16 @@ public:
 
 #include <file.hh>
 
-#include <QTemporaryFile>
-
-/// This class implements an ExternalFunction communicating to a
-/// python process.
-class PythonFunction : public JSONBasedFunction {
+/// This class implements an ExternalFunction communicating to one or
+/// more python processes.
+///
+/// The function owns a pool of at most nbWorkers python processes, so
+/// that several computations can run concurrently (for instance, the
+/// columns of the jacobian). A thread calling compute() takes an idle
+/// process from the pool, or starts a new one if the pool is not
+/// full, or waits for one to be released. The processes are
+/// terminated when the function is deleted.
+class PythonFunction : public ExternalFunction {
 protected:
 
   /// The name of the function
@@ -185,6 +333,27 @@ protected:
   /// The path to the python interpreter
   QString python;
 
+  /// The number of processes that can run concurrently.
+  int nbWorkers;
+
+  /// Whether the data is exchanged using shared memory (or JSON)
+  bool sharedMemory;
+
+  /// The file containing the full python code
+  QString wrapperFile;
+
+  /// The workers not currently used by a thread
+  QList<ExternalWorker *> idleWorkers;
+
+  /// The number of workers currently alive, idle or not
+  int createdWorkers;
+
+  /// Signaled when a worker gets back to the pool
+  QWaitCondition workerReleased;
+
+  /// Protects the generation of the code and the pool of workers
+  QMutex mutex;
+
   /// Reads the file, parses the argument list and generates the code
   /// necessary.
   ///
@@ -237,25 +406,21 @@ protected:
     code = s;
     code += QString("\nfunc = %1\n").arg(function);
   };
-  
 
-  
-  virtual void spawn() {
+  /// Writes the full python code to a temporary file.
+  void writeWrapper() {
     if(code.isEmpty())
       generateCode();
-    if(process)
-      throw InternalError("Trying to create a second process");
     /// @todo cd to the correct directory
-    // We create a temporary file
-
-    File wrp(":resources/python-wrapper.py", File::TextRead);
+    File wrp(sharedMemory ? ":resources/python-shm-wrapper.py" :
+             ":resources/python-wrapper.py", File::TextRead);
     QTextStream in(wrp);
     QString s = in.readAll();
     s.replace("## CODE", code);
 
     /// @todo Move to File ?
     QTemporaryFile file;
-    file.setAutoRemove(false); // Accumulation of temporary files ?
+    file.setAutoRemove(false); // Removed in the destructor
     file.setFileTemplate("python-temporary-code-XXXXXX.py");
     file.open();
     {
@@ -263,26 +428,102 @@ protected:
       out << s;
     }
     file.close();
+    wrapperFile = file.fileName();
+  };
 
-    
+  /// Takes a worker from the pool, starting a new one if none is
+  /// idle and there are less than nbWorkers. Waits for a worker to be
+  /// released otherwise. The worker is attached to the current thread
+  /// and must be given back using releaseWorker().
+  ExternalWorker * acquireWorker() {
+    QStringList args;
+    {
+      QMutexLocker l(&mutex);
+      while(idleWorkers.isEmpty() && createdWorkers >= nbWorkers)
+        workerReleased.wait(&mutex);
+      if(! idleWorkers.isEmpty()) {
+        ExternalWorker * wk = idleWorkers.takeLast();
+        wk->attachToCurrentThread();
+        return wk;
+      }
+      if(wrapperFile.isEmpty())
+        writeWrapper();
+      args << wrapperFile;
+      ++createdWorkers;
+    }
+    try {
+      if(sharedMemory)
+        return new SharedMemoryWorker(python, args);
+      return new JSONWorker(python, args);
+    }
+    catch(...) {
+      dropWorker(NULL);
+      throw;
+    }
+  };
 
-    process = new QProcess();
-    process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
-    process->start(python,
-                   QStringList() << file.fileName(),
-                   QIODevice::ReadWrite|QIODevice::Unbuffered);
-    
+  /// Gives back the worker to the pool.
+  void releaseWorker(ExternalWorker * wk) {
+    wk->detach();
+    QMutexLocker l(&mutex);
+    idleWorkers << wk;
+    workerReleased.wakeOne();
+  };
+
+  /// Deletes a worker that is not usable anymore (or NULL if it could
+  /// not be created), making room in the pool for a new one.
+  void dropWorker(ExternalWorker * wk) {
+    delete wk;
+    QMutexLocker l(&mutex);
+    --createdWorkers;
+    workerReleased.wakeOne();
   };
 
 public:
 
   PythonFunction(const QString & file, const QString & fn,
-                 const QString & py = QString()) :
+                 const QString & py, int nb, bool shm) :
     function(fn), fileName(file), python(py.isEmpty() ?
-                                         QString("python3") : py)
+                                         QString("python3") : py),
+    nbWorkers(nb), sharedMemory(shm), createdWorkers(0)
   {
   };
 
+  ~PythonFunction() {
+    // No computation can be running at this point, so all the
+    // workers are idle. Deleting them terminates the processes,
+    // which must be done before removing the file they run.
+    for(ExternalWorker * wk : idleWorkers) {
+      wk->attachToCurrentThread();
+      delete wk;
+    }
+    idleWorkers.clear();
+    if(! wrapperFile.isEmpty())
+      QFile::remove(wrapperFile);
+  };
+
+  Vector compute(const Vector & xv, const double * params) override {
+    int nb = parameters().size();
+    ExternalWorker * wk = acquireWorker();
+    try {
+      Vector rv = wk->compute(xv, params, nb);
+      releaseWorker(wk);
+      return rv;
+    }
+    catch(...) {
+      // A worker whose process died is useless
+      if(wk->isRunning())
+        releaseWorker(wk);
+      else
+        dropWorker(wk);
+      throw;
+    }
+  };
+
+  int concurrency() const override {
+    return nbWorkers;
+  };
+
   /// The list of parameters.
   QStringList parameters() const override {
     if(code.isEmpty()) {
@@ -301,10 +542,16 @@ public:
 
 ExternalFunction * ExternalFunction::pythonFunction(const QString & file,
                                                     const QString & function,
-                                                    const QString & interpreter)
+                                                    const QString & interpreter,
+                                                    int workers,
+                                                    bool sharedMemory)
 {
+  if(workers < 1)
+    throw RuntimeError("The number of workers must be at least 1, not %1").
+      arg(workers);
   std::unique_ptr<ExternalFunction>
-    fn(new PythonFunction(file, function, interpreter));
+    fn(new PythonFunction(file, function, interpreter,
+                          workers, sharedMemory));
   /// Ensure opening woks
   fn->parameters();
 
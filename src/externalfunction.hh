@@ -45,13 +45,23 @@ public:
   /// missing)
   virtual QHash<QString, double> defaultValues() const;
 
+  /// Returns the number of threads that can run compute()
+  /// concurrently. Defaults to 1.
+  virtual int concurrency() const;
+
   virtual ~ExternalFunction();
 
   /// Returns a newly created external function for the given python
-  /// file and function
+  /// file and function.
+  ///
+  /// Up to @a workers python processes run concurrently. If @a
+  /// sharedMemory is true, the data is exchanged using a memory
+  /// segment rather than JSON text.
   static ExternalFunction * pythonFunction(const QString & file,
                                            const QString & function,
-                                           const QString & interpreter = "");
+                                           const QString & interpreter = "",
+                                           int workers = 1,
+                                           bool sharedMemory = true);
 };
 
 #endif
@@ -72,6 +72,16 @@ public:
       a[i] = vals.value(ps[i], 1);
   };
 
+  /// The fit is thread-safe as soon as the function can run several
+  /// computations concurrently.
+  bool threadSafe() const override {
+    return func->concurrency() > 1;
+  };
+
+  int defaultThreadNumber() const override {
+    return func->concurrency();
+  };
+
   QList<ParameterDefinition> parameters(FitData * data) const override {
     QList<ParameterDefinition> rv;
     for(const QString & s : func->parameters())
@@ -88,6 +98,11 @@ public:
   {
   };
 
+  /// Deleting the function terminates the external processes.
+  ~ExternalFunctionFit() {
+    delete func;
+  };
+
 
 
 
@@ -103,10 +118,12 @@ static ExternalFunctionFit * createExternalFit(const QString & name,
                                                ExternalFunction * func,
                                                bool overwrite = false)
 {
+  // The fit takes ownership of the function
+  std::unique_ptr<ExternalFunction> fn(func);
   Fit::safelyRedefineFit(name, overwrite);
   externalFits.remove(name);
   ExternalFunctionFit * fit =
-    new ExternalFunctionFit(name, func);
+    new ExternalFunctionFit(name, fn.release());
   externalFits[name] = fit;
   return fit;
 }
@@ -123,11 +140,21 @@ static void definePythonFitCommand(const QString &,
 
   QString python;
   updateFromOptions(opts, "interpreter", python);
+
+  int workers = 1;
+  updateFromOptions(opts, "workers", workers);
+
+  QString protocol = "shm";
+  updateFromOptions(opts, "protocol", protocol);
   
   ExternalFunction * fun =
-    ExternalFunction::pythonFunction(file, func, python);
+    ExternalFunction::pythonFunction(file, func, python, workers,
+                                     protocol == "shm");
   Terminal::out << "Found function : " << func << " with parameters: "
                 << fun->parameters().join(", ") << endl;
+  if(workers > 1)
+    Terminal::out << "Using " << workers
+                  << " python processes for computing the jacobian" << endl;
   createExternalFit(name, fun, overwrite);
 }
 
@@ -152,6 +179,13 @@ cfOpts(QList<Argument *>()
         << new FileArgument("interpreter", 
                             "Python interpreter",
                             "Path to the python3 interpreter")
+        << new IntegerArgument("workers", 
+                               "Workers",
+                               "Number of python processes used concurrently to compute the jacobian (default: 1)")
+        << new ChoiceArgument(QStringList() << "shm" << "json",
+                              "protocol", 
+                              "Protocol",
+                              "How the data is exchanged with python: through shared memory (shm, the default) or JSON text (json)")
        );
 
 static Command 
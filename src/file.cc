@@ -80,8 +80,13 @@ QStringList * File::filesRead = NULL;
 
 QHash<QString, int> * File::filesWritten = NULL;
 
+/// Files can be opened from several threads at once, for instance
+/// when loading many files concurrently.
+static QMutex trackingMutex;
+
 void File::trackFile(const QString & path, OpenModes m)
 {
+  QMutexLocker l(&trackingMutex);
   if(! filesRead) {
     filesRead = new QStringList;
     filesWritten = new QHash<QString, int>;
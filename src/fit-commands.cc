@@ -33,6 +33,7 @@
 
 #include <fitparametersfile.hh>
 #include <fitdata.hh>
+#include <fit.hh>
 #include <dataset.hh>
 
 #include <datasetlist.hh>
@@ -297,7 +298,12 @@ static void fitCommand(const QString & /*name*/, const CommandOptions & opts)
     FitWorkspace::currentWorkspace()->setTracing(stream.get());
   }
   
-  FitWorkspace::Ending st = FitWorkspace::currentWorkspace()->runFit(iterations);
+  bool background = false;
+  updateFromOptions(opts, "background", background);
+
+  FitWorkspace * ws = FitWorkspace::currentWorkspace();
+  FitWorkspace::Ending st = background ?
+    ws->runFitInBackground(iterations) : ws->runFit(iterations);
 
   Terminal::out << "Fit ended, status: "
                 << FitTrajectory::endingName(st) << endl;
@@ -313,7 +319,10 @@ ArgumentList fOpts(QList<Argument*>()
                                           "the maximum number of iterations of the fitting process")
                    << new FileArgument("trace-file", 
                                        "Trace file",
-                                       "a file to save the details of the fitting process"));
+                                       "a file to save the details of the fitting process")
+                   << new BoolArgument("background", 
+                                       "Background",
+                                       "runs the iterations in a separate thread, like the fit dialog does (default: false)"));
 
 static Command 
 fit("fit", // command name
@@ -529,6 +538,62 @@ set("set", // command name
 
 //////////////////////////////////////////////////////////////////////
 
+static void setSoftOptionsCommand(const QString & /*name*/,
+                                  QStringList assignments,
+                                  const CommandOptions & /*opts*/)
+{
+  FitWorkspace * ws = FitWorkspace::currentWorkspace();
+  ArgumentList soft = ws->data()->fit->fitSoftOptions();
+
+  // We start from the current options, since some fits reset the
+  // options that are not given.
+  CommandOptions co = ws->currentSoftOptions();
+  try {
+    for(const QString & a : assignments) {
+      int idx = a.indexOf('=');
+      if(idx < 0)
+        throw RuntimeError("Invalid soft option: '%1', should be "
+                           "name=value").arg(a);
+      QString name = a.left(idx);
+      const Argument * arg = soft.namedArgument(name);
+      if(! arg)
+        throw RuntimeError("The fit has no soft option named '%1', "
+                           "available options: %2").
+          arg(name).arg(soft.argumentNames().join(", "));
+      delete co.value(name, NULL);
+      co[name] = arg->fromString(a.mid(idx+1));
+    }
+    ws->processSoftOptions(co);
+  }
+  catch(...) {
+    for(auto i = co.begin(); i != co.end(); i++)
+      delete i.value();
+    throw;
+  }
+  for(auto i = co.begin(); i != co.end(); i++)
+    delete i.value();
+}
+
+ArgumentList ssoArgs(QList<Argument*>() 
+                     << (new SeveralStringsArgument("options", 
+                                                    "Options",
+                                                    "the soft options, as name=value assignments"))->
+                     describe("one or more name=value assignments",
+                              "assignments")
+                     );
+
+static Command 
+sso("set-soft-options", // command name
+    effector(setSoftOptionsCommand), // action
+    "fits",  // group name
+    &ssoArgs, // arguments
+    NULL, // options
+    "Set soft options",
+    "Sets the soft options of the fit",
+    "", CommandContext::fitContext());
+
+//////////////////////////////////////////////////////////////////////
+
 static void setFromDatasetCommand(const QString & /*name*/,
                                   QString name,
                                   QList<const DataSet *> dss,
@@ -1345,6 +1410,17 @@ static void memCommand(const QString &,
   int kb = Utils::memoryUsed();
   Terminal::out << "Memory used: " << kb << " kB" << endl
                 << "Ruby memory used: " << mr->memoryUse() << endl;
+  MRuby::CodeCacheStats cs = mr->codeCacheStats();
+  Terminal::out << "Ruby code cache: " << cs.blocks << " blocks, "
+                << cs.parameters << " parameter lists, "
+                << cs.hits << " hits, " << cs.misses << " misses" << endl;
+  MRuby::GCStats gs = mr->gcStats();
+  Terminal::out << "Ruby heap: " << gs.live << " live objects in "
+                << gs.heapSize << " slots, "
+                << gs.fullCollections << " full GCs, "
+                << gs.incrementalSteps << " incremental steps, "
+                << "pauses: " << gs.totalPause * 1e-6 << " ms total, "
+                << gs.longestPause * 1e-6 << " ms max" << endl;
   long ut, kt;
   Utils::processorUsed(&ut, &kt);
   Terminal::out << "Total time used: " << (ut+kt)*0.001 << endl;
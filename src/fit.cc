@@ -77,6 +77,14 @@ bool Fit::threadSafe() const {
   return false;
 }
 
+bool Fit::separableDatasets() const {
+  return false;
+}
+
+int Fit::defaultThreadNumber() const {
+  return 1;
+}
+
 void Fit::registerFit(Fit * fit)
 {
   if(! fit)
@@ -523,7 +531,7 @@ void Fit::runFit(std::function<void (FitData *)> hook,
   processOptions(opts, &data);
   data.finishInitialization();
 
-  int threads = 1;
+  int threads = defaultThreadNumber();
   updateFromOptions(opts, "threads", threads);
   if(debug > 0)
     Debug::debug() << "Asking for " << threads << " threads (ts: "
@@ -677,7 +685,7 @@ void Fit::computeFit(std::function<void (FitData *)> hook,
   processOptions(opts, &data);
   data.finishInitialization();
 
-  int threads = 1;
+  int threads = defaultThreadNumber();
   updateFromOptions(opts, "threads", threads);
   if(threads != 1)
     data.setupThreads(threads);
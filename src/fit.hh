@@ -238,6 +238,12 @@ public:
   /// Defaults to false...
   virtual bool threadSafe() const;
 
+  /// The number of threads used to compute the jacobian when none
+  /// was specified. Only meaningful for threadSafe() fits.
+  ///
+  /// Defaults to 1, ie no threads.
+  virtual int defaultThreadNumber() const;
+
 
   /// The fit name
   QString fitName(bool includeOptions = true, FitData * data = NULL) const {
@@ -270,6 +276,14 @@ public:
                                   FitData * data, gsl_vector * target, 
                                   int dataset) const;
 
+  /// Whether the values for each dataset only depend on the
+  /// parameters of that dataset, and functionForDataset() only
+  /// computes the given dataset. When that is the case, the jacobian
+  /// only recomputes the datasets affected by each parameter.
+  ///
+  /// Defaults to false.
+  virtual bool separableDatasets() const;
+
   /// Returns a string meant for the user to understand what is the
   /// specific role of the given dataset.
   ///
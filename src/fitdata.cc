@@ -38,182 +38,24 @@
 
 #include <fitengine.hh>
 #include <debug.hh>
+#include <taskscheduler.hh>
+#include <profiler.hh>
+#include <idioms.hh>
+#include <settings-templates.hh>
 
 
-// first, the implementation of the queue
-
-DFComputationQueue::DFComputationQueue(FitData * d) :
-  terminate(false), runningComputations(0), data(d)
-{
-}
-
-DFComputationQueue::~DFComputationQueue()
-{
-}
-
-void DFComputationQueue::enqueue(const DerivativeJob & job)
-{
-  QMutexLocker l(&mutex);
-  queue.enqueue(job);
-  condition.wakeAll();
-}
-
-void DFComputationQueue::enqueue(int i, const gsl_vector * parameters,
-                                 SparseJacobian * target,
-                                 const gsl_vector * current)
-{
-  enqueue(DerivativeJob(i, parameters, target, current));
-}
-
-void DFComputationQueue::signalTermination()
-{
-  QMutexLocker l(&mutex);
-  terminate = true;
-  condition.wakeAll();
-}
-
-DFComputationQueue::DerivativeJob DFComputationQueue::nextJob()
-{
-  while(true) {
-    QMutexLocker l(&mutex);
-    // We wake up every half second, to avoid threads just waiting
-    // forever. Shouldn't be too long in the end.
-    if(data->debug > 0) {
-      QMutexLocker l(Debug::debug().mutex());
-      Debug::debug() << "Thread " << QThread::currentThread()
-                     << " about to wait for a job" << endl;
-    }
-    condition.wait(&mutex, 500);
-    if(queue.size() > 0) {
-      if(data->debug > 0) {
-        QMutexLocker l(Debug::debug().mutex());
-        Debug::debug() << "Thread " << QThread::currentThread()
-                       << " got a job" << endl;
-      }
-      DerivativeJob nxt = queue.dequeue();
-      runningComputations++;
-      return nxt;
-    }
-    if(terminate) {
-      if(data->debug > 0) {
-        QMutexLocker l(Debug::debug().mutex());
-        Debug::debug() << "Thread " << QThread::currentThread()
-                       << " got signaled for termination" << endl;
-      }
-      throw TerminateException();
-    }
-    if(data->debug > 0) {
-      QMutexLocker l(Debug::debug().mutex());
-      Debug::debug() << "Thread " << QThread::currentThread()
-                     << " did not get a job" << endl;
-    }
-  }
-  // This should never happen, but the compiler doesn't know it.
-  return DerivativeJob(0, 0, 0, 0);
-}
-
-void DFComputationQueue::doneJob()
-{
-  QMutexLocker l(&mutex);
-  runningComputations--;        // Should be positive
-  condition.wakeAll();
-}
-
-void DFComputationQueue::waitForJobsDone()
-{
-  while(true) {
-    QMutexLocker l(&mutex);
-    condition.wait(&mutex, 100);
-    int nb = queue.size() + runningComputations;
-    if(data->debug > 0) {
-      QMutexLocker l(Debug::debug().mutex());
-      Debug::debug() << "Waiting for " << nb 
-                     << " jobs to finish" << endl;
-    }
-    if(nb == 0)
-      return;
-  }
-}
-
-int DFComputationQueue::remainingJobs()
-{
-  QMutexLocker l(&mutex);
-  return queue.size() + runningComputations;
-}
-
-//////////////////////////////////////////////////////////////////////
-
-class DerivativeComputationThread : public QThread {
-protected:
-  FitData * data;
-
-  FitInternalStorage * stg;
-
-  QMutex storageMutex;
-
-  int idx;
-public:
-  DerivativeComputationThread(FitData * d, int id) :
-    data(d), stg(NULL), idx(id) {
-  };
-
-  void setStorage(FitInternalStorage * local) {
-    QMutexLocker l(&storageMutex);
-    stg = local;
-  }
-  
-  void run() {
-    try {
-      while(true) {
-        DFComputationQueue::DerivativeJob job = data->workersQueue->nextJob();
-        if(stg) {
-          QMutexLocker l(&storageMutex);
-          data->fitStorage.setLocalData(stg);
-          if(data->debug > 0) {
-            QMutexLocker l(Debug::debug().mutex());
-            Debug::debug() << "Setting up thread " << this
-                           << " (#" << idx << ") to work with storage "
-                           << stg << endl;
-          }
-          stg = NULL;
-        }
-        if(data->debug > 0) {
-          QMutexLocker l(Debug::debug().mutex());
-          Debug::debug()
-            << QString("Thread #%1 derives parameter %2").arg(idx).
-            arg(job.idx)
-            << " -- current options: " << data->fit->optionsString(data)
-            << endl;
-        }
-        // Here, scale 1
-        data->deriveParameter(job.idx, job.params, job.target, job.current, 1);
-        if(data->debug > 0) {
-          QMutexLocker l(Debug::debug().mutex());
-          Debug::debug() << QString("Thread #%1 done deriving parameter %2").
-            arg(idx).arg(job.idx) << endl;
-        }
-        data->workersQueue->doneJob();
-      }
-    }
-    catch(const DFComputationQueue::TerminateException) {
-    }
-  }
-};
-
-
-
-//////////////////////////////////////////////////////////////////////
-
 FitData::FitData(const Fit * f, const QList<const DataSet *> & ds, int d, 
                  const QStringList & ex) : 
   totalSize(0), covarStorage(NULL), covarIsOK(false),
   engine(NULL), inProgress(false), extra(ex),
+  useThreads(false), threads(1), formulas(NULL),
   evaluationNumber(0), 
   fit(f), debug(d), datasets(ds),
-  standardYErrors(NULL), pointWeights(NULL),
+  standardYErrors(NULL), pointWeights(NULL), inverseYErrors(NULL),
   nbIterations(0), storage(0), parametersStorage(0)
 {
   for(int i = 0; i < datasets.size(); i++) {
+    datasetOffsets << totalSize;
     totalSize += datasets[i]->nbRows();
     weightsPerBuffer << 1;      // By default 1
   }
@@ -223,7 +65,6 @@ FitData::FitData(const Fit * f, const QList<const DataSet *> & ds, int d,
 
   computeWeights();
 
-  workersQueue = NULL;
   fitStorage.setLocalData(f->allocateStorage(this));
 
   engineFactory = FitEngine::defaultFactoryItem(datasets.size());
@@ -234,29 +75,71 @@ FitInternalStorage * FitData::getStorage()
   return fitStorage.localData();
 }
 
+QList<FitInternalStorage *> FitData::currentThreadStorage()
+{
+  QList<FitInternalStorage *> rv;
+  rv << getStorage();
+  for(FitData * d : subordinates)
+    rv += d->currentThreadStorage();
+  return rv;
+}
+
+void FitData::setCurrentThreadStorage(const QList<FitInternalStorage *> & storage)
+{
+  QList<FitInternalStorage *> lst = storage;
+  std::function<void (FitData *)> set = [&lst, &set](FitData * d) {
+    d->fitStorage.localData() = lst.isEmpty() ? NULL : lst.takeFirst();
+    for(FitData * s : d->subordinates)
+      set(s);
+  };
+  set(this);
+}
+
 void FitData::setupThreads(int nb)
 {
-  if((! fit->threadSafe()) || nb == 1)         // Nothing to do !
-    return;
-  // #ifndef Q_OS_LINUX
-  // Debug::debug() << "Threads are disabled on platforms other than Linux as of now" << endl;
-  // return;
-  // #endif
   if(nb <= 0)
     nb += QThread::idealThreadCount();
-  if(nb <= 0)
-    return;                     // Still no threads ?
+  if(nb < 1)
+    nb = 1;                     // Still no threads ?
+  threads = nb;
+  if((! fit->threadSafe()) || nb == 1)         // Nothing to do !
+    return;
+  useThreads = TaskScheduler::scheduler()->threadNumber() > 1;
 
   if(debug > 0)
     Debug::debug() << "Setting up fit data " << this
-                   << " for working with " << nb << " threads" << endl;
+                   << " for working with at most " << nb
+                   << " of the "
+                   << TaskScheduler::scheduler()->threadNumber()
+                   << " scheduler threads" << endl;
+}
 
-  workersQueue = new DFComputationQueue(this);
-  for(int i = 0; i < nb; i++) {
-    workers << new DerivativeComputationThread(this, i+1);
-    workers.last()->start();
+FitInternalStorage * FitData::storageForWorker(FitInternalStorage * master)
+{
+  int idx = TaskScheduler::currentWorker();
+  if(idx < 0)
+    return master;
+  QMutexLocker l(&workerStorageMutex);
+  if(idx >= workerStorage.size())
+    workerStorage.resize(idx + 1);
+  if(! workerStorage[idx]) {
+    workerStorage[idx] = fit->copyStorage(this, master);
+    if(debug > 0) {
+      QMutexLocker l(Debug::debug().mutex());
+      Debug::debug() << "Setting up worker #" << idx
+                     << " to work with storage "
+                     << workerStorage[idx] << endl;
+    }
   }
-  
+  return workerStorage[idx];
+}
+
+void FitData::clearWorkerStorage()
+{
+  QMutexLocker l(&workerStorageMutex);
+  for(FitInternalStorage * s : workerStorage)
+    delete s;
+  workerStorage.clear();
 }
 
 void FitData::finishInitialization()
@@ -294,10 +177,12 @@ void FitData::computeWeights()
     // that is caught with checkWeightsConsistency.
     standardYErrors = gsl_vector_alloc(totalSize);
     pointWeights = gsl_vector_alloc(totalSize);
+    inverseYErrors = gsl_vector_alloc(totalSize);
 
     for(int i = 0; i < datasets.size(); i++) {
       gsl_vector_view ve = viewForDataset(i, standardYErrors);
       gsl_vector_view vp = viewForDataset(i, pointWeights);
+      gsl_vector_view vi = viewForDataset(i, inverseYErrors);
 
       const DataSet * ds = datasets[i];
       int sz = ds->nbRows();
@@ -308,6 +193,7 @@ void FitData::computeWeights()
             arg(j).arg(ds->x()[j]).arg(ds->y()[j]).arg(ds->name);
         gsl_vector_set(&ve.vector, j, e);
         gsl_vector_set(&vp.vector, j, 1/(e*e));
+        gsl_vector_set(&vi.vector, j, 1/e);
       }
     }
   }
@@ -336,6 +222,21 @@ bool FitData::hasEngine() const
   return engine;
 }
 
+bool FitData::canRunInBackground() const
+{
+  if(! fit->threadSafe())
+    return false;
+  for(int i = 0; i < parameters.size(); i++) {
+    if(dynamic_cast<const FormulaParameter *>(parameters[i]))
+      return false;
+  }
+  for(const FitData * d : subordinates) {
+    if(! d->canRunInBackground())
+      return false;
+  }
+  return true;
+}
+
 void FitData::doneFitting()
 {
   inProgress = false;
@@ -367,6 +268,7 @@ void FitData::pushParameter(FitParameter * parameter)
 FitData::~FitData()
 {
   // free up some resources
+  delete formulas;
   gsl_vector_free(storage);
   gsl_vector_free(storage2);
   gsl_vector_free(parametersStorage);
@@ -375,52 +277,206 @@ FitData::~FitData()
   if(standardYErrors) {
     gsl_vector_free(standardYErrors);
     gsl_vector_free(pointWeights);
+    gsl_vector_free(inverseYErrors);
   }
   freeSolver();
 
-  if(workersQueue) {
-    workersQueue->signalTermination();
-    for(int i = 0; i < workers.size(); i++) {
-      // try that ?
-      workersQueue->signalTermination();
-      DerivativeComputationThread * d = workers[i];
-      d->wait();
-      d->setStorage(NULL);    
-      delete d;
-    }
-    delete workersQueue;
-  }
-      
+  clearWorkerStorage();
+
   // This calls apparently deletes the data !
   fitStorage.setLocalData(NULL);
 
 }
 
-void FitData::weightVector(gsl_vector * tg, bool forceError)
+bool FitData::shouldApplyErrors(bool forceErrors) const
 {
-  for(int i = 0; i < datasets.size(); i++) {
-    gsl_vector_view v = viewForDataset(i, tg);
-    gsl_vector_scale(&v.vector, weightsPerBuffer[i]);
+  return standardYErrors &&
+    ((engine && !engine->handlesWeights()) || forceErrors);
+}
+
+/// The inner loop of the residuals computation, written so that the
+/// compiler can vectorize the contiguous case.
+template <bool subtract, bool errors>
+static void residualsKernel(double * target, size_t stride,
+                            const double * y, const double * inverse,
+                            double weight, int nb)
+{
+  if(stride == 1) {
+    for(int j = 0; j < nb; j++) {
+      double v = target[j];
+      if(subtract)
+        v -= y[j];
+      v *= weight;
+      if(errors)
+        v *= inverse[j];
+      target[j] = v;
+    }
+  }
+  else {
+    for(int j = 0; j < nb; j++) {
+      double v = target[j*stride];
+      if(subtract)
+        v -= y[j];
+      v *= weight;
+      if(errors)
+        v *= inverse[j];
+      target[j*stride] = v;
+    }
+  }
+}
+
+void FitData::processResiduals(double * target, size_t stride, int ds,
+                               int first, int nb, bool subtract,
+                               bool weight, bool errors) const
+{
+  const double * y = datasets[ds]->y().data() + first;
+  double w = weight ? weightsPerBuffer[ds] : 1;
+  const double * inverse = NULL;
+  if(weight && errors)
+    inverse = inverseYErrors->data + datasetOffsets[ds] + first;
+  if(subtract) {
+    if(inverse)
+      residualsKernel<true, true>(target, stride, y, inverse, w, nb);
+    else
+      residualsKernel<true, false>(target, stride, y, inverse, w, nb);
+  }
+  else {
+    if(inverse)
+      residualsKernel<false, true>(target, stride, y, inverse, w, nb);
+    else
+      residualsKernel<false, false>(target, stride, y, inverse, w, nb);
+  }
+}
+
+void FitData::processResiduals(gsl_vector * tg, bool subtract,
+                               bool weight, bool forceErrors)
+{
+  if(! (subtract || weight))
+    return;
+  bool errors = weight && shouldApplyErrors(forceErrors);
+
+  // Threads are only worth it for large vectors, and are not used
+  // from within the workers, which are already busy computing
+  // jacobian columns.
+  const int chunk = 1 << 16;
+  if(totalSize >= 16 * chunk && TaskScheduler::currentWorker() < 0 &&
+     TaskScheduler::scheduler()->threadNumber() > 1) {
+    TaskGroup jobs("fit-residuals");
+    for(int i = 0; i < datasets.size(); i++) {
+      int sz = datasets[i]->nbRows();
+      for(int first = 0; first < sz; first += chunk) {
+        int nb = std::min(chunk, sz - first);
+        double * t = tg->data + (datasetOffsets[i] + first) * tg->stride;
+        jobs.run([this, t, tg, i, first, nb, subtract, weight, errors]() {
+            processResiduals(t, tg->stride, i, first, nb,
+                             subtract, weight, errors);
+          });
+      }
+    }
+    jobs.wait();
   }
-  if(standardYErrors &&
-     (
-      (engine && !engine->handlesWeights()) ||
-      forceError
-      )
-     ) {
-    /// @todo Would be faster if I multiply ;-)...
-    gsl_vector_div(tg, standardYErrors);
+  else {
+    for(int i = 0; i < datasets.size(); i++)
+      processResiduals(tg->data + datasetOffsets[i] * tg->stride,
+                       tg->stride, i, 0, datasets[i]->nbRows(),
+                       subtract, weight, errors);
   }
 }
 
+void FitData::weightVector(gsl_vector * tg, bool forceError)
+{
+  processResiduals(tg, false, true, forceError);
+}
+
+void FitData::weightVector(int ds, gsl_vector * tg, bool forceError)
+{
+  processResiduals(tg->data, tg->stride, ds, 0, tg->size,
+                   false, true, shouldApplyErrors(forceError));
+}
+
 bool FitData::usesPointWeights() const
 {
   return standardYErrors != NULL;
 }
 
+static SettingsValue<double> evaluationCacheSize("fits/evaluation-cache-size",
+                                                 4,
+                                                 "maximum size, in MB, of the cache of the function evaluations of the fit dialog (0 to disable)");
+
+static SettingsValue<int> evaluationCacheEntries("fits/evaluation-cache-entries",
+                                                 16,
+                                                 "maximum number of function evaluations kept in the cache of the fit dialog (0 to disable)");
+
+static bool useEvaluationCache()
+{
+  return evaluationCacheSize > 0 && evaluationCacheEntries > 0;
+}
+
+qint64 FitData::CachedEvaluation::size() const
+{
+  qint64 rv = parameters.size() + values.size();
+  for(const Vector & v : subFunctions)
+    rv += v.size();
+  return rv;
+}
+
+FitData::CachedEvaluation & FitData::cachedEvaluation(const double * params)
+{
+  int nb = fullParameterNumber();
+  uint hash = qHashBits(params, nb * sizeof(double));
+  for(int i = 0; i < evaluationCache.size(); i++) {
+    const CachedEvaluation & c = evaluationCache[i];
+    if(c.hash == hash &&
+       memcmp(c.parameters.constData(), params, nb * sizeof(double)) == 0) {
+      if(i > 0)
+        evaluationCache.move(i, 0);
+      return evaluationCache.first();
+    }
+  }
+  CachedEvaluation c;
+  c.hash = hash;
+  c.parameters = Vector(params, nb);
+  evaluationCache.prepend(c);
+  return evaluationCache.first();
+}
+
+void FitData::trimEvaluationCache()
+{
+  qint64 max = evaluationCacheSize * 1024 * 1024 / sizeof(double);
+  while(evaluationCache.size() > evaluationCacheEntries)
+    evaluationCache.removeLast();
+  qint64 total = 0;
+  for(int i = 0; i < evaluationCache.size(); i++) {
+    total += evaluationCache[i].size();
+    if(total > max) {
+      while(evaluationCache.size() > i)
+        evaluationCache.removeLast();
+      break;
+    }
+  }
+}
+
+void FitData::clearEvaluationCache()
+{
+  evaluationCache.clear();
+}
+
 int FitData::computeFunction(const double * params, gsl_vector * f,
                              bool doSubtract, bool doWeight)
 {
+  if(useEvaluationCache()) {
+    CachedEvaluation & c = cachedEvaluation(params);
+    if(c.values.size() == totalSize) {
+      if(debug > 0)
+        dumpString("Using cached function evaluation");
+      gsl_vector_const_view v =
+        gsl_vector_const_view_array(c.values.constData(), totalSize);
+      gsl_vector_memcpy(f, &v.vector);
+      processResiduals(f, doSubtract, doWeight, false);
+      return GSL_SUCCESS;
+    }
+  }
+
   int nb = freeParameters();
   if(nb == 0)                   // avoid crashes with no free parameters
     ++nb;
@@ -428,12 +484,43 @@ int FitData::computeFunction(const double * params, gsl_vector * f,
   gsl_vector_view v = gsl_vector_view_array(dt.data(), nb);
   packParameters(params, &v.vector);
 
-  return this->f(&v.vector, f, doSubtract, doWeight);
+  int status = this->f(&v.vector, f, false, false);
+  if(useEvaluationCache()) {
+    // The lookup must be done again, since the evaluation of the
+    // function may have run computeFunction() too.
+    cachedEvaluation(params).values = Vector::fromGSLVector(f);
+    trimEvaluationCache();
+  }
+  processResiduals(f, doSubtract, doWeight, false);
+  return status;
+}
+
+void FitData::computeSubFunctions(const double * params,
+                                  QList<Vector> * targetData,
+                                  QStringList * targetAnnotations)
+{
+  if(useEvaluationCache()) {
+    CachedEvaluation & c = cachedEvaluation(params);
+    if(c.hasSubFunctions) {
+      *targetData = c.subFunctions;
+      *targetAnnotations = c.annotations;
+      return;
+    }
+  }
+  fit->computeSubFunctions(params, this, targetData, targetAnnotations);
+  if(useEvaluationCache()) {
+    CachedEvaluation & c = cachedEvaluation(params);
+    c.hasSubFunctions = true;
+    c.subFunctions = *targetData;
+    c.annotations = *targetAnnotations;
+    trimEvaluationCache();
+  }
 }
 
 int FitData::f(const gsl_vector * x, gsl_vector * f,
                bool doSubtract, bool doWeights)
 {
+  ProfilerTimer t(Profiler::FitFunction);
   QVarLengthArray<double, 1024> params(fullParameterNumber());
   unpackParameters(x, params.data());
 
@@ -468,12 +555,8 @@ int FitData::f(const gsl_vector * x, gsl_vector * f,
   if(debug > 0)
     dumpString(" -> done with function computation");
   evaluationNumber++;
-  // Then, subtract data.
-  if(doSubtract)
-    subtractData(f);
-  if(doWeights)
-    weightVector(f);
-  /// @todo Data weighting ?
+  // Then, subtract data and apply the weights, in a single pass.
+  processResiduals(f, doSubtract, doWeights, false);
 
   if(debug > 0)
     dumpString("Finished f computation");
@@ -482,6 +565,7 @@ int FitData::f(const gsl_vector * x, gsl_vector * f,
 }
 
 void FitData::deriveParameter(int i, const gsl_vector * params,
+                              const double * unpacked,
                               SparseJacobian * target,
                               const gsl_vector * current, double scale)
 {
@@ -510,7 +594,23 @@ void FitData::deriveParameter(int i, const gsl_vector * params,
     gslParams[param->fitIndex] += step;
   }
 
-  unpackParameters(&v.vector, unpackedParams.data());
+  // Only the perturbed parameters and the formulas that depend on
+  // them change with respect to the unpacked values at params.
+  int nb_datasets = datasets.size();
+  int nb_ds_params = parameterDefinitions.size();
+  memcpy(unpackedParams.data(), unpacked,
+         fullParameterNumber() * sizeof(double));
+  QVector<bool> perturbed(nb_datasets, false);
+  for(int j = 0; j < lst.size(); j++) {
+    lst[j]->copyToUnpacked(unpackedParams.data(), &v.vector,
+                           nb_datasets, nb_ds_params);
+    if(lst[j]->dsIndex < 0)
+      perturbed.fill(true);
+    else
+      perturbed[lst[j]->dsIndex] = true;
+  }
+  if(formulas)
+    formulas->evaluateDependent(i, perturbed, unpackedParams.data());
 
   if(debug > 0) {
     QMutexLocker l(Debug::debug().mutex());
@@ -518,28 +618,55 @@ void FitData::deriveParameter(int i, const gsl_vector * params,
     dumpFitParameters(unpackedParams.data());
   }
 
-  fit->function(unpackedParams.data(), this, col);
-  {
-    QMutexLocker m(&evaluationsMutex);
-    evaluationNumber++;
+  if(fit->separableDatasets() && perturbed.contains(false)) {
+    // Only the datasets in which the parameter was perturbed have to
+    // be computed, the derivatives are 0 for the others.
+    for(int ds = 0; ds < nb_datasets; ds++) {
+      gsl_vector_view c = viewForDataset(ds, col);
+      if(! perturbed[ds] || weightsPerBuffer[ds] == 0) {
+        gsl_vector_set_zero(&c.vector);
+        continue;
+      }
+      fit->functionForDataset(unpackedParams.data(), this, col, ds);
+      gsl_vector_const_view cur = viewForDataset(ds, current);
+      gsl_vector_sub(&c.vector, &cur.vector);
+      weightVector(ds, &c.vector);
+    }
+    {
+      QMutexLocker m(&evaluationsMutex);
+      evaluationNumber++;
+    }
+    if(debug > 1) {
+      QMutexLocker l(Debug::debug().mutex());
+      dumpString(QString("Independent parameters %1 (only perturbed datasets)").
+                 arg(i));
+      dumpString(QString("wdf: ") + Utils::vectorString(col));
+    }
   }
+  else {
+    fit->function(unpackedParams.data(), this, col);
+    {
+      QMutexLocker m(&evaluationsMutex);
+      evaluationNumber++;
+    }
 
-  if(debug > 1) {
-    QMutexLocker l(Debug::debug().mutex());
-    dumpString(QString("Independent parameters %1").arg(i));
-    dumpString(QString("f:   ") + Utils::vectorString(col));
-  }
+    if(debug > 1) {
+      QMutexLocker l(Debug::debug().mutex());
+      dumpString(QString("Independent parameters %1").arg(i));
+      dumpString(QString("f:   ") + Utils::vectorString(col));
+    }
 
-  gsl_vector_sub(col, current);
+    gsl_vector_sub(col, current);
 
-  if(debug > 1) {
-    dumpString(QString("df:  ") + Utils::vectorString(col));
-  }
+    if(debug > 1) {
+      dumpString(QString("df:  ") + Utils::vectorString(col));
+    }
     
-  weightVector(col);
+    weightVector(col);
 
-  if(debug > 1) {
-    dumpString(QString("wdf: ") + Utils::vectorString(col));
+    if(debug > 1) {
+      dumpString(QString("wdf: ") + Utils::vectorString(col));
+    }
   }
 
   for(int j = 0; j < lst.size(); j++) {
@@ -563,6 +690,7 @@ int FitData::df(const gsl_vector * x, SparseJacobian * df, double scale)
     throw InternalError("Size mismatch between GSL parameters "
                         "and FitData data");
 
+  ProfilerTimer t(Profiler::Jacobian);
   QVarLengthArray<double, 1024> unpackedParams(fullParameterNumber());
   unpackParameters(x, unpackedParams.data());
 
@@ -577,10 +705,27 @@ int FitData::df(const gsl_vector * x, SparseJacobian * df, double scale)
   fit->function(unpackedParams.data(), this, storage);
   evaluationNumber++;
 
-  if(workersQueue) {
+  const double * unpacked = unpackedParams.data();
+  if(useThreads) {
+    FitInternalStorage * master = getStorage();
+    // At most threads derivatives at the same time, for fits whose
+    // concurrency is limited (like python fits)
+    TaskGroup jobs("fit-jacobian", threads);
     for(int i = 0; i < parametersByDefinition.size(); i++)
-      workersQueue->enqueue(i, x, df, storage);
-    workersQueue->waitForJobsDone();
+      jobs.run([this, i, x, unpacked, df, master, scale]() {
+          TemporaryThreadLocalChange<FitInternalStorage*>
+            s(fitStorage, storageForWorker(master));
+          if(debug > 0) {
+            QMutexLocker l(Debug::debug().mutex());
+            Debug::debug()
+              << QString("Worker #%1 derives parameter %2").
+              arg(TaskScheduler::currentWorker()).arg(i)
+              << " -- current options: " << fit->optionsString(this)
+              << endl;
+          }
+          deriveParameter(i, x, unpacked, df, storage, scale);
+        });
+    jobs.wait();
   }
   else {
     for(int i = 0; i < parametersByDefinition.size(); i++) {
@@ -588,7 +733,7 @@ int FitData::df(const gsl_vector * x, SparseJacobian * df, double scale)
         exc = false;
         throw RuntimeError("Exception raised manually");
       }
-      deriveParameter(i, x, df, storage, scale);
+      deriveParameter(i, x, unpacked, df, storage, scale);
     }
   }
 
@@ -640,62 +785,32 @@ void FitData::unpackParameters(const gsl_vector * packed,
   int nb_ds_params = parameterDefinitions.size();
   int nb_datasets = datasets.size();
 
-  int nb_second_pass = 0;
-
-  for(int i = 0; i < parameters.size(); i++) {
-    parameters[i]->copyToUnpacked(unpacked, packed, 
-                                 nb_datasets, nb_ds_params);
-    if(parameters[i]->needSecondPass())
-      nb_second_pass++;
-  }
-
-
-  // We make as many second passes as there are parameters needing it,
-  // so that if there is a linear chain of parameters, the whole
-  // dependency chain is complete
-
-  /// @todo Smarter interdependency detection, to compute the right
-  /// parameters in the right order only once. Only the order in which
-  /// the parameters have to be evaluated should be stored
-
-  while(nb_second_pass > 0) {
-    for(int i = 0; i < parameters.size(); i++)
-      if(parameters[i]->needSecondPass())
-        parameters[i]->copyToUnpacked(unpacked, packed, 
-                                      nb_datasets, nb_ds_params);
-    --nb_second_pass;
-  }
-
+  for(int i = 0; i < parameters.size(); i++)
+    if(! parameters[i]->needSecondPass())
+      parameters[i]->copyToUnpacked(unpacked, packed, 
+                                    nb_datasets, nb_ds_params);
+
+  // Then, all the parameters defined by formulas, in the order of
+  // their dependencies.
+  if(formulas)
+    formulas->evaluate(unpacked);
 }
 
 gsl_vector_view FitData::viewForDataset(int ds, gsl_vector * vect) const
 {
-  int total = 0;
-  for(int i = 0; i < ds; i++)
-    total += datasets[i]->nbRows();
-  return gsl_vector_subvector(vect, total, datasets[ds]->nbRows());
+  return gsl_vector_subvector(vect, datasetOffsets[ds],
+                              datasets[ds]->nbRows());
 }
 
 gsl_vector_const_view FitData::viewForDataset(int ds, const gsl_vector * vect) const
 {
-  int total = 0;
-  for(int i = 0; i < ds; i++)
-    total += datasets[i]->nbRows();
-  return gsl_vector_const_subvector(vect, total, datasets[ds]->nbRows());
+  return gsl_vector_const_subvector(vect, datasetOffsets[ds],
+                                    datasets[ds]->nbRows());
 }
 
 void FitData::subtractData(gsl_vector * target)
 {
-  // Then, subtract the data.
-  int nbds = datasets.size();
-  int total = 0;
-  for(int i = 0; i < nbds; i++) {
-    const DataSet * ds = datasets[i];
-    gsl_vector_const_view sv = ds->y().vectorView();
-    gsl_vector_view tv = gsl_vector_subvector(target, total, ds->nbRows());
-    gsl_vector_sub(&tv.vector, &sv.vector);
-    total += ds->nbRows();
-  }
+  processResiduals(target, true, false, false);
 }
 
 
@@ -733,6 +848,10 @@ void FitData::initializeParameters()
     if(param->needsInit())
       param->initialize(this);
   }
+
+  delete formulas;
+  formulas = NULL;
+  formulas = new FormulaEvaluator(this, parameters);
 }
 
 
@@ -786,8 +905,8 @@ void FitData::initializeSolver(const double * initialGuess,
       // Make sure the initialization is finished and done after
       // copying the internal storage
       d->finishInitialization();
-      if(workers.size() > 0)
-        d->setupThreads(workers.size());
+      if(useThreads)
+        d->setupThreads(threads);
 
       d->engineFactory = engineFactory;
       d->initializeSolver(initialGuess + 
@@ -807,11 +926,8 @@ void FitData::initializeSolver(const double * initialGuess,
       throw;
     }
 
-    FitInternalStorage * master = getStorage();
-    for(int i = 0; i < workers.size(); i++) {
-      FitInternalStorage * c = fit->copyStorage(this, master);
-      workers[i]->setStorage(c);
-    }
+    // The workers will copy the storage again when they need it.
+    clearWorkerStorage();
     
     if(debug > 0) {
       QTextStream o(stdout);
@@ -35,91 +35,10 @@ class DataSet;
 class ParameterDefinition;
 class FitInternalStorage;
 class FitData;
+class FormulaEvaluator;
 
 class SparseJacobian;
 
-/// A queue for derivation computations
-class DFComputationQueue {
-public:
-  /// These are the arguments to FitData::deriveParameter
-  class DerivativeJob {
-  public:
-    /// the index
-    int idx;
-
-    /// the parameters
-    const gsl_vector * params;
-
-    /// the target matrix
-    SparseJacobian * target;
-
-    /// The base for parameters
-    const gsl_vector * current;
-
-    DerivativeJob(int i, const gsl_vector * parameters,
-                  SparseJacobian * tgt, const gsl_vector * cur) :
-      idx(i), params(parameters), target(tgt), current(cur)
-    {
-      ;
-    };
-  };
-
-  /// The exception raised upon termination
-  class TerminateException {
-  };
-private:
-  QQueue<DerivativeJob> queue;
-
-  /// A mutex used for synchronisation
-  QMutex mutex;
-
-  /// The wait condition (based on the mutex)
-  QWaitCondition condition;
-
-  /// A flag used to indicate that all the threads should terminate.
-  volatile bool terminate;
-
-  /// A number of running computations
-  volatile int runningComputations;
-
-  /// Used only for debug info.
-  FitData * data;
-public:
-
-  explicit DFComputationQueue(FitData * d);
-  ~DFComputationQueue();
-
-
-  /// Enqueues the job.
-  void enqueue(const DerivativeJob & job);
-
-  /// Enqueues a given job
-  void enqueue(int i, const gsl_vector * parameters,
-               SparseJacobian * target, const gsl_vector * current);
-
-
-  /// Signals to the waiting threads that they should kindly finish
-  /// (through the shouldTerminate() flag)
-  void signalTermination();
-
-  /// pops a job from the list and returns it. Blocks. It will raise
-  /// an exception to signal that the thread should be terminated.
-  DerivativeJob nextJob();
-
-
-  /// Should be called at the end of a computation to be sure all the
-  /// computations are done.
-  void doneJob();
-
-  /// Run by the overall thread to wait until all the computations
-  /// have been performed.
-  void waitForJobsDone();
-
-  /// Returns the number of jobs remaining
-  int remainingJobs();
-};
-
-class DerivativeComputationThread;
 
 /// Fit data. This data will be carried around using the void *
 /// argument to the function calls.
@@ -136,7 +55,9 @@ protected:
   ///
   /// @a target is the target vector
   /// @a current is an already-computed evaluation at @a parameters.
+  /// @a unpacked are the unpacked values of @a parameters.
   void deriveParameter(int i, const gsl_vector * parameters,
+                       const double * unpacked,
                        SparseJacobian * target, const gsl_vector * current,
                        double scale);
 
@@ -149,11 +70,66 @@ public:
   int fdf(const gsl_vector * x, gsl_vector * f, SparseJacobian * df);
 
 
-  /// Computes the function
+  /// Computes the function. The values computed for the last few
+  /// parameters are kept in a cache, so that computing again the
+  /// function for the same parameters (which happens a lot in the
+  /// fit dialog) is immediate.
   int computeFunction(const double * params, gsl_vector * f,
                       bool doSubtract = false, bool doWeights = false);
+
+  /// Computes the subfunctions, like Fit::computeSubFunctions(),
+  /// using the same cache as computeFunction().
+  void computeSubFunctions(const double * params,
+                           QList<Vector> * targetData,
+                           QStringList * targetAnnotations);
+
+  /// Clears the cache of computeFunction() and
+  /// computeSubFunctions(). It must be called whenever something
+  /// other than the parameters changes the results of the fit
+  /// function, like the soft options.
+  void clearEvaluationCache();
 private:
 
+  /// The results of the evaluation of the fit for a given set of
+  /// (unpacked) parameters.
+  class CachedEvaluation {
+  public:
+    /// A hash of the parameters, to speed up the lookup
+    uint hash;
+
+    /// The parameters
+    Vector parameters;
+
+    /// The values of the function, or empty if they were not
+    /// computed.
+    Vector values;
+
+    /// Whether the subfunctions were computed
+    bool hasSubFunctions;
+
+    /// The subfunctions
+    QList<Vector> subFunctions;
+
+    /// The annotations of the subfunctions
+    QStringList annotations;
+
+    CachedEvaluation() : hash(0), hasSubFunctions(false) {;};
+
+    /// The number of doubles stored
+    qint64 size() const;
+  };
+
+  /// The cached evaluations, the most recently used first.
+  QList<CachedEvaluation> evaluationCache;
+
+  /// Returns the cached evaluation for the given unpacked parameters,
+  /// moving it to the front of the cache, creating it if needed.
+  CachedEvaluation & cachedEvaluation(const double * params);
+
+  /// Drops the least recently used evaluations until the cache is
+  /// within the limits on its size and its number of entries.
+  void trimEvaluationCache();
+
   int totalSize;
 
   void freeSolver();
@@ -172,6 +148,28 @@ private:
   /// Wether the covarStorage matrix is up-to-date
   bool covarIsOK;
 
+  /// The index of the first point of each dataset in the overall
+  /// vectors.
+  QVector<int> datasetOffsets;
+
+  /// Whether the errors should be applied when weighting.
+  bool shouldApplyErrors(bool forceErrors) const;
+
+  /// The fused residuals kernel. It processes the @a nb points of
+  /// dataset @a ds starting from point @a first (within the dataset),
+  /// whose values are pointed to by @a target (with the given @a
+  /// stride). It subtracts the data if @a subtract is true, and
+  /// multiplies by the buffer weight and, if @a errors is true, by
+  /// the inverse of the errors if @a weight is true.
+  void processResiduals(double * target, size_t stride, int ds,
+                        int first, int nb, bool subtract,
+                        bool weight, bool errors) const;
+
+  /// Runs processResiduals() on all the points of @a target, using
+  /// the TaskScheduler threads for large vectors.
+  void processResiduals(gsl_vector * target, bool subtract,
+                        bool weight, bool forceErrors);
+
   /// Dumps the given string if debug is on
   void dumpString(const QString & str) const;
 
@@ -216,13 +214,29 @@ private:
   /// A storage space allocated by the fit for storing fit options,
   QThreadStorage<FitInternalStorage *> fitStorage;
 
-  /// The computation queue.
-  DFComputationQueue * workersQueue;
+  /// Whether the jacobian is computed using the TaskScheduler worker
+  /// threads.
+  bool useThreads;
+
+  /// The maximum number of jacobian columns computed at the same
+  /// time, as set by setupThreads()
+  int threads;
+
+  /// Copies of the internal storage for the TaskScheduler workers,
+  /// indexed by worker. They are created as needed, and dropped on
+  /// initializeSolver().
+  QVector<FitInternalStorage *> workerStorage;
+
+  /// Protects workerStorage
+  QMutex workerStorageMutex;
 
-  /// The worker threads
-  QList<DerivativeComputationThread * > workers;
+  /// Returns the storage the current thread should use when deriving
+  /// parameters: @a master for threads that are not workers, or a
+  /// copy of @a master for the worker threads.
+  FitInternalStorage * storageForWorker(FitInternalStorage * master);
 
-  friend class DerivativeComputationThread;
+  /// Deletes the copies of the storage made for the workers.
+  void clearWorkerStorage();
 
   /// Basic synchronization for updating evaluationNumer
   QMutex evaluationsMutex;
@@ -233,6 +247,10 @@ private:
   /// All parameters
   PossessiveList<FitParameter> parameters;
 
+  /// The evaluator for the FormulaParameter objects, rebuilt by
+  /// initializeParameters().
+  FormulaEvaluator * formulas;
+
 public:
 
   
@@ -240,17 +258,25 @@ public:
   /// engine.
   int evaluationNumber;
 
-  /// Setup the object to handle that many threads (if the fit is
-  /// thread-safe !)
+  /// Setup the object to compute the jacobian using the worker
+  /// threads of the TaskScheduler (if the fit is thread-safe !)
   ///
-  /// A strictly positive number indicates the number of threads
-  /// (i.e. 1 disables threading), a zero or negative number indicates
-  /// the number of processor cores that should be left free.
+  /// A strictly positive number indicates the maximum number of
+  /// threads used at the same time (i.e. 1 disables threading), a
+  /// zero or negative number indicates the number of processor cores
+  /// that should be left free. The number of worker threads itself
+  /// is global, see TaskScheduler.
   void setupThreads(int nb);
 
   /// True whether the fit has an engine
   bool hasEngine() const;
 
+  /// Whether the iterations of the fit can run in a thread other
+  /// than the main one. This requires a threadSafe() fit, and no
+  /// parameter defined by a formula, since the Ruby interpreter is
+  /// not thread-safe.
+  bool canRunInBackground() const;
+
   /// The fit in use
   const Fit * fit;
 
@@ -264,6 +290,20 @@ public:
   /// Returns the internal storage for the current thread.
   FitInternalStorage * getStorage();
 
+  /// Returns the internal storage of the current thread for this
+  /// FitData and all its subordinates.
+  QList<FitInternalStorage *> currentThreadStorage();
+
+  /// Sets the internal storage of the current thread for this
+  /// FitData and all its subordinates, from the result of
+  /// currentThreadStorage() in another thread. This is used to run
+  /// the fit iterations in a thread different from the one that
+  /// prepared the fit.
+  ///
+  /// The storage must be reset (using a list of NULL) before the
+  /// thread finishes, since QThreadStorage deletes what is left.
+  void setCurrentThreadStorage(const QList<FitInternalStorage *> & storage);
+
   /// The datasets holding the data.
   QList<const DataSet *> datasets;
 
@@ -273,6 +313,9 @@ public:
   /// If not NULL, weight of each point (1/error^2) for each point
   gsl_vector * pointWeights;
 
+  /// If not NULL, the inverse of standardYErrors.
+  gsl_vector * inverseYErrors;
+
   /// Whether or not this FitData makes use of point weights
   bool usesPointWeights() const;
 
@@ -465,6 +508,10 @@ public:
   /// true, then the errors are applied regardless of that condition.
   void weightVector(gsl_vector * tg, bool forceErrors = false);
 
+  /// Same as weightVector(), but @a tg only holds the part
+  /// corresponding to the dataset @a ds.
+  void weightVector(int ds, gsl_vector * tg, bool forceErrors = false);
+
   /// @}
 
 
@@ -829,12 +829,82 @@ void FitDialog::onFitStart()
   iterationLimitEditor->setEnabled(false);
 }
 
+/// Swallows the user input to a widget and all its descendants (and
+/// their shortcuts and actions), except for one widget and one key
+/// sequence.
+class InputBlocker : public QObject {
+  QWidget * target;
+
+  QWidget * allowed;
+
+  QKeySequence allowedKey;
+
+  bool isWithin(QObject * obj, QObject * parent) const {
+    for(; obj; obj = obj->parent())
+      if(obj == parent)
+        return true;
+    return false;
+  };
+
+public:
+  InputBlocker(QWidget * t, QWidget * a, const QKeySequence & k) :
+    target(t), allowed(a), allowedKey(k) {
+    qApp->installEventFilter(this);
+  };
+
+  ~InputBlocker() {
+    qApp->removeEventFilter(this);
+  };
+
+  bool eventFilter(QObject * obj, QEvent * event) override {
+    switch(event->type()) {
+    case QEvent::Shortcut:
+      if(static_cast<QShortcutEvent *>(event)->key() == allowedKey)
+        return false;
+      break;
+    case QEvent::Close:
+      if(obj != target)
+        return false;
+      event->ignore();
+      return true;
+    case QEvent::KeyPress:
+    case QEvent::KeyRelease:
+    case QEvent::MouseButtonPress:
+    case QEvent::MouseButtonRelease:
+    case QEvent::MouseButtonDblClick:
+    case QEvent::Wheel:
+    case QEvent::ContextMenu:
+    case QEvent::Drop:
+      break;
+    default:
+      return false;
+    }
+    return isWithin(obj, target) && ! isWithin(obj, allowed);
+  };
+};
+
 void FitDialog::startFit()
 {
+  // While the fit runs, it owns the fit data, so all the input to
+  // the dialog is blocked, but for the abort button and its
+  // shortcut. The widgets are disabled too, to make that visible.
+  InputBlocker blocker(this, cancelButton, QKeySequence(tr("Ctrl+B")));
+  QList<QWidget *> disabled;
+  for(QWidget * w : findChildren<QWidget *>(QString(),
+                                           Qt::FindDirectChildrenOnly)) {
+    if(w != cancelButton && w->isEnabled()) {
+      w->setEnabled(false);
+      disabled << w;
+    }
+  }
   try {
-    parameters.runFit(getIterationLimit());
+    parameters.runFitInBackground(getIterationLimit());
+    for(QWidget * w : disabled)
+      w->setEnabled(true);
   }
   catch (const Exception & re) {
+    for(QWidget * w : disabled)
+      w->setEnabled(true);
     updateEditors();
     message(QString("An error occurred while fitting: ") +
             re.message());
@@ -884,9 +954,12 @@ void FitDialog::onIterate(int nb, double residuals)
     arg(parameters.elapsedTime());
   message(str);
 
-  parameters.retrieveParameters();
+  // The parameters are already up-to-date in the workspace, either
+  // retrieved after the iteration, or taken from the snapshot of the
+  // fit running in the background.
   updateEditors();
-  QCoreApplication::processEvents(QEventLoop::AllEvents, 100);
+  if(! parameters.isRunningInBackground())
+    QCoreApplication::processEvents(QEventLoop::AllEvents, 100);
 }
 
 
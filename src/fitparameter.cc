@@ -212,22 +212,21 @@ void FormulaParameter::initialize(FitData * data)
   for(int i = 0; i < data->parametersPerDataset(); i++)
     parameters << data->parameterDefinitions[i].name;
 
-  QString exp2 = Expression::rubyIzeExpression(formula, parameters);
+  QString rubyFormula = Expression::rubyIzeExpression(formula, parameters);
 
   // Write that only if we're debugging QSoas
   if(Debug::debugLevel() > 0)
     Debug::debug()
-      << "Tweaked expression: '" << formula << "' -> '" << exp2 << endl;
-
-  delete expression;
-  expression = new Expression(exp2);
-
+      << "Tweaked expression: '" << formula << "' -> '"
+      << rubyFormula << endl;
 
   // Hmmmm... This means that all the fancy variables with # signs
   // inside will be delicate to handle...
-  dependencies = expression->naturalVariables();
+  //
+  // The expression itself is only compiled by the FormulaEvaluator.
+  dependencies = Expression::variablesNeeded(rubyFormula);
 
-  // <unnecessary> I think all this is completely unnecessary...
+  depsIndex.clear();
   for(int j = 0; j < dependencies.size(); j++) {
     int idx = parameters.indexOf(dependencies[j]);
     if(idx < 0)
@@ -237,34 +236,26 @@ void FormulaParameter::initialize(FitData * data)
                          arg(dependencies[j]));
     depsIndex << idx;
   }
-  // </unnecessary>
   
-  expression->setVariables(parameters);
   needsUpdate = false;
 }
 
 
 
-void FormulaParameter::copyToUnpacked(double * target, const gsl_vector * fit, 
-                                      int nb_datasets, int nb_per_dataset) const
+void FormulaParameter::copyToUnpacked(double * /*target*/,
+                                      const gsl_vector * /*fit*/, 
+                                      int /*nb_datasets*/,
+                                      int /*nb_per_dataset*/) const
 {
-  if(dsIndex >= 0) {
-    lastValue = expression->evaluate(target + dsIndex * nb_per_dataset);
-    target[paramIndex + dsIndex * nb_per_dataset] = lastValue;
-  }
-  else {
-    for(int j = 0; j < nb_datasets; j++) {
-      lastValue = expression->evaluate(target + j * nb_per_dataset);
-      target[paramIndex + j * nb_per_dataset] = lastValue;
-    }
-  }
+  // Nothing to do, the values are computed by the FormulaEvaluator
 }
 
-void FormulaParameter::copyToPacked(gsl_vector * target, const double * unpacked,
-                                    int /*nbdatasets*/, int nb_per_dataset) const
+void FormulaParameter::copyToPacked(gsl_vector * /*target*/,
+                                    const double * /*unpacked*/,
+                                    int /*nbdatasets*/,
+                                    int /*nb_per_dataset*/) const
 {
-  lastValue = unpacked[paramIndex + (dsIndex < 0 ? 0 : dsIndex) * 
-                       nb_per_dataset]; // necessary ??
+  // Nothing to do
 }
 
 void FormulaParameter::setValue(double *, const QString & value)
@@ -275,10 +266,189 @@ void FormulaParameter::setValue(double *, const QString & value)
 
 FormulaParameter::~FormulaParameter()
 {
-  delete expression;
 }
 
 QString FormulaParameter::textValue(double ) const
 {
   return "=" + formula;
 };
+
+//////////////////////////////////////////////////////////////////////
+
+/// The datasets that share the same set of formulas
+class FormulaEvaluator::Group {
+public:
+  /// The code computing all the formulas, and returning their values
+  /// as an array.
+  Expression * expression;
+
+  /// The index of the parameters computed, in the order in which
+  /// they are returned by the expression.
+  QVector<int> targets;
+
+  /// Whether the formulas depend, directly or indirectly, on the
+  /// given parameter (or compute it).
+  QVector<bool> dependsOn;
+
+  /// The datasets
+  QVector<int> datasets;
+
+  Group(const QMap<int, const FormulaParameter *> & formulas,
+        const QStringList & names);
+
+  ~Group() {
+    delete expression;
+  };
+
+  /// Computes the formulas for the given dataset
+  void evaluate(double * params) const;
+};
+
+FormulaEvaluator::Group::Group(const QMap<int, const FormulaParameter *> & formulas,
+                               const QStringList & names) :
+  expression(NULL)
+{
+  int nb = names.size();
+  dependsOn = QVector<bool>(nb, false);
+
+  // Topological sort of the formulas, while computing the transitive
+  // dependencies of each of them.
+  QHash<int, QVector<bool> > closure;
+  QSet<int> visiting;
+  std::function<void (int)> visit = [&](int idx) {
+    if(closure.contains(idx))
+      return;
+    if(visiting.contains(idx))
+      throw RuntimeError("Circular dependency in the definition of "
+                         "parameter %1").arg(names[idx]);
+    visiting.insert(idx);
+    QVector<bool> deps(nb, false);
+    for(int d : formulas[idx]->depsIndex) {
+      deps[d] = true;
+      if(formulas.contains(d)) {
+        visit(d);
+        const QVector<bool> & sub = closure[d];
+        for(int k = 0; k < nb; k++)
+          deps[k] = deps[k] || sub[k];
+      }
+    }
+    visiting.remove(idx);
+    closure[idx] = deps;
+    targets << idx;
+  };
+  for(int idx : formulas.keys())
+    visit(idx);
+
+  QStringList vars;
+  QStringList code;
+  QStringList ret;
+  for(int idx : targets) {
+    vars = names;
+    QString expr = Expression::rubyIzeExpression(formulas[idx]->formula,
+                                                 vars);
+    code << QString("%1 = begin\n%2\nend").arg(vars[idx]).arg(expr);
+    ret << vars[idx];
+    dependsOn[idx] = true;
+    const QVector<bool> & deps = closure[idx];
+    for(int k = 0; k < nb; k++)
+      dependsOn[k] = dependsOn[k] || deps[k];
+  }
+  code << QString("[%1]").arg(ret.join(", "));
+
+  QString final = code.join("\n");
+  if(Debug::debugLevel() > 0)
+    Debug::debug() << "Formula parameters code: '" << final << "'" << endl;
+  expression = new Expression(final, vars, true);
+}
+
+void FormulaEvaluator::Group::evaluate(double * params) const
+{
+  QVarLengthArray<double, 64> values(targets.size());
+  int nb = expression->evaluateIntoArray(params, values.data(),
+                                         targets.size());
+  if(nb != targets.size())
+    throw InternalError("Formula parameters evaluated to %1 values, "
+                        "but %2 were expected").
+      arg(nb).arg(targets.size());
+  for(int i = 0; i < targets.size(); i++)
+    params[targets[i]] = values[i];
+}
+
+FormulaEvaluator::FormulaEvaluator(const FitData * data,
+                                   const QList<FitParameter *> & parameters) :
+  nbPerDataset(data->parametersPerDataset())
+{
+  int nbds = data->datasets.size();
+
+  // The formulas for each dataset, indexed by the parameter they
+  // define. Dataset-local formulas take precedence over global ones.
+  QVector<QMap<int, const FormulaParameter *> > perDataset(nbds);
+  for(const FitParameter * p : parameters) {
+    const FormulaParameter * fm = dynamic_cast<const FormulaParameter *>(p);
+    if(! fm)
+      continue;
+    if(fm->needsUpdate)
+      throw InternalError("Uninitialized formula for parameter %1").
+        arg(fm->paramIndex);
+    if(fm->dsIndex < 0) {
+      for(int j = 0; j < nbds; j++)
+        if(! perDataset[j].contains(fm->paramIndex))
+          perDataset[j][fm->paramIndex] = fm;
+    }
+    else if(fm->dsIndex < nbds)
+      perDataset[fm->dsIndex][fm->paramIndex] = fm;
+  }
+
+  QStringList names;
+  for(int i = 0; i < nbPerDataset; i++)
+    names << data->parameterDefinitions[i].name;
+
+  QHash<QString, Group *> bySignature;
+  try {
+    for(int j = 0; j < nbds; j++) {
+      const QMap<int, const FormulaParameter *> & fms = perDataset[j];
+      if(fms.isEmpty())
+        continue;
+      QStringList sig;
+      for(auto it = fms.begin(); it != fms.end(); ++it)
+        sig << QString("%1=%2").arg(it.key()).arg(it.value()->formula);
+      Group * & grp = bySignature[sig.join("\n")];
+      if(! grp) {
+        grp = new Group(fms, names);
+        groups << grp;
+      }
+      grp->datasets << j;
+    }
+  }
+  catch(...) {
+    for(Group * g : groups)
+      delete g;
+    throw;
+  }
+}
+
+FormulaEvaluator::~FormulaEvaluator()
+{
+  for(Group * g : groups)
+    delete g;
+}
+
+void FormulaEvaluator::evaluate(double * unpacked) const
+{
+  for(const Group * g : groups)
+    for(int ds : g->datasets)
+      g->evaluate(unpacked + ds * nbPerDataset);
+}
+
+void FormulaEvaluator::evaluateDependent(int index,
+                                         const QVector<bool> & datasets,
+                                         double * unpacked) const
+{
+  for(const Group * g : groups) {
+    if(! g->dependsOn[index])
+      continue;
+    for(int ds : g->datasets)
+      if(datasets[ds])
+        g->evaluate(unpacked + ds * nbPerDataset);
+  }
+}
@@ -203,26 +203,24 @@ public:
 
 /// A parameter whose value is defined as a function of other
 /// parameters.
+///
+/// The values of these parameters are not computed by
+/// copyToUnpacked(), but all at once by the FormulaEvaluator of the
+/// FitData.
 class FormulaParameter : public FitParameter {
-  /// The expression we're using
-  Expression * expression;
 
-  /// The parameter dependencies (to ensure they are computed in the
-  /// correct order). It is also the argument list to the block
+  /// The parameter dependencies, rubyized.
   QStringList dependencies;
 
   /// The same thing as dependencies, but with their index (in the
   /// parametersDefinition)
   QVector<int> depsIndex;
 
-
-
   QString formula;
 
   bool needsUpdate;
 
-  // The last value this stuff took... (could be useful ?)
-  mutable double lastValue;
+  friend class FormulaEvaluator;
 
 public:
 
@@ -238,7 +236,7 @@ public:
   virtual bool fixed() const override { return true;};
 
   FormulaParameter(int p, int ds, const QString & f)  :
-    FitParameter(p, ds), expression(NULL), formula(f), needsUpdate(true) {;};
+    FitParameter(p, ds), formula(f), needsUpdate(true) {;};
 
   virtual void initialize(FitData * data) override;
 
@@ -260,4 +258,45 @@ public:
 
 };
 
+/// Computes the values of all the FormulaParameter of a fit.
+///
+/// All the formulas that apply to a given dataset are compiled into a
+/// single Ruby block that computes them in dependency order, and
+/// datasets that have exactly the same formulas share the same
+/// block. This way, there is only one Ruby call per dataset,
+/// regardless of the number of formulas.
+class FormulaEvaluator {
+
+  class Group;
+
+  /// The groups of datasets sharing the same formulas
+  QList<Group *> groups;
+
+  /// The number of parameters per dataset
+  int nbPerDataset;
+
+public:
+
+  /// Builds the evaluator for all the FormulaParameter in @a
+  /// parameters, which must all have been initialized.
+  ///
+  /// Throws a RuntimeError if the formulas depend circularly on each
+  /// other.
+  FormulaEvaluator(const FitData * data,
+                   const QList<FitParameter *> & parameters);
+
+  ~FormulaEvaluator();
+
+  /// Computes all the formulas for all the datasets, using the
+  /// values already present in @a unpacked.
+  void evaluate(double * unpacked) const;
+
+  /// Only recomputes the formulas that depend (directly or
+  /// indirectly) on the parameter @a index, for the datasets for
+  /// which @a datasets is true.
+  void evaluateDependent(int index, const QVector<bool> & datasets,
+                         double * unpacked) const;
+
+};
+
 #endif
@@ -31,6 +31,10 @@
 
 #include <utils.hh>
 #include <debug.hh>
+#include <profiler.hh>
+#include <settings-templates.hh>
+
+#include <QElapsedTimer>
 
 #include <file.hh>
 
@@ -113,7 +117,8 @@ FitWorkspace::FitWorkspace(FitData * d) :
   fitEnding(NotStarted),
   parametersStatus(FitWorkspace::ParametersUnknown),
   covarianceMatrixOK(false),
-  tracingStream(NULL)
+  tracingStream(NULL),
+  backgroundFit(false)
 {
   if(currentWS)
     throw InternalError("Trying to recurse into a fit workspace, this should not happen");
@@ -212,6 +217,8 @@ CommandOptions FitWorkspace::currentSoftOptions() const
 
 void FitWorkspace::processSoftOptions(const CommandOptions & opts) const
 {
+  // The soft options may change the results of the function
+  fitData->clearEvaluationCache();
   return fitData->fit->processSoftOptions(opts, fitData);
 }
 
@@ -430,8 +437,7 @@ QList<Vector> FitWorkspace::computeSubFunctions(bool dontSend,
     return ret;
   updateParameterValues(dontSend);
   QStringList str;
-  fitData->fit->computeSubFunctions(values, fitData, 
-                                    &ret, ann ? ann : &str);
+  fitData->computeSubFunctions(values, &ret, ann ? ann : &str);
 
   return ret;
 }
@@ -1764,7 +1770,7 @@ void FitWorkspace::startFit()
   soas().shouldStopFit = false;
   prepareFit(fitEngineParameterValues.value(fitData->engineFactory, NULL));
   parametersBackup = saveParameterValues();
-  shouldCancelFit = false;
+  shouldCancelFit.storeRelease(0);
   freeParams = fitData->freeParameters();
 
   recompute(true);
@@ -1851,10 +1857,12 @@ void FitWorkspace::setTracing(QTextStream * target)
   tracingStream = target;
 }
 
-void FitWorkspace::traceFit()
+void FitWorkspace::traceFit(const double * vals)
 {
   if(! tracingStream)
     return;
+  if(! vals)
+    vals = values;
   ValueHash trace;
 
   trace << "iteration" << fitData->nbIterations;
@@ -1877,7 +1885,7 @@ void FitWorkspace::traceFit()
       n += QString("[#%1]").arg(fp->dsIndex);
     int idx = (fp->dsIndex >= 0 ? fp->dsIndex : 0) * nbParameters +
       fp->paramIndex;
-    trace << n << values[idx];
+    trace << n << vals[idx];
   }
   if(fitData->nbIterations == 0) {
     QString hd = QString("## %1").arg(trace.keyOrder.join("\t"));
@@ -1886,31 +1894,32 @@ void FitWorkspace::traceFit()
   (*tracingStream) << trace.toString("\t", "x", true) << endl;
 }
 
+FitWorkspace::Ending FitWorkspace::iterationEnding(int status,
+                                                   int iterationLimit) const
+{
+  if(shouldCancelFit.loadAcquire() || soas().shouldStopFit)
+    return Cancelled;
+  if(fitData->nbIterations >= iterationLimit)
+    return TimeOut;
+  if(status != GSL_CONTINUE) {
+    if(status == GSL_SUCCESS)
+      return Converged;
+    return Error;
+  }
+  return Running;
+}
+
 FitWorkspace::Ending FitWorkspace::runFit(int iterationLimit)
 {
+  ProfilerSection section(QString("fit: %1").arg(fitName(false)));
   try {
     startFit();
     traceFit();
-    int status;
     do {
-      status = nextIteration();
+      int status = nextIteration();
       traceFit();
-      if(shouldCancelFit || soas().shouldStopFit) {
-        fitEnding = Cancelled;
-        break;
-      };
-      if(fitData->nbIterations >= iterationLimit) {
-        fitEnding = TimeOut;
-        break;
-      }
-      if(status != GSL_CONTINUE) {
-        if(status == GSL_SUCCESS)
-          fitEnding = Converged;
-        else
-          fitEnding = Error;
-        break;
-      }
-    } while(true);
+      fitEnding = iterationEnding(status, iterationLimit);
+    } while(fitEnding == Running);
   }
   catch(::Exception & e) {
     Terminal::out << "Fit aborted with error: " << e.message() << endl;
@@ -1926,6 +1935,168 @@ FitWorkspace::Ending FitWorkspace::runFit(int iterationLimit)
   return fitEnding;
 }
 
+static SettingsValue<double> progressRate("fit/progress-rate", 10,
+                                          "maximum number of updates per second of the display of fits running in the background");
+
+/// The thread in which the iterations of a fit run.
+class FitIterationThread : public QThread {
+public:
+  FitWorkspace * workspace;
+
+  int iterationLimit;
+
+  /// The internal storage of the fit, from the thread which prepared
+  /// the fit.
+  QList<FitInternalStorage *> storage;
+
+  /// The exception thrown by the iterations, if any
+  std::exception_ptr exception;
+
+  FitWorkspace::Ending ending;
+
+  /// The residuals after the last iteration
+  double residuals;
+
+  FitIterationThread(FitWorkspace * ws, int lim) :
+    workspace(ws), iterationLimit(lim), ending(FitWorkspace::Running),
+    residuals(ws->residuals) {
+    storage = workspace->fitData->currentThreadStorage();
+  };
+
+  void run() override {
+    FitData * data = workspace->fitData;
+    data->setCurrentThreadStorage(storage);
+    try {
+      ending = workspace->backgroundIterations(iterationLimit, residuals);
+    }
+    catch(...) {
+      exception = std::current_exception();
+    }
+    // QThreadStorage would delete the storage otherwise.
+    data->setCurrentThreadStorage(QList<FitInternalStorage *>());
+
+    // The results are handed back to the main thread, where they are
+    // processed before the finished() signal.
+    QMetaObject::invokeMethod(workspace, "backgroundFitDone",
+                              Qt::QueuedConnection,
+                              Q_ARG(int, ending),
+                              Q_ARG(double, residuals));
+  };
+};
+
+FitWorkspace::Ending FitWorkspace::backgroundIterations(int iterationLimit,
+                                                       double & res)
+{
+  QElapsedTimer timer;
+  timer.start();
+  qint64 interval = progressRate > 0 ? 1000/progressRate : 0;
+  qint64 last = -interval;
+
+  Vector current(nbParameters * datasets, 0);
+  Ending ending;
+  do {
+    int status = fitData->iterate();
+    res = fitData->residuals();
+    fitData->unpackCurrentParameters(current.data());
+    traceFit(current.data());
+    ending = iterationEnding(status, iterationLimit);
+
+    // We only send a snapshot if the previous one has been taken, and
+    // not too often.
+    qint64 now = timer.elapsed();
+    if(ending == Running && now - last >= interval) {
+      QMutexLocker l(&progressMutex);
+      if(! progress.pending) {
+        progress.iteration = fitData->nbIterations;
+        progress.residuals = res;
+        progress.parameters = current;
+        progress.pending = true;
+        last = now;
+        QMetaObject::invokeMethod(this, "publishProgress",
+                                  Qt::QueuedConnection);
+      }
+    }
+  } while(ending == Running);
+  return ending;
+}
+
+void FitWorkspace::publishProgress()
+{
+  FitProgress p;
+  {
+    QMutexLocker l(&progressMutex);
+    if(! progress.pending)
+      return;
+    p = progress;
+    progress.pending = false;
+  }
+  // The fit thread does not touch the values, only fitData
+  int size = nbParameters * datasets;
+  for(int i = 0; i < size && i < p.parameters.size(); i++)
+    values[i] = p.parameters[i];
+  emit(iterated(p.iteration, p.residuals, p.parameters));
+}
+
+void FitWorkspace::backgroundFitDone(int ending, double res)
+{
+  fitEnding = static_cast<Ending>(ending);
+  residuals = res;
+  lastResiduals = res;
+}
+
+bool FitWorkspace::isRunningInBackground() const
+{
+  return backgroundFit;
+}
+
+FitWorkspace::Ending FitWorkspace::runFitInBackground(int iterationLimit)
+{
+  // Fits that need the Ruby interpreter run in this thread.
+  if(! fitData->canRunInBackground())
+    return runFit(iterationLimit);
+
+  ProfilerSection section(QString("fit: %1").arg(fitName(false)));
+  try {
+    startFit();
+    traceFit();
+
+    FitIterationThread thread(this, iterationLimit);
+    {
+      TemporaryChange<bool> bg(backgroundFit, true);
+      QEventLoop loop;
+      connect(&thread, SIGNAL(finished()), &loop, SLOT(quit()));
+      thread.start();
+      loop.exec();
+      thread.wait();
+    }
+    {
+      QMutexLocker l(&progressMutex);
+      progress.pending = false;
+    }
+
+    // Now, the fit data is back in this thread, and
+    // backgroundFitDone() has set the ending and the residuals. The
+    // snapshots only give intermediate values, we need the final
+    // parameters.
+    retrieveParameters();
+    if(thread.exception)
+      std::rethrow_exception(thread.exception);
+    emit(iterated(fitData->nbIterations, residuals,
+                  saveParameterValues()));
+  }
+  catch(::Exception & e) {
+    Terminal::out << "Fit aborted with error: " << e.message() << endl;
+    fitEnding = Exception;
+    if(fitData->debug > 0)
+      Debug::debug() << "Fit aborted with exception: " << e.message() << endl
+                     << "\nBacktrace:\n\t"
+                     << e.exceptionBacktrace().join("\n\t") << endl;
+  }
+
+  endFit(fitEnding);
+  return fitEnding;
+}
+
 
 void FitWorkspace::endFit(FitWorkspace::Ending ending)
 {
@@ -1968,7 +2139,7 @@ void FitWorkspace::endFit(FitWorkspace::Ending ending)
 
 void FitWorkspace::cancelFit()
 {
-  shouldCancelFit = true;
+  shouldCancelFit.storeRelease(1);
 }
 
 void FitWorkspace::quit()
@@ -653,8 +653,10 @@ public:
   /// @name Functions to run the fit
   /// @{
 
-  /// Whether or not we should cancel the current fit.
-  bool shouldCancelFit;
+  /// Whether or not we should cancel the current fit. It is atomic
+  /// since it is set from the GUI thread while the iterations may
+  /// run in another one.
+  QAtomicInt shouldCancelFit;
 
   /// The internal residuals
   double residuals;
@@ -707,8 +709,29 @@ public:
   /// Runs the next iteration, returns the status code
   int nextIteration();
 
+  /// Returns how the fit should end after an iteration that returned
+  /// \a status, or Running if it should go on.
+  Ending iterationEnding(int status, int iterationLimit) const;
+
   Ending runFit(int iterationLimit);
 
+  /// Same as runFit(), but the iterations run in a dedicated thread,
+  /// while the calling thread processes events. The thread running
+  /// the iterations owns the fit data until it is finished, so the
+  /// caller should prevent any interaction with it in the meantime.
+  ///
+  /// Fits that use the Ruby interpreter (see
+  /// FitData::canRunInBackground()) just run with runFit().
+  ///
+  /// Instead of iterated() at each iteration, the workspace emits
+  /// iterated() with snapshots of the progress, at most
+  /// fit/progress-rate times per second, and a last time at the end.
+  Ending runFitInBackground(int iterationLimit);
+
+  /// Whether the fit iterations are currently running in another
+  /// thread.
+  bool isRunningInBackground() const;
+
   void endFit(Ending ending);
 
   /// The reason for the end of fit
@@ -745,8 +768,47 @@ private:
   /// If this isn't NULL, then tracing will occur
   QTextStream * tracingStream;
 
-  /// If tracing is on, write the tracing information to the tracing file.
-  void traceFit();
+  /// If tracing is on, write the tracing information to the tracing
+  /// file. Uses \a vals rather than the current values if not NULL.
+  void traceFit(const double * vals = NULL);
+
+  friend class FitIterationThread;
+
+  /// The progress of a fit running in the background
+  class FitProgress {
+  public:
+    int iteration;
+    double residuals;
+    Vector parameters;
+
+    /// Whether a snapshot was sent but not taken yet.
+    bool pending;
+
+    FitProgress() : iteration(0), residuals(0), pending(false) {;};
+  };
+
+  /// The last progress, protected by progressMutex
+  FitProgress progress;
+
+  QMutex progressMutex;
+
+  /// Whether the iterations are running in another thread
+  bool backgroundFit;
+
+  /// Runs the iterations, in the fit thread. Returns the ending, and
+  /// sets \a res to the residuals after the last iteration. It
+  /// touches neither the parameters nor the residuals of the
+  /// workspace.
+  Ending backgroundIterations(int iterationLimit, double & res);
+
+private slots:
+  /// Takes the last snapshot of the fit progress and emits
+  /// iterated(). Called in the main thread.
+  void publishProgress();
+
+  /// Sets the ending and the residuals at the end of a fit that ran
+  /// in the background. Called in the main thread.
+  void backgroundFitDone(int ending, double res);
 
 public:
 
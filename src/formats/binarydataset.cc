@@ -0,0 +1,161 @@
+/*
+  binarydataset.cc: reading of the native binary format of QSoas
+  Copyright 2021 by CNRS/AMU
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <headers.hh>
+#include <databackend.hh>
+#include <dataset.hh>
+#include <datasetwriter.hh>
+
+#include <exceptions.hh>
+
+#include <QtEndian>
+
+/// Reads the files written by DataSetWriter in binary format. See
+/// the DataSetWriter documentation for the description of the format.
+///
+/// When the stream is a real file, it is mapped into memory, so that
+/// each column is read with a single copy.
+class BinaryDataSetBackend : public DataBackend {
+protected:
+
+  virtual int couldBeMine(const QByteArray & peek,
+                          const QString & fileName) const override;
+
+  virtual QList<DataSet *> readFromStream(QIODevice * stream,
+                                          const QString & fileName,
+                                          const CommandOptions & opts) const override;
+
+  /// Reads the dataset from the given data
+  static DataSet * readData(const uchar * data, qint64 size,
+                            const QString & fileName);
+
+public:
+  BinaryDataSetBackend();
+};
+
+int BinaryDataSetBackend::couldBeMine(const QByteArray & peek,
+                                      const QString & /*fileName*/) const
+{
+  if(peek.startsWith(DataSetWriter::binaryMagic))
+    return 1000;
+  return 0;
+}
+
+DataSet * BinaryDataSetBackend::readData(const uchar * data, qint64 size,
+                                         const QString & fileName)
+{
+  const int hs = DataSetWriter::binaryHeaderSize;
+  if(size < hs || memcmp(data, DataSetWriter::binaryMagic, 8) != 0)
+    throw RuntimeError("File '%1' is not a QSoas binary file").
+      arg(fileName);
+  quint32 version = qFromLittleEndian<quint32>(data + 8);
+  if(version > DataSetWriter::binaryVersion)
+    throw RuntimeError("File '%1' was written by a more recent version of QSoas (format version %2)").
+      arg(fileName).arg(version);
+  quint32 nbCols = qFromLittleEndian<quint32>(data + 12);
+  quint64 nbRows = qFromLittleEndian<quint64>(data + 16);
+  quint64 trailer = qFromLittleEndian<quint64>(data + 24);
+
+  if(nbRows > (quint64) size || nbCols > (quint64) size ||
+     trailer != hs + nbCols * nbRows * 8 || trailer > (quint64) size)
+    throw RuntimeError("File '%1' is truncated or corrupted").
+      arg(fileName);
+
+  QList<Vector> columns;
+  const uchar * col = data + hs;
+  for(quint32 i = 0; i < nbCols; i++, col += nbRows * 8) {
+    Vector v(nbRows, 0);
+    memcpy(v.data(), col, nbRows * 8);
+#if Q_BYTE_ORDER != Q_LITTLE_ENDIAN
+    for(double & d : v) {
+      quint64 raw = qFromLittleEndian<quint64>(reinterpret_cast<uchar *>(&d));
+      memcpy(&d, &raw, sizeof(d));
+    }
+#endif
+    columns << v;
+  }
+
+  DataSet * ds = new DataSet(columns);
+  QByteArray tr = QByteArray::fromRawData(reinterpret_cast<const char *>(data + trailer),
+                                          size - trailer);
+  QDataStream in(tr);
+  in.setVersion(QDataStream::Qt_4_8);
+
+  ValueHash meta;
+  Vector perp;
+  QSet<QString> flags;
+  in >> ds->name >> ds->segments >> meta >> perp >> flags
+     >> ds->options >> ds->columnNames >> ds->rowNames
+     >> ds->perpCoordNames;
+  if(in.status() != QDataStream::Ok) {
+    delete ds;
+    throw RuntimeError("File '%1' is truncated or corrupted").
+      arg(fileName);
+  }
+  ds->addMetaData(meta);
+  ds->setPerpendicularCoordinates(perp);
+  ds->setFlags(flags);
+  return ds;
+}
+
+QList<DataSet *> BinaryDataSetBackend::readFromStream(QIODevice * stream,
+                                                      const QString & fileName,
+                                                      const CommandOptions & /*opts*/) const
+{
+  DataSet * ds = NULL;
+  QFileDevice * file = qobject_cast<QFileDevice *>(stream);
+  uchar * mapped = NULL;
+  qint64 size = 0;
+  if(file) {
+    size = file->size();
+    mapped = file->map(0, size);
+  }
+  if(mapped) {
+    try {
+      ds = readData(mapped, size, fileName);
+    }
+    catch(...) {
+      file->unmap(mapped);
+      throw;
+    }
+    file->unmap(mapped);
+  }
+  else {
+    QByteArray contents = stream->readAll();
+    ds = readData(reinterpret_cast<const uchar *>(contents.constData()),
+                  contents.size(), fileName);
+  }
+
+  // Like all the other backends, the dataset is named after the file
+  ds->name = QDir::cleanPath(fileName);
+  setMetaDataForFile(ds, fileName);
+
+  QList<DataSet *> rv;
+  rv << ds;
+  return rv;
+}
+
+BinaryDataSetBackend::BinaryDataSetBackend() :
+  DataBackend("binary",
+              "QSoas binary files",
+              "Files saved by QSoas in the binary format (using save /format=binary)")
+{
+}
+
+static BinaryDataSetBackend binaryBackend;
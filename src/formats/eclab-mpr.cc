@@ -0,0 +1,557 @@
+/*
+  eclab-mpr.cc: reading of binary EC-Lab files
+  Copyright 2021 by CNRS/AMU
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <headers.hh>
+#include <databackend.hh>
+#include <dataset.hh>
+
+#include <utils.hh>
+#include <exceptions.hh>
+
+#include <valuehash.hh>
+
+#include <QtEndian>
+
+/// Reads the binary .mpr files of Bio-Logic's EC-Lab.
+///
+/// These files are made of a file header followed by "modules", each
+/// with its own header. The modules we use are:
+/// @li "VMP Set   ", the settings, containing the technique;
+/// @li "VMP data  ", the data proper;
+/// @li "VMP LOG   ", which contains the date of the experiment.
+///
+/// The data module starts with the number of points and the list of
+/// column IDs, and contains records whose layout is given by the
+/// column IDs. Some of the column IDs correspond to bits of a single
+/// "flags" byte.
+///
+/// The size of the columns whose ID is unknown is deduced from the
+/// size of the records, which is only possible if there is only one
+/// of them, or if they all come after the known ones, in which case
+/// they are skipped.
+class ECLabMPR : public DataBackend {
+protected:
+
+  /// The type of a column
+  enum ColumnType {
+    Flag,
+    UInt8,
+    UInt16,
+    UInt32,
+    Float32,
+    Float64
+  };
+
+  /// The description of a column
+  class Column {
+  public:
+    QString name;
+    ColumnType type;
+    /// The mask of the flag
+    int mask;
+
+    Column(const QString & n = QString(), ColumnType t = Float32,
+           int m = 0) :
+      name(n), type(t), mask(m) {
+    };
+
+    /// Size of the column in the records.
+    int size() const {
+      switch(type) {
+      case UInt8:
+        return 1;
+      case UInt16:
+        return 2;
+      case UInt32:
+      case Float32:
+        return 4;
+      case Float64:
+        return 8;
+      default:
+        break;
+      }
+      return 0;
+    };
+  };
+
+  /// The known columns, by ID
+  static const QHash<int, Column> & knownColumns();
+  static QHash<int, Column> buildKnownColumns();
+
+  /// The names of the techniques, by ID
+  static const QHash<int, QString> & techniques();
+  static QHash<int, QString> buildTechniques();
+
+  /// A module of the file
+  class Module {
+  public:
+    QByteArray shortName;
+    QString longName;
+    int version;
+    QString date;
+    const char * data;
+    quint32 length;
+  };
+
+  /// Splits the file into modules.
+  static QList<Module> readModules(const QByteArray & contents,
+                                   const QString & fileName);
+
+  /// Reads an little-endian integer
+  template<typename T> static T readInt(const char * data) {
+    return qFromLittleEndian<T>(reinterpret_cast<const uchar *>(data));
+  };
+
+  static double readFloat32(const char * data) {
+    quint32 v = readInt<quint32>(data);
+    float f;
+    memcpy(&f, &v, sizeof(f));
+    return f;
+  };
+
+  static double readFloat64(const char * data) {
+    quint64 v = readInt<quint64>(data);
+    double d;
+    memcpy(&d, &v, sizeof(d));
+    return d;
+  };
+
+  virtual int couldBeMine(const QByteArray & peek,
+                          const QString & fileName) const override;
+
+  virtual QList<DataSet *> readFromStream(QIODevice * stream,
+                                          const QString & fileName,
+                                          const CommandOptions & opts) const override;
+
+public:
+  ECLabMPR();
+};
+
+static const char * fileMagic = "BIO-LOGIC MODULAR FILE";
+
+/// Size of the file header
+static const int fileHeaderSize = 52;
+
+// The tables are built within the initialization of function-local
+// statics, so that files can be loaded concurrently.
+const QHash<int, ECLabMPR::Column> & ECLabMPR::knownColumns()
+{
+  static const QHash<int, Column> cols = buildKnownColumns();
+  return cols;
+}
+
+QHash<int, ECLabMPR::Column> ECLabMPR::buildKnownColumns()
+{
+  QHash<int, Column> cols;
+  // Flags, all within the same byte
+  cols[1] = Column("mode", Flag, 0x03);
+  cols[2] = Column("ox/red", Flag, 0x04);
+  cols[3] = Column("error", Flag, 0x08);
+  cols[21] = Column("control changes", Flag, 0x10);
+  cols[31] = Column("Ns changes", Flag, 0x20);
+  cols[65] = Column("counter inc.", Flag, 0x80);
+
+  cols[4] = Column("time/s", Float64);
+  cols[5] = Column("control/V/mA", Float32);
+  cols[6] = Column("Ewe/V", Float32);
+  cols[7] = Column("dQ/mA.h", Float64);
+  cols[8] = Column("I/mA", Float32);
+  cols[9] = Column("Ece/V", Float32);
+  cols[11] = Column("I/mA", Float64);
+  cols[13] = Column("(Q-Qo)/mA.h", Float64);
+  cols[16] = Column("Analog IN 1/V", Float32);
+  cols[19] = Column("control/V", Float32);
+  cols[20] = Column("control/mA", Float32);
+  cols[23] = Column("dQ/mA.h", Float64);
+  cols[24] = Column("cycle number", Float64);
+  cols[26] = Column("Rapp/Ohm", Float32);
+  cols[32] = Column("freq/Hz", Float32);
+  cols[33] = Column("|Ewe|/V", Float32);
+  cols[34] = Column("|I|/A", Float32);
+  cols[35] = Column("Phase(Z)/deg", Float32);
+  cols[36] = Column("|Z|/Ohm", Float32);
+  cols[37] = Column("Re(Z)/Ohm", Float32);
+  cols[38] = Column("-Im(Z)/Ohm", Float32);
+  cols[39] = Column("I Range", UInt16);
+  cols[69] = Column("R/Ohm", Float32);
+  cols[70] = Column("P/W", Float32);
+  cols[74] = Column("Energy/W.h", Float64);
+  cols[75] = Column("Analog OUT/V", Float32);
+  cols[76] = Column("<I>/mA", Float32);
+  cols[77] = Column("<Ewe>/V", Float32);
+  cols[78] = Column("Cs-2/µF-2", Float32);
+  cols[96] = Column("|Ece|/V", Float32);
+  cols[98] = Column("Phase(Zce)/deg", Float32);
+  cols[99] = Column("|Zce|/Ohm", Float32);
+  cols[100] = Column("Re(Zce)/Ohm", Float32);
+  cols[101] = Column("-Im(Zce)/Ohm", Float32);
+  cols[123] = Column("Energy charge/W.h", Float64);
+  cols[124] = Column("Energy discharge/W.h", Float64);
+  cols[125] = Column("Capacitance charge/µF", Float64);
+  cols[126] = Column("Capacitance discharge/µF", Float64);
+  cols[131] = Column("Ns", UInt16);
+  cols[163] = Column("|Estack|/V", Float32);
+  cols[168] = Column("Rcmp/Ohm", Float32);
+  cols[169] = Column("Cs/µF", Float32);
+  cols[172] = Column("Cp/µF", Float32);
+  cols[173] = Column("Cp-2/µF-2", Float32);
+  cols[174] = Column("Ewe/V", Float32);
+  cols[241] = Column("|E1|/V", Float32);
+  cols[242] = Column("|E2|/V", Float32);
+  cols[326] = Column("P/W", Float32);
+  cols[434] = Column("(Q-Qo)/C", Float32);
+  cols[435] = Column("dQ/C", Float32);
+  cols[467] = Column("Q charge/discharge/mA.h", Float64);
+  cols[468] = Column("half cycle", UInt32);
+  cols[469] = Column("z cycle", UInt32);
+  cols[471] = Column("<Ece>/V", Float32);
+  cols[473] = Column("THD Ewe/%", Float32);
+  cols[474] = Column("THD I/%", Float32);
+  cols[476] = Column("NSD Ewe/%", Float32);
+  cols[477] = Column("NSD I/%", Float32);
+  cols[479] = Column("NSR Ewe/%", Float32);
+  cols[480] = Column("NSR I/%", Float32);
+  return cols;
+}
+
+const QHash<int, QString> & ECLabMPR::techniques()
+{
+  static const QHash<int, QString> tech = buildTechniques();
+  return tech;
+}
+
+QHash<int, QString> ECLabMPR::buildTechniques()
+{
+  QHash<int, QString> tech;
+  tech[0x03] = "Chronoamperometry / Chronocoulometry";
+  tech[0x04] = "Chronopotentiometry";
+  tech[0x06] = "Cyclic Voltammetry";
+  tech[0x0b] = "Open Circuit Voltage";
+  tech[0x18] = "Cyclic Voltammetry";
+  tech[0x19] = "Chronoamperometry / Chronocoulometry";
+  tech[0x1c] = "Potentio Electrochemical Impedance Spectroscopy";
+  tech[0x1d] = "Galvano Electrochemical Impedance Spectroscopy";
+  tech[0x32] = "Linear Sweep Voltammetry";
+  tech[0x6c] = "Linear Sweep Voltammetry";
+  return tech;
+}
+
+QList<ECLabMPR::Module> ECLabMPR::readModules(const QByteArray & contents,
+                                              const QString & fileName)
+{
+  QList<Module> rv;
+  const char * data = contents.constData();
+  int size = contents.size();
+  int pos = fileHeaderSize;
+
+  // The header of the modules. There are two versions, the newer
+  // one has two additional 32-bits integers:
+  //
+  // v1: short name (10), long name (25), length, version, date (8)
+  // v2: short name (10), long name (25), max length, length,
+  //     version, unknown, date (8)
+  const int v1Size = 10 + 25 + 4 + 4 + 8;
+  const int v2Size = v1Size + 8;
+
+  while(pos < size) {
+    if(size - pos < 6 + v1Size || qstrncmp(data + pos, "MODULE", 6) != 0)
+      throw RuntimeError("Invalid module header at position %1 in file '%2'").
+        arg(pos).arg(fileName);
+    pos += 6;
+    const char * hd = data + pos;
+    Module m;
+    m.shortName = QByteArray(hd, 10);
+    m.longName = QString::fromLatin1(hd + 10, 25).trimmed();
+
+    // We detect the version of the header from the date, which is
+    // formatted as mm/dd/yy
+    QByteArray date = QByteArray(hd + 43, 8);
+    int hds = v1Size;
+    if(date[2] == '/' && date[5] == '/') {
+      m.length = readInt<quint32>(hd + 35);
+      m.version = readInt<quint32>(hd + 39);
+    }
+    else {
+      if(size - pos < v2Size)
+        throw RuntimeError("Truncated module header at position %1 in file '%2'").
+          arg(pos).arg(fileName);
+      m.length = readInt<quint32>(hd + 39);
+      m.version = readInt<quint32>(hd + 43);
+      date = QByteArray(hd + 51, 8);
+      hds = v2Size;
+    }
+    m.date = QString::fromLatin1(date);
+    pos += hds;
+    if((qint64)pos + m.length > size)
+      throw RuntimeError("Module '%1' in file '%2' is truncated").
+        arg(m.longName).arg(fileName);
+    m.data = data + pos;
+    pos += m.length;
+    rv << m;
+  }
+  return rv;
+}
+
+int ECLabMPR::couldBeMine(const QByteArray & peek,
+                          const QString & /*fileName*/) const
+{
+  if(peek.startsWith(fileMagic))
+    return 1000;
+  return 0;
+}
+
+QList<DataSet *> ECLabMPR::readFromStream(QIODevice * stream,
+                                          const QString & fileName,
+                                          const CommandOptions & /*opts*/) const
+{
+  QByteArray contents = stream->readAll();
+  if(! contents.startsWith(fileMagic))
+    throw RuntimeError("File '%1' is not a binary EC-Lab file").
+      arg(fileName);
+
+  QList<Module> modules = readModules(contents, fileName);
+
+  ValueHash meta;
+  const Module * dataModule = NULL;
+  for(const Module & m : modules) {
+    if(m.shortName.startsWith("VMP data"))
+      dataModule = &m;
+    else if(m.shortName.startsWith("VMP Set")) {
+      if(m.length > 0) {
+        int id = (unsigned char) m.data[0];
+        meta["technique_id"] = id;
+        if(techniques().contains(id))
+          meta["method"] = techniques()[id];
+      }
+      // Fallback for the date, the date of the settings module
+      QRegExp red("(\\d+)/(\\d+)/(\\d+)");
+      if(! meta.contains("exp_date") && red.indexIn(m.date) == 0)
+        meta["exp_date"] = QDateTime(QDate(2000 + red.cap(3).toInt(),
+                                           red.cap(1).toInt(),
+                                           red.cap(2).toInt()));
+    }
+    else if(m.shortName.startsWith("VMP LOG")) {
+      // The date of the acquisition is stored as an OLE timestamp,
+      // i.e. the number of days since 1899-12-30, at one of these
+      // offsets, depending on the version.
+      int offsets[] = {465, 469, 473, 585};
+      for(int off : offsets) {
+        if(m.length < (quint32) off + 8)
+          break;
+        double days = readFloat64(m.data + off);
+        if(days > 40000 && days < 80000) {
+          QDateTime dt(QDate(1899, 12, 30), QTime(0, 0));
+          meta["exp_date"] = dt.addMSecs((qint64)(days * 86400000.0));
+          break;
+        }
+      }
+    }
+  }
+
+  if(! dataModule)
+    throw RuntimeError("No data in file '%1'").arg(fileName);
+  const Module & dm = *dataModule;
+
+  if(dm.length < 5)
+    throw RuntimeError("Truncated data in file '%1'").arg(fileName);
+  quint32 nbPoints = readInt<quint32>(dm.data);
+  int nbCols = (unsigned char) dm.data[4];
+
+  QList<int> ids;
+  quint32 headerSize;
+  switch(dm.version) {
+  case 0:
+    for(int i = 0; i < nbCols; i++)
+      ids << (unsigned char) dm.data[5 + i];
+    headerSize = 100;
+    break;
+  case 2:
+  case 3:
+    for(int i = 0; i < nbCols; i++)
+      ids << readInt<quint16>(dm.data + 5 + 2*i);
+    headerSize = (dm.version == 2 ? 405 : 406);
+    break;
+  default:
+    throw RuntimeError("Unsupported version %1 of the data module in file '%2'").
+      arg(dm.version).arg(fileName);
+  }
+
+  if(dm.length < headerSize)
+    throw RuntimeError("Truncated data in file '%1'").arg(fileName);
+
+  // The size of the unknown columns, if any, is deduced from the
+  // size of the records.
+  const QHash<int, Column> & known = knownColumns();
+  QList<int> unknown;
+  int knownSize = 0;
+  bool hasFlags = false;
+  bool unknownLast = true;
+  for(int id : ids) {
+    if(! known.contains(id)) {
+      unknown << id;
+      continue;
+    }
+    const Column & c = known[id];
+    if(c.type == Flag) {
+      if(! hasFlags)
+        knownSize += 1;
+      hasFlags = true;
+    }
+    else
+      knownSize += c.size();
+    if(unknown.size() > 0)
+      unknownLast = false;
+  }
+
+  int unknownSize = 0;
+  if(unknown.size() > 0 && nbPoints > 0) {
+    unknownSize = (dm.length - headerSize) / nbPoints - knownSize;
+    if(unknown.size() == 1) {
+      if(unknownSize != 1 && unknownSize != 2 &&
+         unknownSize != 4 && unknownSize != 8)
+        throw RuntimeError("Could not determine the size of the column of unknown ID %1 in file '%2'").
+          arg(unknown[0]).arg(fileName);
+    }
+    else if(! unknownLast || unknownSize < 0) {
+      QStringList lst;
+      for(int id : unknown)
+        lst << QString::number(id);
+      throw RuntimeError("Several columns of unknown IDs (%1) in file '%2'").
+        arg(lst.join(", ")).arg(fileName);
+    }
+  }
+
+  // Now, we build the record layout: all the flags are stored in a
+  // single byte, at the position of the first flag column.
+  QList<Column> columns;
+  QList<int> offsets;
+  int rowSize = 0;
+  int flagsOffset = -1;
+  for(int id : ids) {
+    Column c;
+    if(known.contains(id))
+      c = known[id];
+    else if(unknown.size() == 1 && unknownSize > 0) {
+      // We read it with the most likely type for its size
+      ColumnType t = Float64;
+      switch(unknownSize) {
+      case 1:
+        t = UInt8;
+        break;
+      case 2:
+        t = UInt16;
+        break;
+      case 4:
+        t = Float32;
+        break;
+      }
+      c = Column(QString("column #%1").arg(id), t);
+    }
+    else
+      continue;                 // Skipped
+    columns << c;
+    if(c.type == Flag) {
+      if(flagsOffset < 0) {
+        flagsOffset = rowSize;
+        rowSize += 1;
+      }
+      offsets << flagsOffset;
+    }
+    else {
+      offsets << rowSize;
+      rowSize += c.size();
+    }
+  }
+
+  if(unknown.size() > 1)
+    rowSize += unknownSize;
+
+  if((qint64) rowSize * nbPoints > dm.length - headerSize)
+    throw RuntimeError("Not enough data in file '%1': expected %2 points").
+      arg(fileName).arg(nbPoints);
+
+  QList<Vector> cols;
+  QList<double *> targets;
+  for(int i = 0; i < columns.size(); i++) {
+    cols << Vector(nbPoints, 0);
+    targets << cols.last().data();
+  }
+
+  const char * rec = dm.data + headerSize;
+  for(quint32 j = 0; j < nbPoints; j++, rec += rowSize) {
+    for(int i = 0; i < columns.size(); i++) {
+      const Column & c = columns[i];
+      const char * d = rec + offsets[i];
+      double v = 0;
+      switch(c.type) {
+      case Flag: {
+        int val = ((unsigned char) *d) & c.mask;
+        // Shift down to the lowest bit of the mask
+        int m = c.mask;
+        while(! (m & 1)) {
+          m >>= 1;
+          val >>= 1;
+        }
+        v = val;
+        break;
+      }
+      case UInt8:
+        v = (unsigned char) *d;
+        break;
+      case UInt16:
+        v = readInt<quint16>(d);
+        break;
+      case UInt32:
+        v = readInt<quint32>(d);
+        break;
+      case Float32:
+        v = readFloat32(d);
+        break;
+      case Float64:
+        v = readFloat64(d);
+        break;
+      }
+      targets[i][j] = v;
+    }
+  }
+
+  QStringList names;
+  for(const Column & c : columns)
+    names << c.name;
+
+  DataSet * ds = new DataSet(cols);
+  ds->name = QDir::cleanPath(fileName);
+  ds->addMetaData(meta);
+  setMetaDataForFile(ds, fileName);
+  ds->columnNames << names;
+
+  QList<DataSet *> rv;
+  rv << ds;
+  return rv;
+}
+
+
+ECLabMPR::ECLabMPR() :
+  DataBackend("eclab-mpr",
+              "EC-Lab binary files",
+              "Binary files (.mpr) from EC-Labs potentiostats")
+{
+}
+
+static ECLabMPR eclabMPR;
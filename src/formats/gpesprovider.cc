@@ -145,8 +145,7 @@ public:
       return ret;
     }
     catch (const Exception & e) {
-      Terminal::out << "(meta-data file '" << mf
-                    << "' could not be read by QSoas, it is probably corrupted)";
+      reportProblem(QString("(meta-data file '%1' could not be read by QSoas, it is probably corrupted)").arg(mf));
     }
     return ValueHash(); 
   };
@@ -247,3 +247,143 @@ double Functions::marcusHushChidsey(double lambda, double eta)
   else
     return mhc_trapezoid(lambda, eta, 1);
 }
+
+//////////////////////////////////////////////////////////////////////
+// Array functions
+//
+// The kernels below only use arithmetic operations, comparisons and
+// 64-bit integer additions and shifts, without branches nor calls,
+// so that the compiler can vectorize the loops over the arrays with
+// whichever SIMD instructions are available. The values they do not
+// handle (overflows, subnormal numbers, infinities and NaNs) are
+// detected beforehand, and passed to the functions of the C library.
+
+static inline quint64 doubleBits(double x)
+{
+  quint64 v;
+  memcpy(&v, &x, sizeof(v));
+  return v;
+}
+
+static inline double bitsDouble(quint64 v)
+{
+  double x;
+  memcpy(&x, &v, sizeof(x));
+  return x;
+}
+
+// ln(2) split in a part whose product with integers up to 2048 is
+// exact, and the rest.
+static const double ln2Hi = 6.93147180369123816490e-01;
+static const double ln2Lo = 1.90821492927058770002e-10;
+
+static const double expMin = -708;
+static const double expMax = 709;
+
+/// exp(x) for x within [expMin, expMax]
+static inline double fastExp(double x)
+{
+  // Adding then subtracting this rounds to the nearest integer, and
+  // leaves that integer in the low bits of the sum.
+  const double shifter = 6755399441055744.0; // 1.5 * 2^52
+  const double log2e = 1.44269504088896338700e+00;
+
+  // x = n ln(2) + r, with |r| <= ln(2)/2
+  double t = x * log2e + shifter;
+  double n = t - shifter;
+  double r = (x - n * ln2Hi) - n * ln2Lo;
+
+  // Taylor expansion up to r^13, the remainder is below 1e-17
+  double p = 1.0/6227020800;
+  p = p * r + 1.0/479001600;
+  p = p * r + 1.0/39916800;
+  p = p * r + 1.0/3628800;
+  p = p * r + 1.0/362880;
+  p = p * r + 1.0/40320;
+  p = p * r + 1.0/5040;
+  p = p * r + 1.0/720;
+  p = p * r + 1.0/120;
+  p = p * r + 1.0/24;
+  p = p * r + 1.0/6;
+  p = p * r + 0.5;
+  p = p * r + 1;
+  p = p * r + 1;
+
+  // 2^n, built directly from the bits of t
+  return p * bitsDouble((doubleBits(t) + 1023) << 52);
+}
+
+void Functions::expArray(const double * source, double * target, int nb)
+{
+  bool special = false;
+  for(int i = 0; i < nb; i++)
+    special |= ! (source[i] >= expMin && source[i] <= expMax);
+
+  if(special) {
+    for(int i = 0; i < nb; i++) {
+      double x = source[i];
+      target[i] = (x >= expMin && x <= expMax) ? fastExp(x) : ::exp(x);
+    }
+  }
+  else {
+    for(int i = 0; i < nb; i++)
+      target[i] = fastExp(source[i]);
+  }
+}
+
+/// log(x) for positive normal numbers
+static inline double fastLog(double x)
+{
+  // The bits of 1/sqrt(2), so that the mantissa is reduced to
+  // [1/sqrt(2), sqrt(2)]
+  const quint64 invSqrt2 = 0x3fe6a09e667f3bcdULL;
+  const quint64 one = 0x3ff0000000000000ULL;
+
+  // Coefficients of the minimax approximation used by fdlibm
+  const double lg1 = 6.666666666666735130e-01;
+  const double lg2 = 3.999999999940941908e-01;
+  const double lg3 = 2.857142874366239149e-01;
+  const double lg4 = 2.222219843214978396e-01;
+  const double lg5 = 1.818357216161805012e-01;
+  const double lg6 = 1.531383769920937332e-01;
+  const double lg7 = 1.479819860511658591e-01;
+
+  // x = 2^k m. The biased exponent is computed on unsigned integers,
+  // which works for all positive normal numbers.
+  quint64 bits = doubleBits(x);
+  quint64 kb = (bits - invSqrt2 + one) >> 52;
+  // k as a double, using the same trick as in fastExp in reverse
+  double k = bitsDouble(kb + 0x4330000000000000ULL) - 4503599627371519.0;
+  double m = bitsDouble(bits - (kb << 52) + one);
+
+  // log(1+f) = 2 atanh(s), with s = f/(2+f)
+  double f = m - 1;
+  double s = f/(2 + f);
+  double z = s * s;
+  double w = z * z;
+  double t1 = w * (lg2 + w * (lg4 + w * lg6));
+  double t2 = z * (lg1 + w * (lg3 + w * (lg5 + w * lg7)));
+  double hfsq = 0.5 * f * f;
+  double r = t1 + t2;
+  return k * ln2Hi - ((hfsq - (s * (hfsq + r) + k * ln2Lo)) - f);
+}
+
+void Functions::logArray(const double * source, double * target, int nb)
+{
+  const double min = std::numeric_limits<double>::min();
+  const double max = std::numeric_limits<double>::max();
+  bool special = false;
+  for(int i = 0; i < nb; i++)
+    special |= ! (source[i] >= min && source[i] <= max);
+
+  if(special) {
+    for(int i = 0; i < nb; i++) {
+      double x = source[i];
+      target[i] = (x >= min && x <= max) ? fastLog(x) : ::log(x);
+    }
+  }
+  else {
+    for(int i = 0; i < nb; i++)
+      target[i] = fastLog(source[i]);
+  }
+}
@@ -65,6 +65,28 @@ namespace Functions {
   /// @returns The position of the peak, in units of RT/F
   double trumpetBV(double rate, double alpha, double prec = 0.01);
 
+  /// @name Array functions
+  ///
+  /// Versions of the elementary functions working on whole arrays,
+  /// written so that the compiler can vectorize them. They are meant
+  /// for the fits that evaluate the same expression on all the
+  /// points of a dataset.
+  ///
+  /// \a source and \a target can be the same array.
+  ///
+  /// @{
+
+  /// Computes the exponential of the \a nb elements of \a source into
+  /// \a target. The error is below 1.2 ulp (0.9 ulp when the
+  /// processor has fused multiply-add), against 0.5 ulp for ::exp().
+  void expArray(const double * source, double * target, int nb);
+
+  /// Computes the natural logarithm of the \a nb elements of \a
+  /// source into \a target. The error is below 0.75 ulp.
+  void logArray(const double * source, double * target, int nb);
+
+  /// @}
+
 };
 
 #endif
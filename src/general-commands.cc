@@ -42,6 +42,8 @@
 #include <utils.hh>
 
 #include <debug.hh>
+#include <taskscheduler.hh>
+#include <profiler.hh>
 #include <commandwidget.hh>
 #include <mainwin.hh>
 
@@ -257,6 +259,17 @@ static void memCommand(const QString &,
   MRuby * mr = MRuby::ruby();
   Terminal::out << "Memory used: " << kb << " kB\n"
                 << "Ruby memory used: " << mr->memoryUse() << endl;
+  MRuby::CodeCacheStats cs = mr->codeCacheStats();
+  Terminal::out << "Ruby code cache: " << cs.blocks << " blocks, "
+                << cs.parameters << " parameter lists, "
+                << cs.hits << " hits, " << cs.misses << " misses" << endl;
+  MRuby::GCStats gs = mr->gcStats();
+  Terminal::out << "Ruby heap: " << gs.live << " live objects in "
+                << gs.heapSize << " slots, "
+                << gs.fullCollections << " full GCs, "
+                << gs.incrementalSteps << " incremental steps, "
+                << "pauses: " << gs.totalPause * 1e-6 << " ms total, "
+                << gs.longestPause * 1e-6 << " ms max" << endl;
 
   Terminal::out << "Stack: " << soas().stack().textSummary() << endl;
 
@@ -1158,6 +1171,73 @@ tm("timer", // command name
 
 //////////////////////////////////////////////////////////////////////
 
+// The built-in profiler
+
+void profileCommand(const QString &, const CommandOptions & opts)
+{
+  bool reset = false;
+  updateFromOptions(opts, "reset", reset);
+  if(opts.contains("enable")) {
+    bool enable = false;
+    updateFromOptions(opts, "enable", enable);
+    Profiler::setEnabled(enable);
+    Terminal::out << (enable ? "Enabling" : "Disabling")
+                  << " profiler" << endl;
+    if(! reset)
+      return;
+  }
+  if(! Profiler::isEnabled())
+    Terminal::out << "Profiler is not enabled, use /enable=true" << endl;
+
+  QString format = "table";
+  updateFromOptions(opts, "format", format);
+  QString str = (format == "json" ? Profiler::recordsJSON() :
+                 Profiler::recordsTable());
+  QString output;
+  updateFromOptions(opts, "output", output);
+  if(output.isEmpty())
+    Terminal::out << str << endl;
+  else {
+    File file(output, File::TextWrite, opts);
+    QTextStream o(file);
+    o << str << endl;
+    Terminal::out << "Wrote profile to '" << output << "'" << endl;
+  }
+  if(reset)
+    Profiler::clear();
+}
+
+static ArgumentList 
+profO(QList<Argument *>() 
+      << new BoolArgument("enable",
+                          "Enable",
+                          "turns on or off the profiler")
+      << new BoolArgument("reset",
+                          "Reset",
+                          "clears the recorded timings (after displaying them)")
+      << new ChoiceArgument(QStringList() << "table" << "json",
+                            "format",
+                            "Format",
+                            "format of the output (default: table)")
+      << new FileSaveArgument("output",
+                              "Output",
+                              "writes to the given file rather than to the terminal",
+                              "profile.dat", false)
+      << File::fileOptions(File::OverwriteOption)
+      );
+
+
+static Command 
+prof("profile", // command name
+     effector(profileCommand), // action
+     "file",  // group name
+     NULL, // arguments
+     &profO, // options
+     "Profile",
+     "Profiles the commands and fits");
+
+//////////////////////////////////////////////////////////////////////
+
 // Shell execution !
 
 void systemCommand(const QString &, QStringList args, const CommandOptions & opts)
@@ -1258,6 +1338,31 @@ void debugCommand(const QString &, const CommandOptions & opts)
     updateFromOptions(opts, "level", lvl);
     Debug::setDebugLevel(lvl);
   }
+  TaskScheduler * sched = TaskScheduler::scheduler();
+  if(opts.contains("threads")) {
+    int nb = 0;
+    updateFromOptions(opts, "threads", nb);
+    sched->setThreadNumber(nb);
+    Terminal::out << "Using " << sched->threadNumber()
+                  << " worker threads" << endl;
+  }
+  bool timings = false;
+  updateFromOptions(opts, "task-timings", timings);
+  if(timings) {
+    QHash<QString, TaskScheduler::Timing> tm = sched->taskTimings();
+    QStringList names = tm.keys();
+    std::sort(names.begin(), names.end());
+    Terminal::out << "Tasks run using " << sched->threadNumber()
+                  << " threads:" << endl;
+    for(const QString & n : names) {
+      const TaskScheduler::Timing & t = tm[n];
+      Terminal::out << QString(" * %1: %2 tasks, total %3 ms, "
+                               "average %4 ms, longest %5 ms").
+        arg(n).arg(t.number).arg(t.total * 1e-6).
+        arg(t.total * 1e-6/t.number).arg(t.longest * 1e-6) << endl;
+    }
+    sched->clearTimings();
+  }
 }
 
 
@@ -1270,6 +1375,12 @@ dbgO(QList<Argument *>()
      << new IntegerArgument("level",
                             "Debug level",
                             "Sets the debug level")
+     << new IntegerArgument("threads",
+                            "Worker threads",
+                            "Sets the number of worker threads (0 to use the general/threads setting)")
+     << new BoolArgument("task-timings",
+                         "Task timings",
+                         "Shows (and resets) the timings of the tasks run by the worker threads")
     );
 
 
@@ -283,6 +283,29 @@ atanc("atanc(x)", "$$\\frac{\\tan^{-1} x}{x}$$");
 static GSLSimpleFunction<Functions::atanhc> 
 atanhc("atanhc(x)", "$$\\frac{\\tanh^{-1} x}{x}$$");
 
+/// The exponential as computed on arrays by the fits, exposed mostly
+/// to check its accuracy against exp().
+static double fastExp(double x)
+{
+  double rv;
+  Functions::expArray(&x, &rv, 1);
+  return rv;
+}
+
+static GSLSimpleFunction<fastExp> 
+fast_exp("fast_exp(x)", "The exponential, computed the way the fits do it, should be within a few ulps of $$\\exp x$$");
+
+/// Same thing for the logarithm.
+static double fastLog(double x)
+{
+  double rv;
+  Functions::logArray(&x, &rv, 1);
+  return rv;
+}
+
+static GSLSimpleFunction<fastLog> 
+fast_log("fast_log(x)", "The natural logarithm, computed the way the fits do it, should be within a few ulps of $$\\ln x$$");
+
 
 //////////////////////////////////////////////////////////////////////
 
@@ -20,6 +20,7 @@
 #include <kineticsystem.hh>
 
 #include <expression.hh>
+#include <mruby.hh>
 #include <exceptions.hh>
 #include <utils.hh>
 
@@ -94,15 +95,25 @@ void KineticSystem::Reaction::setParameters(const QStringList & parameters)
   backward->setVariables(parameters);
 }
 
-void KineticSystem::Reaction::computeRateConstants(const double * vals, 
+QList<const Expression *> KineticSystem::Reaction::expressions() const
+{
+  QList<const Expression *> rv;
+  if(forward)
+    rv << forward;
+  if(backward)
+    rv << backward;
+  return rv;
+}
+
+void KineticSystem::Reaction::computeRateConstants(const double * values,
+                                                   const double * /*vals*/, 
                                                    double * fd, 
                                                    double * bd) const
 {
-  *fd = forward->evaluate(vals);
-  if(backward)
-    *bd = backward->evaluate(vals);
-  else
-    *bd = 0;
+  // The rates given by a cycle are computed later on
+  int i = 0;
+  *fd = forward ? values[i++] : 0;
+  *bd = backward ? values[i++] : 0;
 }
 
 QString KineticSystem::Reaction::toString(const QList<Species> & species) const
@@ -254,12 +265,12 @@ void KineticSystem::RedoxReaction::setParameters(const QStringList & parameters)
                         "for a redox reaction");
 }
 
-void KineticSystem::RedoxReaction::computeRateConstants(const double * vals, 
-                                                double * fd, 
-                                                double * bd) const
+void KineticSystem::RedoxReaction::computeRateConstants(const double * values,
+                                                        const double * vals, 
+                                                        double * fd, 
+                                                        double * bd) const
 {
-  double e0, k0;                // e0 is forward, k0 is backward
-  Reaction::computeRateConstants(vals, &e0, &k0);
+  double e0 = values[0], k0 = values[1];
   double e = vals[potentialIndex];
   double fara = GSL_CONST_MKSA_FARADAY /
     (vals[temperatureIndex] * GSL_CONST_MKSA_MOLAR_GAS);
@@ -272,8 +283,7 @@ void KineticSystem::RedoxReaction::computeRateConstants(const double * vals,
 
 void KineticSystem::RedoxReaction::computeCache(const double * vals)
 {
-  double e0, k0;                // e0 is forward, k0 is backward
-  Reaction::computeRateConstants(vals, &e0, &k0);
+  double e0 = forward->evaluate(vals), k0 = backward->evaluate(vals);
   // Debug::debug() << "Cache: " << k0 << " - " << e0 << endl;
   cache[1] = k0;
   double fara = GSL_CONST_MKSA_FARADAY /
@@ -340,13 +350,15 @@ public:
   }
 
 
-  virtual void computeRateConstants(const double * vals, 
+  virtual QList<const Expression *> expressions() const override {
+    return KineticSystem::RedoxReaction::expressions() << alpha;
+  };
+
+  virtual void computeRateConstants(const double * values,
+                                    const double * vals, 
                                     double * fd, double * bd) const override
   {
-    double e0, k0, al;
-    e0 = forward->evaluate(vals);
-    k0 = backward->evaluate(vals);
-    al = alpha->evaluate(vals);
+    double e0 = values[0], k0 = values[1], al = values[2];
 
     double e = vals[potentialIndex];
     double fara = GSL_CONST_MKSA_FARADAY /
@@ -413,13 +425,15 @@ public:
   }
 
 
-  virtual void computeRateConstants(const double * vals, 
+  virtual QList<const Expression *> expressions() const override {
+    return KineticSystem::RedoxReaction::expressions() << lambda;
+  };
+
+  virtual void computeRateConstants(const double * values,
+                                    const double * vals, 
                                     double * fd, double * bd) const override
   {
-    double e0, k0, lb;
-    e0 = forward->evaluate(vals);
-    k0 = backward->evaluate(vals);
-    lb = lambda->evaluate(vals);
+    double e0 = values[0], k0 = values[1], lb = values[2];
 
     double e = vals[potentialIndex];
     double fara = GSL_CONST_MKSA_FARADAY /
@@ -480,9 +494,82 @@ void KineticSystem::Cycle::computeRateConstant() const
 
 //////////////////////////////////////////////////////////////////////
 
+KineticSystem::FormulaBatch::FormulaBatch() :
+  expression(NULL)
+{
+}
+
+KineticSystem::FormulaBatch::FormulaBatch(const FormulaBatch & o) :
+  targets(o.targets), separateTargets(o.separateTargets)
+{
+  expression = o.expression ? new Expression(*o.expression) : NULL;
+  for(const Expression * e : o.separate)
+    separate << new Expression(*e);
+}
+
+KineticSystem::FormulaBatch::~FormulaBatch()
+{
+  clear();
+}
+
+void KineticSystem::FormulaBatch::clear()
+{
+  delete expression;
+  expression = NULL;
+  for(Expression * e : separate)
+    delete e;
+  separate.clear();
+  targets.clear();
+  separateTargets.clear();
+}
+
+void KineticSystem::FormulaBatch::setup(const QStringList & formulas,
+                                        const QVector<int> & tgts,
+                                        const QStringList & variables)
+{
+  clear();
+  MRuby * mr = MRuby::ruby();
+  QStringList code;
+  for(int i = 0; i < formulas.size(); i++) {
+    QStringList locals;
+    mr->detectParameters(formulas[i].toLocal8Bit(), &locals);
+    if(locals.isEmpty()) {
+      code << QString("begin\n%1\nend").arg(formulas[i]);
+      targets << tgts[i];
+    }
+    else {
+      separate << new Expression(formulas[i], variables, true);
+      separateTargets << tgts[i];
+    }
+  }
+  if(! code.isEmpty())
+    expression = new Expression(QString("[%1]").arg(code.join(",\n")),
+                                variables, true);
+}
+
+void KineticSystem::FormulaBatch::evaluate(const double * vals,
+                                           double * values) const
+{
+  for(int i = 0; i < separate.size(); i++)
+    values[separateTargets[i]] = separate[i]->evaluate(vals);
+  if(! expression)
+    return;
+  int nb = targets.size();
+  QVarLengthArray<double, 200> tmp(nb);
+  int got = expression->evaluateIntoArray(vals, tmp.data(), nb);
+  if(got != nb)
+    throw InternalError("Rate formulas evaluated to %1 values, "
+                        "but %2 were expected").arg(got).arg(nb);
+  for(int i = 0; i < nb; i++)
+    values[targets[i]] = tmp[i];
+}
+
+//////////////////////////////////////////////////////////////////////
+
 
 KineticSystem::KineticSystem() : 
-  linear(false), checkRange(true), redoxReactionScaling(1),
+  linear(false), constantFormulasValid(false),
+  checkRange(true), redoxReactionScaling(1),
   reporterExpression(NULL), reporterUseCurrent(false)
   
 {
@@ -491,6 +578,13 @@ KineticSystem::KineticSystem() :
 
 KineticSystem::KineticSystem(const KineticSystem & o) : 
   linear(o.linear), species(o.species),
+  varyingFormulas(o.varyingFormulas),
+  constantFormulas(o.constantFormulas),
+  constantDependencies(o.constantDependencies),
+  lastDependencies(o.lastDependencies),
+  constantFormulasValid(o.constantFormulasValid),
+  reactionFormulas(o.reactionFormulas),
+  formulaValues(o.formulaValues),
   speciesLookup(o.speciesLookup),
   parameters(o.parameters),
   checkRange(o.checkRange),
@@ -606,6 +700,7 @@ void KineticSystem::ensureReady(const QStringList & add)
     params += r->parameters();
   }
 
+  reporterOnly.clear();
   if(reporterExpression) {
     QSet<QString> reporterVariables =
       QSet<QString>::fromList(reporterExpression->currentVariables());
@@ -615,6 +710,7 @@ void KineticSystem::ensureReady(const QStringList & add)
     }
     else
       reporterUseCurrent = false;
+    reporterOnly = reporterVariables - params;
     params += reporterVariables;
   }
 
@@ -624,11 +720,14 @@ void KineticSystem::ensureReady(const QStringList & add)
   for(int i = 0; i < species.size(); i++) {
     QString str = QString("c_%1").arg(species[i].name);
     params.remove(str);
+    reporterOnly.remove(str);
     conc.append(str);
   }
 
-  for(int i = 0; i < add.size(); i++)
+  for(int i = 0; i < add.size(); i++) {
     params.remove(add[i]);
+    reporterOnly.remove(add[i]);
+  }
 
   parameters.clear();
   parameters = params.toList();
@@ -648,6 +747,54 @@ void KineticSystem::ensureReady(const QStringList & add)
   }
 
   checkLinearity();
+  setupFormulas();
+}
+
+void KineticSystem::setupFormulas()
+{
+  int nbSpecies = species.size();
+  QStringList varying, constant;
+  QVector<int> varyingTargets, constantTargets;
+  QSet<int> deps;
+
+  reactionFormulas.clear();
+  int idx = 0;
+  for(const Reaction * r : reactions) {
+    reactionFormulas << idx;
+    for(const Expression * e : r->expressions()) {
+      bool useConcentrations = false;
+      QSet<int> d;
+      for(const QString & v : e->naturalVariables()) {
+        int pi = parameters.indexOf(v);
+        if(pi < 0)
+          throw InternalError("Variable '%1' not found in the parameters").
+            arg(v);
+        if(pi < nbSpecies)
+          useConcentrations = true;
+        else
+          d.insert(pi);
+      }
+      if(useConcentrations) {
+        varying << e->formula();
+        varyingTargets << idx;
+      }
+      else {
+        constant << e->formula();
+        constantTargets << idx;
+        deps += d;
+      }
+      ++idx;
+    }
+  }
+  formulaValues.fill(0, idx);
+
+  varyingFormulas.setup(varying, varyingTargets, parameters);
+  constantFormulas.setup(constant, constantTargets, parameters);
+
+  constantDependencies = deps.toList().toVector();
+  std::sort(constantDependencies.begin(), constantDependencies.end());
+  lastDependencies.fill(0, constantDependencies.size());
+  constantFormulasValid = false;
 }
 
 void KineticSystem::checkLinearity()
@@ -695,6 +842,11 @@ QStringList KineticSystem::allParameters() const
   return parameters.mid(species.size());
 }
 
+QSet<QString> KineticSystem::reporterOnlyParameters() const
+{
+  return reporterOnly;
+}
+
 QStringList KineticSystem::allSpecies() const
 {
   QStringList ret;
@@ -743,9 +895,28 @@ void KineticSystem::cacheRateConstants(const gsl_vector * concentrations,
     p = vals.data();
   }
   
-  for(Reaction * rc : reactions) {
-    rc->computeRateConstants(p, &rc->forwardCache,
-                             &rc->backwardCache);
+  // The formulas that only depend on the parameters are only
+  // evaluated again when one of them has changed.
+  bool changed = ! constantFormulasValid;
+  for(int i = 0; i < constantDependencies.size(); i++) {
+    double v = p[constantDependencies[i]];
+    if(v != lastDependencies[i]) {
+      lastDependencies[i] = v;
+      changed = true;
+    }
+  }
+  double * values = formulaValues.data();
+  if(changed) {
+    constantFormulasValid = false;
+    constantFormulas.evaluate(p, values);
+    constantFormulasValid = true;
+  }
+  varyingFormulas.evaluate(p, values);
+
+  for(int i = 0; i < reactions.size(); i++) {
+    Reaction * rc = reactions[i];
+    rc->computeRateConstants(values + reactionFormulas[i], p,
+                             &rc->forwardCache, &rc->backwardCache);
     if(checkRange) {
       if(rc->forwardCache < 0)
         throw RangeError("Negative forward rate constant for reaction '%1'").
@@ -820,6 +991,56 @@ void KineticSystem::computeLinearJacobian(gsl_matrix * target,
 }
 
 
+QVector<QVector<int> > KineticSystem::jacobianPattern() const
+{
+  int nbs = species.size();
+
+  // The species whose concentrations the rate constants of each
+  // reaction depend on.
+  QHash<const Reaction *, QSet<int> > rateDependencies;
+  for(const Reaction * rc : reactions) {
+    QSet<int> & deps = rateDependencies[rc];
+    for(const Expression * expr : rc->expressions()) {
+      if(! expr)
+        continue;
+      for(const QString & v : expr->naturalVariables()) {
+        if(v.startsWith("c_")) {
+          int idx = speciesLookup.value(v.mid(2), -1);
+          if(idx >= 0)
+            deps.insert(idx);
+        }
+      }
+    }
+  }
+
+  // The automatic rate constant of a cycle depends on those of all
+  // the other reactions of the cycle.
+  for(const Cycle & c : cycles) {
+    QSet<int> deps;
+    for(const Reaction * rc : c.reactions)
+      deps += rateDependencies.value(rc);
+    rateDependencies[c.reactions.first()] += deps;
+  }
+
+  QVector<QSet<int> > pattern(nbs);
+  for(const Reaction * rc : reactions) {
+    QSet<int> columns = rateDependencies.value(rc);
+    for(int idx : rc->speciesIndices)
+      columns.insert(idx);
+    for(int col : columns) {
+      for(int row : rc->speciesIndices)
+        pattern[col].insert(row);
+    }
+  }
+
+  QVector<QVector<int> > ret(nbs);
+  for(int i = 0; i < nbs; i++) {
+    ret[i] = pattern[i].toList().toVector();
+    std::sort(ret[i].begin(), ret[i].end());
+  }
+  return ret;
+}
+
 /// The cache is setup assuming that ALL the non-redox reactions have
 /// constant rates. This is true as of now if the isLinear() returns
 /// true.
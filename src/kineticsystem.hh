@@ -151,10 +151,17 @@ public:
     bool isReversible() const;
 
 
-    /// Computes both the forward and backward rates
+    /// Returns the expressions needed to compute the rate constants,
+    /// in the order in which their values are given to
+    /// computeRateConstants().
+    virtual QList<const Expression *> expressions() const;
+
+    /// Computes both the forward and backward rates, using the \a
+    /// values of the expressions() and the parameters \a vals.
     ///
     /// In fact, these are rate CONSTANTS !
-    virtual void computeRateConstants(const double * vals, 
+    virtual void computeRateConstants(const double * values,
+                                      const double * vals, 
                                       double * forward, double * backward) const;
 
     /// String depiction of the equation (along with the rates)
@@ -197,7 +204,8 @@ public:
 
     virtual QSet<QString> parameters() const;
 
-    virtual void computeRateConstants(const double * vals, 
+    virtual void computeRateConstants(const double * values,
+                                      const double * vals, 
                                       double * forward, double * backward) const override;
     
     virtual QString exchangeRate() const override;
@@ -234,6 +242,84 @@ protected:
 
   /// @}
 
+  /// @name Batched evaluation of the rate formulas
+  ///
+  /// All the expressions of all the reactions are evaluated in only
+  /// two calls to the Ruby interpreter. The ones that do not depend
+  /// on the concentrations are only evaluated when the parameters
+  /// they depend on change, which is seldom the case during an
+  /// integration.
+  ///
+  /// @{
+
+  /// A series of expressions evaluated in one go.
+  ///
+  /// The formulas batched together share the same Ruby scope, so
+  /// those that use local variables (including assignments to the
+  /// parameters) are evaluated separately, so that their variables
+  /// do not leak into the other formulas.
+  class FormulaBatch {
+  public:
+    /// The expression, returning an array, or NULL if the batch is
+    /// empty
+    Expression * expression;
+
+    /// The index in formulaValues of each of the values returned.
+    QVector<int> targets;
+
+    /// The formulas with local variables, evaluated one by one.
+    QList<Expression *> separate;
+
+    /// The index in formulaValues of the value of each of the
+    /// separate formulas
+    QVector<int> separateTargets;
+
+    /// Deletes all the expressions
+    void clear();
+
+    FormulaBatch();
+    FormulaBatch(const FormulaBatch & other);
+    ~FormulaBatch();
+
+    /// Compiles the given formulas, which are evaluated with the
+    /// given variables.
+    void setup(const QStringList & formulas, const QVector<int> & targets,
+               const QStringList & variables);
+
+    /// Evaluates the formulas, and stores their values in \a values
+    void evaluate(const double * vals, double * values) const;
+  };
+
+  /// The formulas that depend on the concentrations.
+  FormulaBatch varyingFormulas;
+
+  /// The formulas that only depend on the parameters
+  FormulaBatch constantFormulas;
+
+  /// The indices of the parameters the constantFormulas depend on
+  QVector<int> constantDependencies;
+
+  /// The values of the constantDependencies when the constantFormulas
+  /// were last evaluated.
+  mutable QVector<double> lastDependencies;
+
+  /// Whether the constantFormulas have been evaluated with the
+  /// lastDependencies.
+  mutable bool constantFormulasValid;
+
+  /// For each reaction, the index of the value of its first
+  /// expression in formulaValues.
+  QVector<int> reactionFormulas;
+
+  /// The values of all the expressions of all the reactions.
+  mutable QVector<double> formulaValues;
+
+  /// Sets up the batches of formulas. Must be called after the
+  /// parameters are set.
+  void setupFormulas();
+
+  /// @}
+
   /// A hash species name -> species index
   QHash<QString, int> speciesLookup;
 
@@ -287,6 +373,10 @@ protected:
   /// the \b same \b order !
   QStringList parameters;
 
+  /// The parameters that are only used by the reporter expression,
+  /// and therefore have no influence on the time evolution.
+  QSet<QString> reporterOnly;
+
   /// Ensures all the reactions are ready for evaluation, computing
   /// the parameters as a side effect.
   ///
@@ -349,6 +439,11 @@ public:
   /// Returns all the parameters
   QStringList allParameters() const;
 
+  /// Returns the parameters that are only used by the reporter
+  /// expression (and not by the reactions nor the initial
+  /// concentrations).
+  QSet<QString> reporterOnlyParameters() const;
+
   /// Returns the name of all the species, in the order in which they
   /// come in the parameters.
   QStringList allSpecies() const;
@@ -386,6 +481,16 @@ public:
                             const gsl_vector * concentrations,
                             const double * parameters) const;
 
+  /// Returns the sparsity pattern of the jacobian of
+  /// computeDerivatives() with respect to the concentrations, in the
+  /// form of ODESolver::jacobianPattern(): for each species j, the
+  /// species whose derivatives depend on the concentration of j.
+  ///
+  /// This is deduced from the reaction graph and from the
+  /// concentrations appearing in the rate constants. The system must
+  /// be ready.
+  QVector<QVector<int> > jacobianPattern() const;
+
   /// Computes the jacobian of a linear system (ie J so that dC/dt = J
   /// C). Will abort if used on non-linear systems.
   ///
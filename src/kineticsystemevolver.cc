@@ -85,6 +85,11 @@ int KineticSystemEvolver::computeDerivatives(double t, const double * y,
   return GSL_SUCCESS;
 }
 
+QVector<QVector<int> > KineticSystemEvolver::jacobianPattern() const
+{
+  return system->jacobianPattern();
+}
+
 void KineticSystemEvolver::setParameter(int index, double value)
 {
   parameters[index] = value;
@@ -396,6 +401,11 @@ protected:
     return system->reporterExpression;
   };
 
+  virtual QSet<QString> reporterOnlyParameters(FitData * data) const override {
+    KineticSystem * system = getSystem(data);
+    return system->reporterOnlyParameters();
+  };
+
   virtual double reporterValue(double t, FitData * data) const override {
     KineticSystemEvolver * evolver = getEvolver(data);
     return evolver->reporterValue(t);
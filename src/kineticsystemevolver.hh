@@ -52,6 +52,9 @@ public:
   virtual int computeDerivatives(double t, const double * y, 
                                  double * dydt) override;
 
+  /// The pattern deduced from the reactions of the system
+  virtual QVector<QVector<int> > jacobianPattern() const override;
+
   /// Sets the parameters. Returns the list of undefined parameters.
   QStringList setParameters(const QHash<QString, double> & parameters);
 
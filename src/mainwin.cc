@@ -205,6 +205,7 @@
 
 #include <commandlineparser.hh>
 #include <helpbrowser.hh>
+#include <commandserver.hh>
 
 
 
@@ -249,36 +250,40 @@ static CommandLineOption rs("--run-script",
                             }, -1, "runs a single script with possible arguments and exits");
 
 
-MainWin::MainWin(Soas * theSoas, bool runStartupFiles)
+MainWin::MainWin(Soas * theSoas, bool runStartupFiles, bool batch) :
+  batchMode(batch)
 {
   soasInstance = theSoas;
   theSoas->setMainWindow(this);
   setupFrame();
-  resize(mainWinSize);
-  if(! splitterState->isEmpty())
-    mainSplitter->restoreState(splitterState);
-
-  // We load the icon
-  QIcon appIcon(":QSoas-logo.png");
-  setWindowIcon(appIcon);
-
-  Terminal::out << Soas::versionString()<< endl;
-  Credits::displayStartupMessage();
-  Terminal::out << "PID " << QCoreApplication::applicationPid()
-                << " starting on " << soasInstance->startupTime().toString()
-                << "\nCurrent directory is: " << QDir::currentPath() 
-                << "\nCurrent temperature is: " << soasInstance->temperature() 
-                << " K\n";
+  if(! batchMode) {
+    resize(mainWinSize);
+    if(! splitterState->isEmpty())
+      mainSplitter->restoreState(splitterState);
+
+    // We load the icon
+    QIcon appIcon(":QSoas-logo.png");
+    setWindowIcon(appIcon);
+
+    Terminal::out << Soas::versionString()<< endl;
+    Credits::displayStartupMessage();
+    Terminal::out << "PID " << QCoreApplication::applicationPid()
+                  << " starting on " << soasInstance->startupTime().toString()
+                  << "\nCurrent directory is: " << QDir::currentPath() 
+                  << "\nCurrent temperature is: " << soasInstance->temperature() 
+                  << " K\n";
+  }
   soasInstance->graphicsSettings().initialSetup();
-  
-  Terminal::out << "To list available commands, type 'commands'\n"
-                << "To get help on a specific command, type 'help command'\n"
-                << endl;
+
+  if(! batchMode)
+    Terminal::out << "To list available commands, type 'commands'\n"
+                  << "To get help on a specific command, type 'help command'\n"
+                  << endl;
 
   // Now, running all the startup files
   if(runStartupFiles)
     CommandWidget::runStartupFiles();
-  else
+  else if(! batchMode)
     Terminal::out << "Not loading any startup file as requested" << endl;
 
   Hook::runHooks();
@@ -300,14 +305,45 @@ MainWin::MainWin(Soas * theSoas, bool runStartupFiles)
     }
   }
 
-  if((cmdlineCommands.size() > 0 && exitAfterRunning)
-     || (runScript.size() > 0)) {
+  // The server starts after the command-line commands, which can be
+  // used to preload data.
+  bool serving = false;
+  try {
+    serving = CommandServer::startServer();
+  }
+  catch(const RuntimeError & e) {
+    Terminal::out << "Could not start the server: " << e.message() << endl;
+  }
+
+  if(serving) {
+    // Running until told to stop
+  }
+  else if(batchMode) {
+    // Without commands, we read them from the standard input, just
+    // as a script.
+    if(cmdlineCommands.size() == 0 && runScript.size() == 0) {
+      QFile in;
+      in.open(stdin, QIODevice::ReadOnly);
+      try {
+        commandWidget->runCommandFile(&in);
+      }
+      catch(const ControlFlowException &) {
+        // Most probably an abort, which just ends the script
+      }
+    }
     connect(this, SIGNAL(windowReady()),
             qApp,SLOT(quit()), Qt::QueuedConnection);
   }
-  if(cmdlineCommands.size() == 0 && runScript.size() == 0)
-    connect(this, SIGNAL(windowReady()),
-            this, SLOT(showStartupTips()), Qt::QueuedConnection);
+  else {
+    if((cmdlineCommands.size() > 0 && exitAfterRunning)
+       || (runScript.size() > 0)) {
+      connect(this, SIGNAL(windowReady()),
+              qApp,SLOT(quit()), Qt::QueuedConnection);
+    }
+    if(cmdlineCommands.size() == 0 && runScript.size() == 0)
+      connect(this, SIGNAL(windowReady()),
+              this, SLOT(showStartupTips()), Qt::QueuedConnection);
+  }
   
   emit(windowReady());
 }
@@ -321,9 +357,12 @@ void MainWin::showStartupTips()
 void MainWin::setupFrame()
 {
   statusBar();
-  menus = Group::fillMenuBar(menuBar(), CommandContext::globalContext());
-  connect(menuBar(), SIGNAL(triggered(QAction *)),
-          SLOT(menuActionTriggered(QAction *)));
+  // The menus are only useful when the window is shown
+  if(! batchMode) {
+    menus = Group::fillMenuBar(menuBar(), CommandContext::globalContext());
+    connect(menuBar(), SIGNAL(triggered(QAction *)),
+            SLOT(menuActionTriggered(QAction *)));
+  }
 
   mainSplitter = new QSplitter(Qt::Vertical);
   // QVBoxLayout * layout = new QVBoxLayout(w);
@@ -416,12 +455,14 @@ void MainWin::updateWindowName()
 
 MainWin::~MainWin()
 {
-  Terminal::out << "QSoas PID " << QCoreApplication::applicationPid()
-                << " closing on " << QDateTime::currentDateTime().toString()
-                << endl;
+  if(! batchMode) {
+    Terminal::out << "QSoas PID " << QCoreApplication::applicationPid()
+                  << " closing on " << QDateTime::currentDateTime().toString()
+                  << endl;
 
-  mainWinSize = size();
-  splitterState = mainSplitter->saveState();
+    mainWinSize = size();
+    splitterState = mainSplitter->saveState();
+  }
   for(QMenu * m : menus)
     delete m;
   menus.clear();
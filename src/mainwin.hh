@@ -48,8 +48,18 @@ class MainWin : public QMainWindow {
   /// These are saved for deleting later
   QList<QMenu*> menus;
 
+  /// Whether the window is used by the qsoas-batch executable, in
+  /// which case it is never shown, and only serves to run the
+  /// commands.
+  bool batchMode;
+
 public:
-  MainWin(Soas * theSoas, bool runStartupFiles);
+  /// Creates the main window and runs the startup files and the
+  /// commands given on the command-line. In @a batch mode, the
+  /// window is not meant to be shown: the menus are not built, the
+  /// commands are read from the standard input if none were given on
+  /// the command-line, and the application quits when they are done.
+  MainWin(Soas * theSoas, bool runStartupFiles, bool batch = false);
   ~MainWin();
 
   /// Displays a message on the status bar
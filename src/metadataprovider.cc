@@ -22,6 +22,8 @@
 #include <terminal.hh>
 #include <exceptions.hh>
 
+QThreadStorage<QStringList *> MetaDataProvider::deferredMessages;
+
 MetaDataProvider::~MetaDataProvider()
 {
 }
@@ -32,6 +34,14 @@ MetaDataProvider::MetaDataProvider(const QString & n) :
   NamedInstance<MetaDataProvider>::registerInstance(this);
 }
 
+void MetaDataProvider::reportProblem(const QString & message)
+{
+  if(deferredMessages.hasLocalData() && deferredMessages.localData())
+    *deferredMessages.localData() << message;
+  else
+    Terminal::out << message << endl;
+}
+
 ValueHash MetaDataProvider::allMetaDataForFile(const QString & fileName)
 {
   ValueHash ret;
@@ -44,12 +54,12 @@ ValueHash MetaDataProvider::allMetaDataForFile(const QString & fileName)
         ret.merge(prov->metaDataForFile(fileName));
       }
       catch(const RuntimeError & err) {
-        Terminal::out << "Error with meta-data provider '"
-                      << it.key() << "': " << err.message() << endl;
+        reportProblem(QString("Error with meta-data provider '%1': %2").
+                      arg(it.key()).arg(err.message()));
       }
       catch(const InternalError & err) {
-        Terminal::out << "Internal error with meta-data provider '"
-                      << it.key() << "': " << err.message() << endl;
+        reportProblem(QString("Internal error with meta-data provider '%1': %2").
+                      arg(it.key()).arg(err.message()));
       }
     }
   }
@@ -46,8 +46,17 @@ protected:
   bool enabled;
 
   MetaDataProvider(const QString & name);
+
+  /// Reports a problem to the terminal, or to the deferred messages
+  /// of the current thread, if there are.
+  static void reportProblem(const QString & message);
 public:
 
+  /// If set for the current thread, the problems are appended to
+  /// this list rather than written to the terminal, which can only
+  /// be used from the main thread.
+  static QThreadStorage<QStringList *> deferredMessages;
+
 
   virtual ~MetaDataProvider();
 
@@ -30,6 +30,7 @@
 #include <mruby/variable.h>
 #include <mruby/hash.h>
 #include <mruby/class.h>
+#include <mruby/gc.h>
 
 #include <exceptions.hh>
 #include <utils.hh>
@@ -38,6 +39,17 @@
 
 #include <gslfunction.hh>
 
+#include <settings-templates.hh>
+
+static SettingsValue<int> codeCacheSize("ruby/code-cache-size", 2000,
+                                        "number of compiled formulas kept in cache");
+
+static SettingsValue<int> heapBudget("ruby/heap-budget", 500000,
+                                     "number of live ruby objects above which a full garbage collection is run after each command (0 to disable)");
+
+static SettingsValue<bool> reuseFloats("ruby/reuse-float-arguments", false,
+                                       "if true, the float objects passed to formulas are reused from one evaluation to the next, which creates less garbage, but formulas must not keep their arguments");
+
 
 // A code that may move in its dedicated place later on.
 
@@ -82,9 +94,18 @@ int StackDump::level = 0;
 #define STACK_DUMP 
 
 
-MRuby::MRuby()
+MRuby::MRuby() :
+  nextBlockID(0), cacheHits(0), cacheMisses(0)
 {
+  gcStatistics.fullCollections = 0;
+  gcStatistics.incrementalSteps = 0;
+  gcStatistics.totalPause = 0;
+  gcStatistics.longestPause = 0;
   mrb = mrb_open();
+  cachedBlocks = mrb_hash_new(mrb);
+  gcRegister(cachedBlocks);
+  objectCounts = mrb_hash_new(mrb);
+  gcRegister(objectCounts);
   cQSoasInterface = NULL;
   cFancyHash = mrb_nil_value();
   cTime = getConstant("Time");
@@ -105,6 +126,7 @@ MRuby::MRuby()
 
 MRuby::~MRuby()
 {
+  clearCodeCache();
   mrb_close(mrb);
 }
 
@@ -1023,6 +1045,29 @@ QStringList MRuby::detectParametersNative(const QByteArray & code,
 
 QStringList MRuby::detectParameters(const QByteArray & code,
                                     QStringList * locals)
+{
+  CachedParameters * c = parametersCache.object(code);
+  if(c) {
+    ++cacheHits;
+    if(locals)
+      *locals += c->locals;
+    return c->parameters;
+  }
+  ++cacheMisses;
+  QStringList lcls;
+  QStringList rv = detectParametersNoCache(code, &lcls);
+  if(locals)
+    *locals += lcls;
+  c = new CachedParameters;
+  c->parameters = rv;
+  c->locals = lcls;
+  parametersCache.setMaxCost(::codeCacheSize);
+  parametersCache.insert(code, c);
+  return rv;
+}
+
+QStringList MRuby::detectParametersNoCache(const QByteArray & code,
+                                           QStringList * locals)
 {
   // QTextStream o(stdout);
   // o << "Detect: '" << code << "' -- " << locals << endl;
@@ -1073,6 +1118,55 @@ void MRuby::startGC()
   mrb_full_gc(mrb);
 }
 
+void MRuby::countObjects(qint64 * live, qint64 * heapSize)
+{
+  MRubyArenaContext c(this);
+  mrb_value os = mrb_obj_value(mrb_module_get(mrb, "ObjectSpace"));
+  funcall(os, intern("count_objects"), 1, &objectCounts);
+  qint64 total = floatValue(mrb_hash_get(mrb, objectCounts,
+                                         mrb_symbol_value(intern("TOTAL"))));
+  qint64 free = floatValue(mrb_hash_get(mrb, objectCounts,
+                                        mrb_symbol_value(intern("FREE"))));
+  if(live)
+    *live = total - free;
+  if(heapSize)
+    *heapSize = total;
+}
+
+bool MRuby::reuseFloatArguments()
+{
+  return ::reuseFloats;
+}
+
+void MRuby::collectAtCommandBoundary()
+{
+  QElapsedTimer timer;
+  timer.start();
+  int budget = ::heapBudget;
+  qint64 live = 0;
+  if(budget > 0)
+    countObjects(&live, NULL);
+  if(budget > 0 && live > budget) {
+    mrb_full_gc(mrb);
+    ++gcStatistics.fullCollections;
+  }
+  else {
+    mrb_incremental_gc(mrb);
+    ++gcStatistics.incrementalSteps;
+  }
+  qint64 pause = timer.nsecsElapsed();
+  gcStatistics.totalPause += pause;
+  if(pause > gcStatistics.longestPause)
+    gcStatistics.longestPause = pause;
+}
+
+MRuby::GCStats MRuby::gcStats()
+{
+  GCStats rv = gcStatistics;
+  countObjects(&rv.live, &rv.heapSize);
+  return rv;
+}
+
 
 
 void MRuby::gcRegister(mrb_value obj)
@@ -1158,7 +1252,50 @@ mrb_value MRuby::newInt(int value)
   return mrb_fixnum_value(value);
 }
 
+MRuby::CachedBlock::CachedBlock(MRuby * m, mrb_int i, mrb_value b) :
+  mr(m), id(i), block(b)
+{
+  mrb_hash_set(mr->mrb, mr->cachedBlocks, mrb_fixnum_value(id), block);
+}
+
+MRuby::CachedBlock::~CachedBlock()
+{
+  mrb_hash_delete_key(mr->mrb, mr->cachedBlocks, mrb_fixnum_value(id));
+}
+
 mrb_value MRuby::makeBlock(const QString & code, const QStringList & vars)
+{
+  QString key = vars.join(",") + "\n" + code;
+  CachedBlock * c = blockCache.object(key);
+  if(c) {
+    ++cacheHits;
+    return c->block;
+  }
+  ++cacheMisses;
+  mrb_value blk = makeBlockNoCache(code, vars);
+  blockCache.setMaxCost(::codeCacheSize);
+  blockCache.insert(key, new CachedBlock(this, nextBlockID++, blk));
+  return blk;
+}
+
+MRuby::CodeCacheStats MRuby::codeCacheStats() const
+{
+  CodeCacheStats rv;
+  rv.blocks = blockCache.size();
+  rv.parameters = parametersCache.size();
+  rv.hits = cacheHits;
+  rv.misses = cacheMisses;
+  return rv;
+}
+
+void MRuby::clearCodeCache()
+{
+  blockCache.clear();
+  parametersCache.clear();
+}
+
+mrb_value MRuby::makeBlockNoCache(const QString & code,
+                                  const QStringList & vars)
 {
   if(vars.size() > 16) {
     // We need to use a catch-all block
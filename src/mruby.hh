@@ -68,6 +68,59 @@ private:
 
   mrb_sym sBrackets;
 
+  /// @name Code cache
+  ///
+  /// Expression objects are very often built again and again from
+  /// the same formula (e.g. apply-formula within run-for-each), so
+  /// the results of makeBlock() and detectParameters() are cached.
+  ///
+  /// @{
+
+  /// A cached block. All the blocks are protected from garbage
+  /// collection through the cachedBlocks hash.
+  class CachedBlock {
+  public:
+    MRuby * mr;
+
+    /// The key in cachedBlocks
+    mrb_int id;
+
+    mrb_value block;
+
+    CachedBlock(MRuby * m, mrb_int i, mrb_value b);
+    ~CachedBlock();
+  };
+
+  /// Cached results of detectParameters()
+  class CachedParameters {
+  public:
+    QStringList parameters;
+    QStringList locals;
+  };
+
+  /// Blocks, indexed by variables + code
+  QCache<QString, CachedBlock> blockCache;
+
+  /// Parameters, indexed by code
+  QCache<QByteArray, CachedParameters> parametersCache;
+
+  /// The hash holding all the cached blocks, registered once and for
+  /// all with the GC.
+  mrb_value cachedBlocks;
+
+  /// The ID of the next cached block
+  mrb_int nextBlockID;
+
+  /// Hits and misses
+  qint64 cacheHits;
+  qint64 cacheMisses;
+
+  /// Makes the block without looking at the cache.
+  mrb_value makeBlockNoCache(const QString & code,
+                             const QStringList & parameters);
+
+  /// @}
+
 public:
   mrb_state *mrb;
 
@@ -105,8 +158,28 @@ public:
   /// proc do |parameters...|
   ///   ...
   /// end
+  ///
+  /// The blocks are cached, so calling twice this function with the
+  /// same arguments is likely to return the same block.
   mrb_value makeBlock(const QString & code, const QStringList & parameters);
 
+  /// Statistics about the code cache
+  class CodeCacheStats {
+  public:
+    /// Number of cached blocks
+    int blocks;
+    /// Number of cached parameter lists
+    int parameters;
+    qint64 hits;
+    qint64 misses;
+  };
+
+  /// Returns the statistics about the code cache
+  CodeCacheStats codeCacheStats() const;
+
+  /// Empties the code cache
+  void clearCodeCache();
+
 
   void gcRegister(mrb_value obj);
   void gcUnregister(mrb_value obj);
@@ -114,12 +187,93 @@ public:
   /// Starts the garbage collection
   void startGC();
 
+  /// @name Managed garbage collection
+  ///
+  /// To keep the memory bounded in long scripts, garbage collection
+  /// is triggered at the end of each command: a full one if the
+  /// number of live objects exceeds the ruby/heap-budget setting, an
+  /// incremental step otherwise.
+  ///
+  /// The object counts come from ObjectSpace.count_objects, so as not
+  /// to depend on the internals of mruby.
+  ///
+  /// @{
+
+  /// Statistics about the garbage collection
+  class GCStats {
+  public:
+    /// Number of live objects
+    qint64 live;
+
+    /// The size of the heap, i.e. the number of object slots, free
+    /// or not
+    qint64 heapSize;
+
+    /// The number of full and incremental GCs run from
+    /// collectAtCommandBoundary()
+    qint64 fullCollections;
+    qint64 incrementalSteps;
+
+    /// Total and longest pause, in nanoseconds
+    qint64 totalPause;
+    qint64 longestPause;
+  };
+
+  /// Runs the GC as needed, to be called between commands.
+  void collectAtCommandBoundary();
+
+  /// Returns the current GC statistics
+  GCStats gcStats();
+
+  /// @}
+
+private:
+  /// The GC statistics (but the object counts)
+  GCStats gcStatistics;
+
+  /// The hash filled by ObjectSpace.count_objects, reused from one
+  /// call to the next.
+  mrb_value objectCounts;
+
+  /// Counts the objects of the heap: the live ones and all the slots.
+  void countObjects(qint64 * live, qint64 * heapSize);
+
+public:
+
   /// @name Number-related functions
   /// @{
 
   /// Returns a new float with the given value.
   mrb_value newFloat(double value);
 
+  /// Whether the formulas are evaluated in the "managed" mode, in
+  /// which the float objects given as arguments are reused from one
+  /// evaluation to the next (the ruby/reuse-float-arguments setting).
+  static bool reuseFloatArguments();
+
+  /// Returns a float argument with the given value. When @a reuse
+  /// is true (see reuseFloatArguments()) and floats are
+  /// heap-allocated objects (word boxing without inline floats), the
+  /// object @a box, which must have been created by newFloat() and be
+  /// protected from the GC, is updated in place and returned, so that
+  /// repeated evaluations of formulas do not create garbage. A formula
+  /// that keeps its arguments (in a global variable, for instance)
+  /// then sees them change at the next evaluation. Otherwise, a new
+  /// float is returned, and @a box is left untouched.
+  static mrb_value floatArgument(mrb_state * mrb, mrb_value box,
+                                 double value, bool reuse) {
+#if defined(MRB_WORD_BOXING) && (MRUBY_RELEASE_MAJOR < 3 || defined(MRB_WORDBOX_NO_FLOAT_TRUNCATE))
+    if(reuse && mrb_float_p(box)) {
+      ((struct RFloat*)mrb_ptr(box))->f = value;
+      return box;
+    }
+#else
+    Q_UNUSED(reuse);
+    Q_UNUSED(box);
+#endif
+    return mrb_float_value(mrb, value);
+  };
+
   /// Returns a new complex value
   mrb_value newComplex(const gsl_complex & value);
 
@@ -183,10 +337,16 @@ public:
   static QByteArray annotateQuotes(const QString & code);
 
   /// Detects the "external parameters" for the given code. This may
-  /// either be detectParametersNative or detectParametersApprox
+  /// either be detectParametersNative or detectParametersApprox.
+  ///
+  /// The results are cached.
   QStringList detectParameters(const QByteArray & code,
                                QStringList * localVariables = NULL);
 
+  /// Same as detectParameters(), but without looking at the cache.
+  QStringList detectParametersNoCache(const QByteArray & code,
+                                      QStringList * localVariables = NULL);
+
   /// Defines a module function
   void defineGlobalConstant(const char *name, mrb_value val);
 
@@ -25,6 +25,70 @@
 
 #include <general-arguments.hh>
 #include <debug.hh>
+#include <settings-templates.hh>
+
+#include <QAtomicInteger>
+
+static SettingsValue<int> trajectoryCacheSize("fits/ode-trajectory-cache",
+                                              10000000,
+                                              "maximum number of values of the trajectories kept in total (for all the datasets and all the threads) by ODE fits, to avoid integrating from the start when computing the jacobian (0 to disable)");
+
+/// The number of values currently kept in all the trajectories
+static QAtomicInteger<qint64> trajectoryValues(0);
+
+ODEFit::Storage::Trajectory::Trajectory() :
+  reserved(0)
+{
+}
+
+ODEFit::Storage::Trajectory::Trajectory(const Trajectory &) :
+  reserved(0)
+{
+}
+
+ODEFit::Storage::Trajectory &
+ODEFit::Storage::Trajectory::operator=(const Trajectory & other)
+{
+  if(this != &other)
+    release();
+  return *this;
+}
+
+ODEFit::Storage::Trajectory::~Trajectory()
+{
+  release();
+}
+
+void ODEFit::Storage::Trajectory::release()
+{
+  parameters.clear();
+  x.clear();
+  checkpoints.clear();
+  values.clear();
+  outputs.clear();
+  if(reserved > 0)
+    trajectoryValues.fetchAndAddOrdered(-reserved);
+  reserved = 0;
+}
+
+bool ODEFit::Storage::Trajectory::prepare(const Vector & xv, int dim)
+{
+  release();
+  qint64 nb = qint64(xv.size()) * (dim + 1);
+  qint64 max = trajectoryCacheSize;
+  qint64 cur = trajectoryValues.load();
+  do {
+    if(cur + nb > max)
+      return false;
+  } while(! trajectoryValues.testAndSetOrdered(cur, cur + nb, cur));
+  reserved = nb;
+
+  x = xv;
+  for(int j = 0; j < dim; j++)
+    values << Vector(xv.size(), 0);
+  outputs = Vector(xv.size(), 0);
+  return true;
+}
 
 void ODEFit::processOptions(const CommandOptions & opts, FitData * data) const
 {
@@ -63,6 +127,11 @@ double ODEFit::reporterValue(double t, FitData * ) const
   return 0.0;
 }
 
+QSet<QString> ODEFit::reporterOnlyParameters(FitData * ) const
+{
+  return QSet<QString>();
+}
+
 CommandOptions ODEFit::currentSoftOptions(FitData * data) const
 {
   return solver(data)->getStepperOptions().asOptions();
@@ -99,6 +168,7 @@ void ODEFit::processSoftOptions(const CommandOptions & opts, FitData * data) con
   s->cachedX.clear();
   s->cachedValues.clear();
   s->cachedParameters.clear();
+  s->trajectories.clear();
 
   // // Setting up the cache:
   // if(! hasReporters(data) && data->datasets.size() > 1) {
@@ -137,15 +207,20 @@ void ODEFit::updateParameters(FitData * data) const
   s->temperatureIndex = -1;
   s->potentialIndex = -1;
   s->reporterIndex = -1;
+  s->reporterOnlyIndices.clear();
+  s->trajectories.clear();
 
   if(! hasReporters(data)) {
     QStringList names = variableNames(data);
     s->reporterIndex = defs.size();
-    for(int i = 0; i < names.size(); i++)
+    for(int i = 0; i < names.size(); i++) {
+      s->reporterOnlyIndices.insert(defs.size());
       defs << ParameterDefinition(QString("y_%1").
                                   arg(names[i]), i != 0,
                                   true, true);
+    }
   }
+  QSet<QString> reporterOnly = reporterOnlyParameters(data);
   // If there are reporters, then the underlying parameters are
   // already taken care of by the systemParameters()
   if(s->hasOrigTime)
@@ -186,6 +261,8 @@ void ODEFit::updateParameters(FitData * data) const
       continue;
     }
 
+    if(reporterOnly.contains(name))
+      s->reporterOnlyIndices.insert(defs.size());
     defs << ParameterDefinition(name, isFixed(name, data)); 
   }
   s->tdBase = defs.size();
@@ -293,6 +370,72 @@ void ODEFit::compute(const double * a, FitData * data,
     doCache = true;
   }
   
+  const Vector & xv = ds->x();
+  if(xv.size() < 2)
+    throw RuntimeError("Not enough data points");
+  int nb = xv.size();
+  int dim = slv->dimension();
+
+  // Now, we look whether the beginning of the trajectory (or all of
+  // it) can be taken from the last full integration.
+  Storage::Trajectory * base = NULL;
+  const Storage::Checkpoint * resume = NULL;
+  int replay = 0;               // the number of points from base
+  bool reporterChanged = false;
+  bool record = false;
+  if(trajectoryCacheSize > 0) {
+    base = &s->trajectories[ds];
+    if(base->x != xv || base->parameters.size() != s->parametersNumber)
+      record = true;
+    else {
+      int changed = 0;
+      bool fromStart = false;
+      bool tdps = false;
+      for(int i = 0; i < s->parametersNumber; i++) {
+        if(a[i] == base->parameters[i])
+          continue;
+        ++changed;
+        if(s->reporterOnlyIndices.contains(i))
+          reporterChanged = true;
+        else if(i >= s->tdBase)
+          tdps = true;
+        else
+          fromStart = true;
+      }
+      if(! fromStart) {
+        double first = GSL_POSINF;
+        if(tdps)
+          first = s->timeDependentParameters.
+            firstDifference(base->parameters.data() + s->tdBase,
+                            a + s->tdBase);
+        if(first == GSL_POSINF)
+          replay = nb;
+        else {
+          // We can only resume from a checkpoint before the first
+          // difference, that is also a discontinuity for the new
+          // parameters, since the integration restarts at each
+          // discontinuity.
+          Vector disc = s->timeDependentParameters.
+            discontinuities(a + s->tdBase);
+          for(const Storage::Checkpoint & cp : base->checkpoints) {
+            if(cp.time >= first)
+              break;
+            if(disc.contains(cp.time))
+              resume = &cp;
+          }
+          if(resume)
+            replay = resume->index;
+        }
+      }
+      // A single parameter changed: this is most probably the
+      // computation of the jacobian, so we keep the base trajectory.
+      record = replay == 0 && ! resume && changed > 1;
+    }
+    // Nothing is kept if that would go over the limit
+    if(record)
+      record = base->prepare(xv, dim);
+  }
+  
   slv->resetStepper();
 
   s->timeDependentParameters.initialize(a + s->tdBase);
@@ -315,10 +458,6 @@ void ODEFit::compute(const double * a, FitData * data,
       
     }, data);
 
-  const Vector & xv = ds->x();
-  if(xv.size() < 2)
-    throw RuntimeError("Not enough data points");
-
   double ini = s->voltammogram ? 0 : xv[0];
   initialize(s->hasOrigTime ? *(a + s->parametersBase - 1) : ini, a, data);
 
@@ -332,17 +471,52 @@ void ODEFit::compute(const double * a, FitData * data,
   s->direction = xv[1] > xv[0] ? sr : -sr;
   s->lastTime = 0;
   s->lastPot = xv[0];
+
+  // In dense output mode, the integration runs ahead of the data
+  // points, but it must not go past the discontinuities, nor past the
+  // changes in the scan direction for voltammograms, which are
+  // themselves discontinuities in the derivative of the potential.
+  // limits holds for each point the end of the scan it belongs to.
+  bool dense = slv->getStepperOptions().denseOutput &&
+    ! slv->getStepperOptions().fixed;
+  Vector limits;
+  if(dense) {
+    Vector times(nb, 0);
+    double dir = s->direction, lt = 0, lp = xv[0];
+    limits = Vector(nb, 0);
+    QList<int> changes;
+    for(int i = 0; i < nb; i++) {
+      if(s->voltammogram && i > 0) {
+        if((xv[i] - lp) * dir < 0) {
+          dir = -dir;
+          changes << i;
+        }
+        lt += (xv[i] - lp) / dir;
+        lp = xv[i];
+      }
+      times[i] = (s->voltammogram ? lt : xv[i]);
+      if(i > 0 && times[i] < times[i-1])
+        dense = false;          // Only works for increasing times
+    }
+    changes << nb;
+    int next = 0;
+    for(int i = 0; i < nb; i++) {
+      if(i >= changes[next])
+        next++;
+      limits[i] = times[changes[next] - 1];
+    }
+  }
   
   bool reporters = hasReporters(data);
 
   if(targetData) {
     targetData->clear();
-    int sz = slv->dimension();
-    for(int j = 0; j < sz; j++)
+    for(int j = 0; j < dim; j++)
       *targetData << Vector();
   }
 
-  for(int i = 0; i < xv.size(); i++) {
+  QVarLengthArray<double, 100> stored(dim);
+  for(int i = 0; i < nb; i++) {
     // Here, we must be wary of the discontinuity points (ie those
     // of the time-evolving stuff)
 
@@ -355,47 +529,118 @@ void ODEFit::compute(const double * a, FitData * data,
     }
 
     double tg = (s->voltammogram ? s->lastTime : xv[i]);
-    while(discontinuities.size() > 0 && 
-          discontinuities[0] < slv->currentTime())
-      discontinuities.remove(0);
-
-    if(discontinuities.size() > 0) {
-      double td = discontinuities[0];
-      if(slv->currentTime() < td && tg > td) {
-        // Make a first step to the discontinuity
-        slv->stepTo(td);
-        discontinuities.remove(0);
+    const double * cv = NULL;
+    double val = 0;
+    bool computeValue = true;
+    if(i < replay) {
+      for(int j = 0; j < dim; j++)
+        stored[j] = base->values[j][i];
+      cv = stored.data();
+      if(reporterChanged)
+        slv->restart(cv, tg);
+      else {
+        val = base->outputs[i];
+        computeValue = false;
       }
     }
+    else {
+      if(resume && i == replay) {
+        slv->restart(resume->values.data(), resume->time);
+        while(discontinuities.size() > 0 && 
+              discontinuities[0] < resume->time)
+          discontinuities.remove(0);
+        discontinuities.remove(0);
+      }
+      
+      while(discontinuities.size() > 0 && 
+            discontinuities[0] < slv->currentTime())
+        discontinuities.remove(0);
 
-    slv->stepTo(tg);
-    double val = 0;
-    const double * cv = slv->currentValues();
-    if(reporters) {
-      val = reporterValue(slv->currentTime(), data);
+      if(discontinuities.size() > 0) {
+        double td = discontinuities[0];
+        if(slv->currentTime() < td && tg > td) {
+          // Make a first step to the discontinuity
+          if(dense)
+            slv->stepTo(td, td);
+          else
+            slv->stepTo(td);
+          discontinuities.remove(0);
+
+          // The integration restarts afresh at each discontinuity,
+          // which makes it possible to resume from there.
+          if(record) {
+            Storage::Checkpoint cp;
+            cp.index = i;
+            cp.time = td;
+            cp.values = Vector(dim, 0);
+            for(int j = 0; j < dim; j++)
+              cp.values[j] = slv->currentValues()[j];
+            base->checkpoints << cp;
+          }
+          slv->restart(slv->currentValues(), td);
+        }
+      }
+
+      if(dense) {
+        double limit = limits[i];
+        if(discontinuities.size() > 0)
+          limit = std::min(limit, discontinuities[0]);
+        slv->stepTo(tg, limit);
+      }
+      else
+        slv->stepTo(tg);
+      cv = slv->currentValues();
     }
-      
-    else {
-      int sz = slv->dimension();
-      for(int j = 0; j < sz; j++)
-        val += cv[j] * a[j + (s->voltammogram ? 2 : 0)];
+
+    if(computeValue) {
+      if(reporters) {
+        val = reporterValue(slv->currentTime(), data);
+      }
+      else {
+        for(int j = 0; j < dim; j++)
+          val += cv[j] * a[j + (s->voltammogram ? 2 : 0)];
+      }
     }
     if(targetData) {
-      int sz = slv->dimension();
-      for(int j = 0; j < sz; j++)
+      for(int j = 0; j < dim; j++)
         (*targetData)[j] << cv[j];
     }
     if(target)
       gsl_vector_set(target, i, val);
     if(doCache) {
-      int sz = slv->dimension();
-      for(int j = 0; j < sz; j++)
+      for(int j = 0; j < dim; j++)
         s->cachedValues[j][i] = cv[j];
     }
+    if(record) {
+      for(int j = 0; j < dim; j++)
+        base->values[j][i] = cv[j];
+      base->outputs[i] = val;
+    }
   }
+  if(record)
+    base->parameters = Vector(a, s->parametersNumber);
 
   if(data->debug) {
-    Debug::debug() << "Number of evaluations: " << slv->evaluations << endl;
+    if(replay == nb)
+      Debug::debug() << "Trajectory taken from the previous integration"
+                     << (reporterChanged ? ", reporters recomputed" : "")
+                     << endl;
+    else if(resume)
+      Debug::debug() << "Integration resumed from the checkpoint at t = "
+                     << resume->time << ", skipping " << replay
+                     << " of " << nb << " points" << endl;
+    Debug::debug() << "Number of evaluations: " << slv->evaluations
+                   << ", integration steps: " << slv->integrationSteps()
+                   << endl;
+    if(dense && replay < nb) {
+      // Without dense output, there is at least one step per point.
+      int steps = std::max(slv->integrationSteps(), 1);
+      int points = nb - replay;
+      Debug::debug() << "Dense output: " << steps
+                     << " steps instead of at least " << points
+                     << ", i.e. " << double(points)/steps
+                     << " times fewer" << endl;
+    }
   }
       
 }
@@ -68,6 +68,11 @@ protected:
   /// Returns the value of reporters
   virtual double reporterValue(double t, FitData * data) const;
 
+  /// Returns the names of the system parameters that are only used
+  /// by the reporters, i.e. that have no influence on the time
+  /// evolution. By default, there are none.
+  virtual QSet<QString> reporterOnlyParameters(FitData * data) const;
+
   /// Setups a callback that should be called at each time, and will be given
   /// * the time
   /// * the system parameters (to be modified)
@@ -129,6 +134,83 @@ protected:
     Vector cachedParameters;
     Vector cachedX;
     QList<Vector> cachedValues;
+
+    /// @name Checkpointing
+    ///
+    /// Most of the function evaluations when computing the jacobian
+    /// only differ from the base parameters by one parameter. When
+    /// that parameter only affects the reporters, or only the
+    /// time-dependent parameters after a given time, the beginning
+    /// of the trajectory is the same as that of the base
+    /// parameters, and can be taken from this cache.
+    ///
+    /// @{
+
+    /// The indices of the fit parameters that only affect the
+    /// reporters (or the linear combination of the variables), and
+    /// not the time evolution.
+    QSet<int> reporterOnlyIndices;
+
+    /// A point at which the integration was restarted (i.e. a
+    /// discontinuity), and from which it can be resumed.
+    class Checkpoint {
+    public:
+      /// The index of the first data point after the checkpoint
+      int index;
+
+      /// The time
+      double time;
+
+      /// The values of the variables
+      Vector values;
+    };
+
+    /// The results of the last full integration for a given dataset.
+    ///
+    /// The number of values kept in all the trajectories, for all
+    /// the fits and all the copies of their storage (one per worker
+    /// thread), is bounded by the fits/ode-trajectory-cache
+    /// setting. Copies of a trajectory start empty.
+    class Trajectory {
+    public:
+      /// The parameters, empty if the trajectory is not valid.
+      Vector parameters;
+
+      /// The X values of the dataset
+      Vector x;
+
+      /// The checkpoints, by increasing time.
+      QList<Checkpoint> checkpoints;
+
+      /// The values of the variables at each point, one Vector per
+      /// variable.
+      QList<Vector> values;
+
+      /// The values of the function at each point
+      Vector outputs;
+
+      /// The number of values accounted for in the global limit
+      qint64 reserved;
+
+      Trajectory();
+      Trajectory(const Trajectory & other);
+      Trajectory & operator=(const Trajectory & other);
+      ~Trajectory();
+
+      /// Clears the trajectory, and frees its values for use by
+      /// other trajectories.
+      void release();
+
+      /// Clears the trajectory and sets it up for @a dim variables
+      /// at @a nb points. Returns false, leaving the trajectory
+      /// empty, if that would go over the global limit.
+      bool prepare(const Vector & x, int dim);
+    };
+
+    /// The trajectories, by dataset.
+    QHash<const DataSet *, Trajectory> trajectories;
+
+    /// @}
   };
 
   virtual void processOptions(const CommandOptions & opts, FitData * data) const override;
@@ -138,7 +220,10 @@ protected:
   };
 
   virtual FitInternalStorage * copyStorage(FitData * /*data*/, FitInternalStorage * source, int /*ds = -1*/) const override {
-    return deepCopy<Storage>(source);
+    Storage * s = deepCopy<Storage>(source);
+    // The copies build their own trajectories
+    s->trajectories.clear();
+    return s;
   };
 
 
@@ -22,16 +22,330 @@
 
 #include <vector.hh>
 #include <exceptions.hh>
+#include <profiler.hh>
 
 #include <argumentmarshaller.hh>
 #include <general-arguments.hh>
 #include <argument-templates.hh>
 
+#include <sparselu.hh>
+
+//////////////////////////////////////////////////////////////////////
+// A Rosenbrock stepper using sparse linear algebra
+
+/// The state of the sparse-rosenbrock stepper, the modified
+/// Rosenbrock method of order 2 (with an error estimate of order 3)
+/// from Shampine and Reichelt (the ode23s solver of MATLAB).
+///
+/// The stepper can only be used on the systems of ODESolver, whose
+/// jacobianPattern() is used both to compute the jacobian by finite
+/// differences with as few evaluations as possible (the columns that
+/// don't share any row are computed together), and to solve the
+/// linear systems using SparseLU.
+class SparseRosenbrockState {
+public:
+  /// The dimension of the system
+  int dim;
+
+  /// The solver whose pattern was used to setup the state
+  const ODESolver * solver;
+
+  /// The sparsity pattern, by columns
+  QVector<QVector<int> > pattern;
+
+  /// The groups of columns that are computed together
+  QVector<QVector<int> > groups;
+
+  /// The values of the jacobian, in the same order as pattern
+  QVector<QVector<double> > jacobian;
+
+  /// The derivative of the function with respect to time
+  QVector<double> dfdt;
+
+  /// The matrix I - h d J
+  SparseLU * lu;
+
+  /// Whether the jacobian was computed at jacobianT and jacobianY,
+  /// in which case it is not computed again, as after a rejected
+  /// step.
+  bool jacobianValid;
+
+  double jacobianT;
+
+  QVector<double> jacobianY;
+
+  /// Work vectors
+  QVector<double> f0, f1, f2, k1, k2, k3, ytmp, buffer;
+
+  explicit SparseRosenbrockState(int d) :
+    dim(d), solver(NULL), dfdt(d), lu(NULL), jacobianValid(false),
+    jacobianT(0), jacobianY(d), f0(d), f1(d), f2(d), k1(d), k2(d),
+    k3(d), ytmp(d), buffer(d)
+  {
+  };
+
+  ~SparseRosenbrockState() {
+    delete lu;
+  };
+
+  /// Prepares the pattern and the groups of columns for the given
+  /// system.
+  void setup(const gsl_odeiv2_system * sys);
+
+  /// Computes the jacobian and the time derivative at the given
+  /// point, using the derivatives \a f in this point.
+  int computeJacobian(double t, double h, const double * y,
+                      const double * f, const gsl_odeiv2_system * sys);
+
+  /// Computes I - hd J and decomposes it.
+  bool decompose(double hd);
+};
+
+void SparseRosenbrockState::setup(const gsl_odeiv2_system * sys)
+{
+  const ODESolver * s = static_cast<const ODESolver *>(sys->params);
+  if(lu && s == solver)
+    return;
+  solver = s;
+  pattern = solver->jacobianPattern();
+  if(pattern.isEmpty()) {
+    // Dense jacobian
+    QVector<int> all(dim);
+    for(int i = 0; i < dim; i++)
+      all[i] = i;
+    pattern.fill(all, dim);
+  }
+  if(pattern.size() != dim)
+    throw InternalError("Jacobian pattern of size %1 for a system "
+                        "of dimension %2").arg(pattern.size()).arg(dim);
+
+  // Greedy grouping of the columns: each column goes in the first
+  // group that does not have any row in common with it.
+  groups.clear();
+  QVector<QVector<bool> > usedRows;
+  for(int j = 0; j < dim; j++) {
+    QVector<int> & col = pattern[j];
+    std::sort(col.begin(), col.end());
+    col.erase(std::unique(col.begin(), col.end()), col.end());
+    int g = 0;
+    for(; g < groups.size(); g++) {
+      bool fits = true;
+      for(int i : col) {
+        if(usedRows[g][i]) {
+          fits = false;
+          break;
+        }
+      }
+      if(fits)
+        break;
+    }
+    if(g == groups.size()) {
+      groups << QVector<int>();
+      usedRows << QVector<bool>(dim, false);
+    }
+    groups[g] << j;
+    for(int i : col)
+      usedRows[g][i] = true;
+  }
+
+  jacobian.resize(dim);
+  for(int j = 0; j < dim; j++)
+    jacobian[j].fill(0, pattern[j].size());
+
+  delete lu;
+  lu = new SparseLU(pattern);
+  jacobianValid = false;
+}
+
+int SparseRosenbrockState::computeJacobian(double t, double h,
+                                           const double * y,
+                                           const double * f,
+                                           const gsl_odeiv2_system * sys)
+{
+  double * yt = ytmp.data();
+  double * buf = buffer.data();
+  for(int i = 0; i < dim; i++)
+    yt[i] = y[i];
+
+  for(const QVector<int> & grp : groups) {
+    for(int j : grp) {
+      double step = y[j] * 1e-7;
+      if(fabs(step) < 1e-13)
+        step = 1e-13;
+      yt[j] = y[j] + step;
+    }
+    int status = GSL_ODEIV_FN_EVAL(sys, t, yt, buf);
+    if(status != GSL_SUCCESS)
+      return status;
+    for(int j : grp) {
+      double fact = 1/(yt[j] - y[j]);
+      const QVector<int> & col = pattern[j];
+      double * vals = jacobian[j].data();
+      for(int k = 0; k < col.size(); k++)
+        vals[k] = (buf[col[k]] - f[col[k]]) * fact;
+      yt[j] = y[j];
+    }
+  }
+
+  // And the time derivative, for the non-autonomous systems
+  double dt = 1e-7 * std::max(fabs(t), fabs(h));
+  if(dt < 1e-13)
+    dt = 1e-13;
+  int status = GSL_ODEIV_FN_EVAL(sys, t + dt, y, buf);
+  if(status != GSL_SUCCESS)
+    return status;
+  for(int i = 0; i < dim; i++)
+    dfdt[i] = (buf[i] - f[i])/dt;
+
+  jacobianT = t;
+  for(int i = 0; i < dim; i++)
+    jacobianY[i] = y[i];
+  jacobianValid = true;
+  return GSL_SUCCESS;
+}
+
+bool SparseRosenbrockState::decompose(double hd)
+{
+  lu->clear();
+  for(int j = 0; j < dim; j++) {
+    const QVector<int> & col = pattern[j];
+    const double * vals = jacobian[j].constData();
+    for(int k = 0; k < col.size(); k++)
+      lu->add(col[k], j, -hd * vals[k]);
+    lu->add(j, j, 1);
+  }
+  return lu->decompose();
+}
+
+static void * sparseRosenbrockAlloc(size_t dim)
+{
+  return new SparseRosenbrockState(dim);
+}
+
+static int sparseRosenbrockApply(void * vstate, size_t dim, double t,
+                                 double h, double y[], double yerr[],
+                                 const double dydt_in[], double dydt_out[],
+                                 const gsl_odeiv2_system * sys)
+{
+  SparseRosenbrockState * s = static_cast<SparseRosenbrockState *>(vstate);
+  s->setup(sys);
+
+  const double d = 1/(2 + M_SQRT2);
+  const double e32 = 6 + M_SQRT2;
+  const double hd = h * d;
+
+  double * f0 = s->f0.data();
+  double * f1 = s->f1.data();
+  double * f2 = s->f2.data();
+  double * k1 = s->k1.data();
+  double * k2 = s->k2.data();
+  double * k3 = s->k3.data();
+  double * yt = s->ytmp.data();
+  const double * dfdt = s->dfdt.constData();
+  int status;
+
+  if(dydt_in) {
+    for(size_t i = 0; i < dim; i++)
+      f0[i] = dydt_in[i];
+  }
+  else {
+    status = GSL_ODEIV_FN_EVAL(sys, t, y, f0);
+    if(status != GSL_SUCCESS)
+      return status;
+  }
+
+  bool same = s->jacobianValid && s->jacobianT == t;
+  for(size_t i = 0; same && i < dim; i++)
+    same = s->jacobianY[i] == y[i];
+  if(! same) {
+    status = s->computeJacobian(t, h, y, f0, sys);
+    if(status != GSL_SUCCESS)
+      return status;
+  }
+
+  // A failure here makes the evolve object try a smaller step.
+  if(! s->decompose(hd))
+    return GSL_FAILURE;
+
+  for(size_t i = 0; i < dim; i++)
+    k1[i] = f0[i] + hd * dfdt[i];
+  s->lu->solve(k1);
+
+  for(size_t i = 0; i < dim; i++)
+    yt[i] = y[i] + 0.5 * h * k1[i];
+  status = GSL_ODEIV_FN_EVAL(sys, t + 0.5 * h, yt, f1);
+  if(status != GSL_SUCCESS)
+    return status;
+
+  for(size_t i = 0; i < dim; i++)
+    k2[i] = f1[i] - k1[i];
+  s->lu->solve(k2);
+  for(size_t i = 0; i < dim; i++) {
+    k2[i] += k1[i];
+    yt[i] = y[i] + h * k2[i];
+  }
+  status = GSL_ODEIV_FN_EVAL(sys, t + h, yt, f2);
+  if(status != GSL_SUCCESS)
+    return status;
+
+  for(size_t i = 0; i < dim; i++)
+    k3[i] = f2[i] - e32 * (k2[i] - f1[i]) - 2 * (k1[i] - f0[i])
+      + hd * dfdt[i];
+  s->lu->solve(k3);
+
+  for(size_t i = 0; i < dim; i++) {
+    yerr[i] = h/6 * (k1[i] - 2 * k2[i] + k3[i]);
+    y[i] = yt[i];
+  }
+  if(dydt_out) {
+    for(size_t i = 0; i < dim; i++)
+      dydt_out[i] = f2[i];
+  }
+  return GSL_SUCCESS;
+}
+
+static int sparseRosenbrockSetDriver(void * /*vstate*/,
+                                     const gsl_odeiv2_driver * /*d*/)
+{
+  return GSL_SUCCESS;
+}
+
+static int sparseRosenbrockReset(void * vstate, size_t /*dim*/)
+{
+  SparseRosenbrockState * s = static_cast<SparseRosenbrockState *>(vstate);
+  s->jacobianValid = false;
+  return GSL_SUCCESS;
+}
+
+static unsigned int sparseRosenbrockOrder(void * /*vstate*/)
+{
+  return 2;
+}
+
+static void sparseRosenbrockFree(void * vstate)
+{
+  delete static_cast<SparseRosenbrockState *>(vstate);
+}
+
+static const gsl_odeiv2_step_type sparseRosenbrockType = {
+  "sparse-rosenbrock",
+  1,                            // can use dydt_in
+  1,                            // gives exact dydt_out
+  &sparseRosenbrockAlloc,
+  &sparseRosenbrockApply,
+  &sparseRosenbrockSetDriver,
+  &sparseRosenbrockReset,
+  &sparseRosenbrockOrder,
+  &sparseRosenbrockFree
+};
+
+//////////////////////////////////////////////////////////////////////
+
 ODEStepperOptions::ODEStepperOptions(const gsl_odeiv2_step_type * t,
                                      double hs, double ea, 
                                      double er, bool f) :
   type(t), hStart(hs), hMin(0), epsAbs(ea), epsRel(er), fixed(f), nmax(100), 
-  substeps(1000)
+  substeps(1000), denseOutput(false)
 {
 }
 
@@ -49,6 +363,7 @@ QHash<QString, const gsl_odeiv2_step_type *> ODEStepperOptions::stepperTypes()
   types["bsimp"] = gsl_odeiv2_step_bsimp;
   types["msadams"] = gsl_odeiv2_step_msadams;
   types["msbdf"] = gsl_odeiv2_step_msbdf;
+  types["sparse-rosenbrock"] = &sparseRosenbrockType;
   return types;
 }
 
@@ -64,6 +379,7 @@ CommandOptions ODEStepperOptions::asOptions() const
   updateOptions(opts, "prec-relative", epsRel);
   updateOptions(opts, "prec-absolute", epsAbs);
   updateOptions(opts, "sub-steps", substeps);
+  updateOptions(opts, "dense-output", denseOutput);
 
   return opts;
 }
@@ -91,6 +407,8 @@ QList<Argument*> ODEStepperOptions::commandOptions()
                              "absolute precision required")
        << new IntegerArgument("sub-steps", "Maximum number of sub-steps",
                               "If this is not 0, then the smallest step size is that many times smaller than the minimum delta t")
+       << new BoolArgument("dense-output", "Dense output",
+                           "if on, the adaptive steppers take their natural steps and interpolate the values in between (off by default)")
        // << new IntegerArgument("max-iterations", "Maximum of iterations",
        //                       "Maximum number of internal iterations for each step (0 to allow infinite number)")
        << stpa;
@@ -109,6 +427,7 @@ void ODEStepperOptions::parseOptions(const CommandOptions & opts)
   updateFromOptions(opts, "prec-absolute", epsAbs);
   // updateFromOptions(opts, "max-iterations", nmax);
   updateFromOptions(opts, "sub-steps", substeps);
+  updateFromOptions(opts, "dense-output", denseOutput);
 }
 
 QString ODEStepperOptions::description() const
@@ -121,7 +440,7 @@ QString ODEStepperOptions::description() const
       break;
     }
   }
-  return QString("%7 %1, with %2step size: %3 (minimum step size: %8, maximum substeps %9) %4-- absolute precision: %5, relative precision: %6").
+  return QString("%7 %1, with %2step size: %3 (minimum step size: %8, maximum substeps %9) %4-- absolute precision: %5, relative precision: %6%10").
     arg(fixed ? "fixed" : "adaptive").
     arg(fixed ? "" : "initial ").
     arg(hStart).
@@ -130,14 +449,15 @@ QString ODEStepperOptions::description() const
     arg(epsRel).
     arg(s).
     arg(hMin).
-    arg(substeps);
+    arg(substeps).
+    arg(denseOutput && ! fixed ? ", dense output" : "");
 }
 
 //////////////////////////////////////////////////////////////////////
 
 
 ODEStepper::ODEStepper() : 
-  driver(NULL), system(NULL)
+  driver(NULL), system(NULL), stepCount(0)
 {
 }
 
@@ -202,10 +522,12 @@ int ODEStepper::apply(double * t, const double t1, double y[], bool retry)
        nb = (int) ceil((t1 - *t)/options.hStart);
     double step = (t1 - *t)/nb;
     status = gsl_odeiv2_driver_apply_fixed_step(driver, t, step, nb, y);
+    stepCount += driver->n;
   }
   else {
     // o << "Trying from " << *t << " to " << t1  << endl;
     status = gsl_odeiv2_driver_apply(driver, t, t1, y);
+    stepCount += driver->n;
 
     if(retry && (status == GSL_FAILURE || status == GSL_EMAXITER)) {
       // We try to reset the driver with the initial step where we are
@@ -238,6 +560,37 @@ int ODEStepper::apply(double * t, const double t1, double y[], bool retry)
   return status;
 }
 
+int ODEStepper::naturalStep(double * t, const double t1, double y[],
+                            bool retry)
+{
+  if(! driver)
+    throw InternalError("Using naturalStep() on an unitialized ODEStepper");
+  double orig = *t;
+  int status = gsl_odeiv2_evolve_apply(driver->e, driver->c, driver->s,
+                                       driver->sys, t, t1, &driver->h, y);
+  if(status == GSL_SUCCESS) {
+    // Same checks as gsl_odeiv2_driver_apply()
+    if(*t == orig)
+      status = GSL_ENOPROG;
+    else {
+      stepCount++;
+      if(*t != t1 && fabs(driver->h) < driver->hmin)
+        return GSL_ENOPROG;
+      return GSL_SUCCESS;
+    }
+  }
+
+  // Here, neither *t nor y have changed
+  if(retry && (status == GSL_FAILURE || status == GSL_ENOPROG)) {
+    // As in apply(), we try again once with a fresh start.
+    gsl_odeiv2_driver_reset(driver);
+    double hs = effectiveInitialStepSize();
+    driver->h = (hs == 0.0 ? 0.01 : hs);
+    return naturalStep(t, t1, y, false);
+  }
+  return status;
+}
+
 void ODEStepper::setOptions(const ODEStepperOptions & opts)
 {
   freeDriver();
@@ -380,9 +733,28 @@ void ODESolver::initialize(const double * yStart, double tStart)
 
   t = tStart;
   evaluations = 0;
+  stepper.resetStepCount();
   stepperInitialized = false;
 }
 
+void ODESolver::restart(const double * yStart, double tStart)
+{
+  if(! yValues)
+    initializeDriver();
+
+  if(yStart != yValues) {
+    for(int i = 0; i < system.dimension; i++)
+      yValues[i] = yStart[i];
+  }
+  t = tStart;
+  stepperInitialized = false;
+}
+
+int ODESolver::integrationSteps() const
+{
+  return stepper.stepCount;
+}
+
 void ODESolver::initializeStepper(double firstStep)
 {
   // QTextStream o(stdout);
@@ -401,6 +773,7 @@ void ODESolver::stepTo(double to)
     return;
   if(! stepperInitialized)
     initializeStepper(dt);
+  ProfilerTimer tm(Profiler::ODEIntegration);
   int status = stepper.apply(&t, to, yValues);
   if(status != GSL_SUCCESS) {
     throw RuntimeError("Integration failed to give the desired "
@@ -409,11 +782,87 @@ void ODESolver::stepTo(double to)
   }
 }
 
+bool ODESolver::useDenseOutput() const
+{
+  const ODEStepperOptions & opts = stepper.getOptions();
+  return opts.denseOutput && ! opts.fixed;
+}
+
+void ODESolver::stepTo(double to, double limit)
+{
+  if(useDenseOutput())
+    denseStepTo(to, limit);
+  else
+    stepTo(to);
+}
+
+void ODESolver::denseStepTo(double to, double limit)
+{
+  if(to == t)
+    return;
+  int dim = dimension();
+  if(! stepperInitialized) {
+    initializeStepper(to - t);
+    denseT0 = denseT1 = t;
+    denseY1.resize(dim);
+    denseF1.resize(dim);
+    for(int i = 0; i < dim; i++)
+      denseY1[i] = yValues[i];
+    computeDerivatives(t, yValues, denseF1.data());
+    evaluations++;
+    denseY0 = denseY1;
+    denseF0 = denseF1;
+  }
+  if(to < denseT0)
+    throw RuntimeError("Dense output only works with increasing times, "
+                       "but stepping back from %1 to %2").arg(t).arg(to);
+
+  ProfilerTimer tm(Profiler::ODEIntegration);
+  limit = std::max(limit, to);
+  while(denseT1 < to) {
+    denseT0 = denseT1;
+    std::swap(denseY0, denseY1);
+    std::swap(denseF0, denseF1);
+    denseY1 = denseY0;
+    int status = stepper.naturalStep(&denseT1, limit, denseY1.data());
+    if(status != GSL_SUCCESS) {
+      throw RuntimeError("Integration failed to give the desired "
+                         "precision stepping from %1 towards %2: %3 (%4). You may want to try another stepper (such as implicit ones)").
+        arg(denseT0).arg(to).arg(gsl_strerror(status)).arg(status);
+    }
+    computeDerivatives(denseT1, denseY1.constData(), denseF1.data());
+    evaluations++;
+  }
+
+  // Cubic Hermite interpolation within the last step
+  t = to;
+  double h = denseT1 - denseT0;
+  if(to == denseT1 || h <= 0) {
+    for(int i = 0; i < dim; i++)
+      yValues[i] = denseY1[i];
+    return;
+  }
+  double x = (to - denseT0)/h;
+  double x2 = x * x;
+  double h00 = (1 + 2*x) * (1 - x) * (1 - x);
+  double h10 = x * (1 - x) * (1 - x) * h;
+  double h01 = x2 * (3 - 2*x);
+  double h11 = x2 * (x - 1) * h;
+  for(int i = 0; i < dim; i++)
+    yValues[i] = h00 * denseY0[i] + h10 * denseF0[i]
+      + h01 * denseY1[i] + h11 * denseF1[i];
+}
+
 Vector ODESolver::reporterValues() const
 {
   return Vector();
 }
 
+QVector<QVector<int> > ODESolver::jacobianPattern() const
+{
+  return QVector<QVector<int> >();
+}
+
 QList<Vector> ODESolver::steps(const Vector &tValues, bool annotate)
 {
   QList<Vector> ret;
@@ -429,7 +878,7 @@ QList<Vector> ODESolver::steps(const Vector &tValues, bool annotate)
     ret += tValues;
   for(int i = 0; i < tValues.size(); i++) {
     int last = evaluations;
-    stepTo(tValues[i]);
+    stepTo(tValues[i], tValues.last());
     if(reporters) {
       Vector v = reporterValues();
       for(int j = 0; j < dim; j++)
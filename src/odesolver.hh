@@ -59,6 +59,13 @@ public:
   /// This is used only by ODEStepper::autoSetHmin().
   int substeps;
 
+  /// Whether ODESolver::stepTo() uses dense output, i.e. takes
+  /// natural adaptive steps and interpolates the values at the
+  /// requested times, rather than integrating up to each of them.
+  ///
+  /// Only used for adaptive steppers.
+  bool denseOutput;
+
   ODEStepperOptions(const gsl_odeiv2_step_type * t = gsl_odeiv2_step_rkf45,
                     double hs = 0.0, double ea = 1e-16, 
                     // Should always be safe ?
@@ -116,6 +123,20 @@ public:
   /// Steps from *t to t1
   int apply(double * t, const double t1, double y[], bool retry = true);
 
+  /// Performs a single adaptive step from *t, without going past
+  /// t1. This is used for the dense output mode of ODESolver.
+  int naturalStep(double * t, const double t1, double y[],
+                  bool retry = true);
+
+  /// The number of steps performed by the stepper since the last
+  /// call to resetStepCount().
+  int stepCount;
+
+  /// Resets the step count
+  void resetStepCount() {
+    stepCount = 0;
+  };
+
   /// Configures the stepper
   void setOptions(const ODEStepperOptions & options);
 
@@ -163,6 +184,26 @@ class ODESolver {
   /// The current time
   double t;
 
+  /// @name Dense output
+  ///
+  /// When ODEStepperOptions::denseOutput is on, the integration runs
+  /// ahead of the current time: these are the times, values and
+  /// derivatives at the beginning and the end of the last natural
+  /// step, between which the values are interpolated.
+  ///
+  /// @{
+
+  double denseT0, denseT1;
+  QVector<double> denseY0, denseY1, denseF0, denseF1;
+
+  /// Whether the integration is in dense output mode.
+  bool useDenseOutput() const;
+
+  /// Steps until the time \a to in dense output mode.
+  void denseStepTo(double to, double limit);
+
+  /// @}
+
   /// The function computing the next derivative
   static int function(double t, const double y[], double dydt[], 
                       void * params);
@@ -208,9 +249,24 @@ public:
   virtual int computeDerivatives(double t, const double * y, 
                                  double * dydt) = 0;
 
+  /// Returns the sparsity pattern of the jacobian, i.e. for each
+  /// variable j, the list of the indices i of the derivatives that
+  /// may depend on it. An empty list means that the jacobian is
+  /// dense, which is the default.
+  ///
+  /// This is used by the sparse-rosenbrock stepper.
+  virtual QVector<QVector<int> > jacobianPattern() const;
+
   /// Resets the solver to the given starting values
   void initialize(const double * yStart, double tstart);
 
+  /// Restarts the integration from the given values and time, as
+  /// initialize() does, but without resetting the statistics
+  /// (evaluations and integration steps). The stepper is started
+  /// afresh, so that the integration from that point does not depend
+  /// on what happened before.
+  void restart(const double * yStart, double tStart);
+
   /// Returns the current Y values
   const double * currentValues() const {
     return yValues;
@@ -226,6 +282,11 @@ public:
   /// This function probably should raise an exception upon GSL error
   void stepTo(double t);
 
+  /// Steps to the given time \a t. In dense output mode, the
+  /// integration can go on up to \a limit, which must be the time
+  /// of the next discontinuity (or the last time of interest).
+  void stepTo(double t, double limit);
+
   /// Whether or not the ODE has reporters, that is, the result we are
   /// interested in is not the variables, but one or several functions
   /// thereof
@@ -249,6 +310,9 @@ public:
 
   /// The overall number of function evaluations since the beginning.
   int evaluations;
+
+  /// The number of integration steps since the beginning.
+  int integrationSteps() const;
 };
 
 
@@ -40,6 +40,11 @@ public:
                                   FitData * data, gsl_vector * target, 
                                   int dataset) const override;
 
+  /// Per-dataset fits are always separable
+  virtual bool separableDatasets() const override {
+    return true;
+  };
+
   /// Redefined to wrap to a call to the per-dataset function
   virtual void initialGuess(FitData * data, double * guess) const override;
 
@@ -0,0 +1,191 @@
+/*
+  profiler.cc: implementation of the built-in profiler
+  Copyright 2021 by CNRS/AMU
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <headers.hh>
+#include <profiler.hh>
+
+QAtomicInteger<qint64> Profiler::times[Profiler::NbCategories];
+QAtomicInteger<qint64> Profiler::callNumbers[Profiler::NbCategories];
+QHash<QString, Profiler::Record> Profiler::records;
+QStringList Profiler::sectionNames;
+QMutex Profiler::recordsMutex;
+QElapsedTimer Profiler::clock;
+QAtomicInt Profiler::enabled(0);
+QThreadStorage<QVector<qint64> > Profiler::nestedTimes;
+
+Profiler::Totals::Totals()
+{
+  for(int i = 0; i < NbCategories; i++) {
+    time[i] = 0;
+    calls[i] = 0;
+  }
+}
+
+Profiler::Totals & Profiler::Totals::operator+=(const Totals & other)
+{
+  for(int i = 0; i < NbCategories; i++) {
+    time[i] += other.time[i];
+    calls[i] += other.calls[i];
+  }
+  return *this;
+}
+
+Profiler::Totals Profiler::Totals::operator-(const Totals & other) const
+{
+  Totals rv;
+  for(int i = 0; i < NbCategories; i++) {
+    rv.time[i] = time[i] - other.time[i];
+    rv.calls[i] = calls[i] - other.calls[i];
+  }
+  return rv;
+}
+
+void Profiler::setEnabled(bool e)
+{
+  if(e && ! clock.isValid())
+    clock.start();
+  enabled.storeRelease(e ? 1 : 0);
+}
+
+qint64 Profiler::startTimer()
+{
+  if(! isEnabled())
+    return -1;
+  nestedTimes.localData() << 0;
+  return now();
+}
+
+void Profiler::stopTimer(Category cat, qint64 start)
+{
+  qint64 elapsed = now() - start;
+  QVector<qint64> & nested = nestedTimes.localData();
+  // The time spent in the timers started inside this one
+  qint64 inner = nested.takeLast();
+  if(nested.size() > 0)
+    nested.last() += elapsed;
+  record(cat, elapsed - inner);
+}
+
+Profiler::Totals Profiler::currentTotals()
+{
+  Totals rv;
+  for(int i = 0; i < NbCategories; i++) {
+    rv.time[i] = times[i].load();
+    rv.calls[i] = callNumbers[i].load();
+  }
+  return rv;
+}
+
+QString Profiler::categoryName(Category cat)
+{
+  switch(cat) {
+  case RubyEvaluation:
+    return "ruby";
+  case FitFunction:
+    return "fit-function";
+  case Jacobian:
+    return "jacobian";
+  case ODEIntegration:
+    return "ode";
+  case LinearAlgebra:
+    return "linear-algebra";
+  case IO:
+    return "io";
+  default:
+    break;
+  }
+  return "?";
+}
+
+void Profiler::clear()
+{
+  QMutexLocker l(&recordsMutex);
+  records.clear();
+  sectionNames.clear();
+}
+
+QString Profiler::recordsTable()
+{
+  QMutexLocker l(&recordsMutex);
+  QStringList lines;
+  QStringList hd;
+  hd << "section" << "runs" << "wall (s)";
+  for(int i = 0; i < NbCategories; i++) {
+    QString n = categoryName(static_cast<Category>(i));
+    hd << n + " (s)" << n + " (calls)";
+  }
+  lines << hd.join("\t");
+  for(const QString & n : sectionNames) {
+    const Record & r = records[n];
+    QStringList ln;
+    ln << n << QString::number(r.runs)
+       << QString::number(r.wallTime * 1e-9);
+    for(int i = 0; i < NbCategories; i++)
+      ln << QString::number(r.totals.time[i] * 1e-9)
+         << QString::number(r.totals.calls[i]);
+    lines << ln.join("\t");
+  }
+  return lines.join("\n");
+}
+
+QString Profiler::recordsJSON()
+{
+  QMutexLocker l(&recordsMutex);
+  QJsonArray sections;
+  for(const QString & n : sectionNames) {
+    const Record & r = records[n];
+    QJsonObject sec;
+    sec["section"] = n;
+    sec["runs"] = r.runs;
+    sec["wall"] = r.wallTime * 1e-9;
+    for(int i = 0; i < NbCategories; i++) {
+      QJsonObject cat;
+      cat["time"] = r.totals.time[i] * 1e-9;
+      cat["calls"] = r.totals.calls[i];
+      sec[categoryName(static_cast<Category>(i))] = cat;
+    }
+    sections.append(sec);
+  }
+  return QString::fromUtf8(QJsonDocument(sections).toJson());
+}
+
+//////////////////////////////////////////////////////////////////////
+
+ProfilerSection::ProfilerSection(const QString & n) :
+  name(n), start(-1)
+{
+  if(Profiler::isEnabled()) {
+    start = Profiler::now();
+    initial = Profiler::currentTotals();
+  }
+}
+
+ProfilerSection::~ProfilerSection()
+{
+  if(start < 0)
+    return;
+  qint64 wall = Profiler::now() - start;
+  Profiler::Totals delta = Profiler::currentTotals() - initial;
+  QMutexLocker l(&Profiler::recordsMutex);
+  if(! Profiler::records.contains(name))
+    Profiler::sectionNames << name;
+  Profiler::Record & r = Profiler::records[name];
+  r.runs += 1;
+  r.wallTime += wall;
+  r.totals += delta;
+}
@@ -0,0 +1,187 @@
+/**
+   \file profiler.hh
+   A built-in profiler, to find out where the time goes
+   Copyright 2021 by CNRS/AMU
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <headers.hh>
+#ifndef __PROFILER_HH
+#define __PROFILER_HH
+
+#include <QElapsedTimer>
+#include <QAtomicInteger>
+
+/// The built-in profiler.
+///
+/// The time spent in a few hot paths (the categories) is accumulated
+/// globally, using ProfilerTimer objects. Profiling sections
+/// (ProfilerSection objects), such as commands or fits, record the
+/// difference of these accumulators between their start and their
+/// end, so that the timings are inclusive of nested sections.
+///
+/// The times of the categories are exclusive: the time spent in a
+/// timer nested inside another one in the same thread (for instance,
+/// the fit function inside the jacobian) is only counted for the
+/// inner one. Timers running in different threads are counted
+/// separately, so the total can exceed the wall-clock time.
+///
+/// Nothing is measured unless the profiler is enabled.
+class Profiler {
+public:
+
+  /// The categories of the hot paths
+  enum Category {
+    RubyEvaluation = 0,
+    FitFunction,
+    Jacobian,
+    ODEIntegration,
+    LinearAlgebra,
+    IO,
+    NbCategories
+  };
+
+  /// Accumulated values for each category
+  class Totals {
+  public:
+    /// Time spent, in nanoseconds
+    qint64 time[NbCategories];
+
+    /// Number of calls
+    qint64 calls[NbCategories];
+
+    Totals();
+
+    Totals & operator+=(const Totals & other);
+    Totals operator-(const Totals & other) const;
+  };
+
+  /// Everything recorded for a given section name
+  class Record {
+  public:
+    /// The number of times the section ran
+    qint64 runs;
+
+    /// Total wall-clock time, in nanoseconds
+    qint64 wallTime;
+
+    /// The per-category totals
+    Totals totals;
+
+    Record() : runs(0), wallTime(0) {;};
+  };
+
+protected:
+
+  /// The accumulated times
+  static QAtomicInteger<qint64> times[NbCategories];
+
+  /// The accumulated call numbers
+  static QAtomicInteger<qint64> callNumbers[NbCategories];
+
+  /// The records, by section name
+  static QHash<QString, Record> records;
+
+  /// The order in which the sections were first seen
+  static QStringList sectionNames;
+
+  static QMutex recordsMutex;
+
+  /// A global clock
+  static QElapsedTimer clock;
+
+  friend class ProfilerTimer;
+  friend class ProfilerSection;
+
+  /// Whether the profiler is on
+  static QAtomicInt enabled;
+
+  /// For each thread, the time spent in the nested timers, for each
+  /// of the currently running timers.
+  static QThreadStorage<QVector<qint64> > nestedTimes;
+
+  /// Called when a ProfilerTimer starts, returns the start time, or
+  /// -1 if the profiler is disabled.
+  static qint64 startTimer();
+
+  /// Called when a ProfilerTimer started at \a start stops.
+  static void stopTimer(Category cat, qint64 start);
+
+public:
+
+  /// Returns true if the profiler is enabled.
+  static bool isEnabled() {
+    return enabled.loadAcquire();
+  };
+
+  /// Turns on/off the profiler.
+  static void setEnabled(bool enabled);
+
+  /// Returns the current value of the clock, in nanoseconds.
+  static qint64 now() {
+    return clock.nsecsElapsed();
+  };
+
+  /// Adds the given (exclusive) time to the category
+  static void record(Category cat, qint64 time) {
+    times[cat].fetchAndAddRelaxed(time);
+    callNumbers[cat].fetchAndAddRelaxed(1);
+  };
+
+  /// Returns the current totals
+  static Totals currentTotals();
+
+  /// The public name of the category
+  static QString categoryName(Category cat);
+
+  /// Clears all the records.
+  static void clear();
+
+  /// Returns a table (one line per section) of the records.
+  static QString recordsTable();
+
+  /// Returns the records as JSON.
+  static QString recordsJSON();
+};
+
+/// Measures the time spent between its creation and its destruction,
+/// and adds it to a Profiler category.
+class ProfilerTimer {
+  Profiler::Category category;
+  qint64 start;
+public:
+  explicit ProfilerTimer(Profiler::Category cat) :
+    category(cat), start(Profiler::startTimer()) {
+  };
+
+  ~ProfilerTimer() {
+    if(start >= 0)
+      Profiler::stopTimer(category, start);
+  };
+};
+
+/// A profiling section, such as a command.
+class ProfilerSection {
+  QString name;
+  qint64 start;
+  Profiler::Totals initial;
+public:
+  explicit ProfilerSection(const QString & name);
+  ~ProfilerSection();
+};
+
+
+#endif
@@ -26,6 +26,7 @@
 #include <argumentlist.hh>
 #include <general-arguments.hh>
 #include <debug.hh>
+#include <profiler.hh>
 
 #include <sparsejacobian.hh>
 #include <fitparameter.hh>
@@ -390,11 +391,14 @@ void QSoasFitEngine::trialStep(double l, gsl_vector * params,
   
   int sign = 0;
 
-  /// @todo error checking !
-  gsl_linalg_LU_decomp(cur, perm, &sign);
+  {
+    ProfilerTimer t(Profiler::LinearAlgebra);
+    /// @todo error checking !
+    gsl_linalg_LU_decomp(cur, perm, &sign);
 
-  // First compute the delta^r:
-  gsl_linalg_LU_solve(cur, perm, gradient, deltap);
+    // First compute the delta^r:
+    gsl_linalg_LU_solve(cur, perm, gradient, deltap);
+  }
 
   // Now, scale the result
   if(useScaling)
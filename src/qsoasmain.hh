@@ -0,0 +1,32 @@
+/**
+   \file qsoasmain.hh
+   The body of the entry points of QSoas and qsoas-batch
+   Copyright 2021 by CNRS/AMU
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __QSOASMAIN_HH
+#define __QSOASMAIN_HH
+
+/// Runs QSoas, and returns the exit status.
+///
+/// If \a batch is true, this runs qsoas-batch: the QSoas session is
+/// headless, the windows are never shown, the terminal output goes
+/// directly to the standard output, the settings are not saved, and
+/// the exit status is non-zero if any error occurred.
+int qsoasMain(int argc, char ** argv, bool batch);
+
+#endif
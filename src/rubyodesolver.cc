@@ -105,8 +105,15 @@ void RubyODESolver::parseSystem(const QString & init, const QString & der,
   allv << "t" << Expression::variablesNeeded(init)
        << Expression::variablesNeeded(der, vars);
 
-  if(! rep.isEmpty())
-    allv << Expression::variablesNeeded(rep, vars);
+  reporterOnlyParams.clear();
+  if(! rep.isEmpty()) {
+    QStringList repv = Expression::variablesNeeded(rep, vars);
+    for(const QString & v : repv) {
+      if(! allv.contains(v) && ! reporterOnlyParams.contains(v))
+        reporterOnlyParams << v;
+    }
+    allv << repv;
+  }
 
   Utils::makeUnique(allv);
 
@@ -160,6 +167,10 @@ Vector RubyODESolver::reporterValues() const
     v[j++] = currentTime();
     for(int i = 0; i < extraParams.size(); i++)
       v[j++] = extraParamsValues[i];
+    // The last evaluation of the derivatives may not have been done
+    // at the current time, in particular with dense output.
+    if(callback != NULL)
+      callback(currentTime(), v + 1);
     for(int i = 0; i < vars.size(); i++)
       v[j++] = vals[i];
 
@@ -339,6 +350,11 @@ protected:
     return system->hasReporters();
   };
 
+  virtual QSet<QString> reporterOnlyParameters(FitData * data) const override {
+    RubyODESolver * system = getSystem(data);
+    return QSet<QString>::fromList(system->reporterOnlyParameters());
+  };
+
   virtual double reporterValue(double t, FitData * data) const override {
     RubyODESolver * system = getSystem(data);
     Vector v = system->reporterValues();
@@ -50,6 +50,9 @@ class RubyODESolver : public ODESolver {
   /// Values for the extra parameters
   Vector extraParamsValues;
 
+  /// The extra parameters that are only used by the reporters
+  QStringList reporterOnlyParams;
+
   /// A callback called for every time step.
   std::function <void (double, double *)> callback;
 
@@ -104,6 +107,12 @@ public:
     return extraParams;
   };
 
+  /// Returns the extra parameters that are only used by the
+  /// reporters, i.e. that have no influence on the time evolution.
+  const QStringList & reporterOnlyParameters() const {
+    return reporterOnlyParams;
+  };
+
   /// Initializes the solver to the (possibly t0-dependent) initial
   /// values.
   void initialize(double t);
@@ -25,6 +25,7 @@
 
 #include <abdmatrix.hh>
 #include <utils.hh>
+#include <profiler.hh>
 
 SparseJacobian::SparseJacobian(const FitData * data,  bool sp,
                                gsl_matrix * mat) :
@@ -136,6 +137,7 @@ void SparseJacobian::spliceParameter(int index)
 
 void SparseJacobian::computejTj(gsl_matrix * target)
 {
+  ProfilerTimer t(Profiler::LinearAlgebra);
   if(! sparse) {
     gsl_blas_dgemm(CblasTrans, CblasNoTrans, 1, 
                    matrix, matrix, 0, target);
@@ -172,6 +174,7 @@ void SparseJacobian::computejTj(gsl_matrix * target)
 
 void SparseJacobian::computejTj(ABDMatrix * target)
 {
+  ProfilerTimer t(Profiler::LinearAlgebra);
   if(! sparse) {
     target->setFromProduct(matrix);
     return;
@@ -207,6 +210,7 @@ void SparseJacobian::computeGradient(gsl_vector * target,
                                      const gsl_vector * func,
                                      double fact)
 {
+  ProfilerTimer t(Profiler::LinearAlgebra);
   if(! sparse) {
     gsl_blas_dgemv(CblasTrans, fact, 
                    matrix, func, 0, target);
@@ -0,0 +1,206 @@
+/*
+  sparselu.cc: implementation of the SparseLU class
+  Copyright 2021 by CNRS/AMU
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <headers.hh>
+#include <sparselu.hh>
+#include <exceptions.hh>
+
+SparseLU::SparseLU(const QVector<QVector<int> > & pattern) :
+  size(pattern.size())
+{
+  // The symmetrized graph of the matrix
+  QVector<QVector<int> > neighbours(size);
+  for(int j = 0; j < size; j++) {
+    for(int i : pattern[j]) {
+      if(i < 0 || i >= size)
+        throw InternalError("Invalid row %1 in sparse pattern of size %2").
+          arg(i).arg(size);
+      if(i == j)
+        continue;
+      neighbours[i] << j;
+      neighbours[j] << i;
+    }
+  }
+  for(QVector<int> & n : neighbours) {
+    std::sort(n.begin(), n.end());
+    n.erase(std::unique(n.begin(), n.end()), n.end());
+  }
+
+  // Cuthill-McKee ordering: breadth-first search of each connected
+  // component, starting from the node of lowest degree and visiting
+  // the neighbours by increasing degree.
+  auto byDegree = [&neighbours](int a, int b) {
+    return neighbours[a].size() < neighbours[b].size();
+  };
+  QVector<bool> visited(size, false);
+  permutation.reserve(size);
+  while(permutation.size() < size) {
+    int start = -1;
+    for(int i = 0; i < size; i++) {
+      if(visited[i])
+        continue;
+      if(start < 0 || neighbours[i].size() < neighbours[start].size())
+        start = i;
+    }
+    visited[start] = true;
+    int head = permutation.size();
+    permutation << start;
+    while(head < permutation.size()) {
+      int cur = permutation[head++];
+      QVector<int> next;
+      for(int n : neighbours[cur]) {
+        if(! visited[n]) {
+          visited[n] = true;
+          next << n;
+        }
+      }
+      std::stable_sort(next.begin(), next.end(), byDegree);
+      permutation += next;
+    }
+  }
+  // ... reversed, which gives in general a smaller envelope.
+  std::reverse(permutation.begin(), permutation.end());
+
+  inverse.resize(size);
+  for(int i = 0; i < size; i++)
+    inverse[permutation[i]] = i;
+
+  first.resize(size);
+  for(int i = 0; i < size; i++) {
+    int f = i;
+    for(int n : neighbours[permutation[i]])
+      f = std::min(f, inverse[n]);
+    first[i] = f;
+  }
+
+  offsets.resize(size);
+  int total = 0;
+  for(int i = 0; i < size; i++) {
+    offsets[i] = total;
+    total += i - first[i];
+  }
+  lower.fill(0, total);
+  upper.fill(0, total);
+  diagonal.fill(0, size);
+}
+
+int SparseLU::envelopeSize() const
+{
+  return lower.size() + upper.size() + diagonal.size();
+}
+
+void SparseLU::clear()
+{
+  lower.fill(0);
+  upper.fill(0);
+  diagonal.fill(0);
+}
+
+double * SparseLU::element(int row, int col)
+{
+  if(row == col)
+    return diagonal.data() + row;
+  if(col < row) {
+    if(col < first[row])
+      return NULL;
+    return lower.data() + offsets[row] + col - first[row];
+  }
+  if(row < first[col])
+    return NULL;
+  return upper.data() + offsets[col] + row - first[col];
+}
+
+void SparseLU::add(int row, int col, double value)
+{
+  double * e = element(inverse[row], inverse[col]);
+  if(! e)
+    throw InternalError("Element (%1, %2) is not part of the sparse matrix").
+      arg(row).arg(col);
+  *e += value;
+}
+
+bool SparseLU::decompose()
+{
+  double norm = 0;
+  for(double v : lower)
+    norm = std::max(norm, fabs(v));
+  for(double v : upper)
+    norm = std::max(norm, fabs(v));
+  for(double v : diagonal)
+    norm = std::max(norm, fabs(v));
+
+  double * l = lower.data();
+  double * u = upper.data();
+
+  // Doolittle scheme: at step k, we compute the column k of U and
+  // the row k of L, which only depend on the previous ones.
+  for(int k = 0; k < size; k++) {
+    int fk = first[k];
+    int ok = offsets[k] - fk;   // l[ok + j] is L(k,j), u[ok + i] is U(i,k)
+    for(int i = fk; i < k; i++) {
+      int fi = first[i];
+      int oi = offsets[i] - fi;
+      double su = u[ok + i];
+      double sl = l[ok + i];
+      for(int m = std::max(fi, fk); m < i; m++) {
+        su -= l[oi + m] * u[ok + m];
+        sl -= l[ok + m] * u[oi + m];
+      }
+      u[ok + i] = su;
+      l[ok + i] = sl/diagonal[i];
+    }
+    double d = diagonal[k];
+    for(int m = fk; m < k; m++)
+      d -= l[ok + m] * u[ok + m];
+    if(! std::isfinite(d) || fabs(d) <= GSL_DBL_EPSILON * norm)
+      return false;
+    diagonal[k] = d;
+  }
+  return true;
+}
+
+void SparseLU::solve(double * b) const
+{
+  QVarLengthArray<double, 512> x(size);
+  for(int k = 0; k < size; k++)
+    x[k] = b[permutation[k]];
+
+  const double * l = lower.constData();
+  const double * u = upper.constData();
+
+  // Forward substitution with L
+  for(int k = 0; k < size; k++) {
+    int ok = offsets[k] - first[k];
+    double s = x[k];
+    for(int j = first[k]; j < k; j++)
+      s -= l[ok + j] * x[j];
+    x[k] = s;
+  }
+
+  // Backward substitution with U, column by column
+  for(int k = size - 1; k >= 0; k--) {
+    int ok = offsets[k] - first[k];
+    double xk = x[k]/diagonal[k];
+    x[k] = xk;
+    for(int i = first[k]; i < k; i++)
+      x[i] -= u[ok + i] * xk;
+  }
+
+  for(int k = 0; k < size; k++)
+    b[permutation[k]] = x[k];
+}
@@ -0,0 +1,104 @@
+/**
+   \file sparselu.hh
+   The SparseLU class, a LU decomposition for sparse matrices
+   Copyright 2021 by CNRS/AMU
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <headers.hh>
+#ifndef __SPARSELU_HH
+#define __SPARSELU_HH
+
+/// SparseLU is a square matrix with a fixed sparsity pattern, that
+/// can be decomposed in place into L U (with L unit lower triangular)
+/// to solve A x = b.
+///
+/// The matrix is stored in "envelope" (or skyline) form: for each
+/// row (and each column), only the elements between the first
+/// non-zero one and the diagonal are stored. The fill-in of the LU
+/// decomposition stays within the envelope, so that no memory
+/// allocation is needed at decomposition time. To keep the envelope
+/// small, the rows and columns are first reordered using the reverse
+/// Cuthill-McKee algorithm, applied to the symmetrized pattern.
+///
+/// The decomposition is done without pivoting, which is fine for the
+/// matrices this class is designed for, i.e. I - h J for the
+/// jacobian J of kinetic systems, which are diagonally dominant.
+/// decompose() returns false if a pivot is too small.
+class SparseLU {
+  /// The size of the matrix
+  int size;
+
+  /// The reordering: permutation[new] = old
+  QVector<int> permutation;
+
+  /// The inverse reordering: inverse[old] = new
+  QVector<int> inverse;
+
+  /// The index of the first element of the envelope for each row
+  /// (or column) in the new ordering.
+  QVector<int> first;
+
+  /// The offset of the row (or column) in the lower and upper
+  /// arrays
+  QVector<int> offsets;
+
+  /// The lower part of the envelope, stored by rows
+  QVector<double> lower;
+
+  /// The upper part of the envelope, stored by columns
+  QVector<double> upper;
+
+  /// The diagonal
+  QVector<double> diagonal;
+
+  /// Returns a pointer to the element at the given row and column (in
+  /// the new ordering), or NULL if it is outside of the envelope.
+  double * element(int row, int col);
+
+public:
+  /// Builds a matrix with the given pattern: \a pattern[j] is the
+  /// list of the rows i for which the element (i, j) can be
+  /// non-zero. The diagonal is always part of the pattern.
+  explicit SparseLU(const QVector<QVector<int> > & pattern);
+
+  /// The size of the matrix
+  int dimension() const {
+    return size;
+  };
+
+  /// The number of elements stored, including the diagonal.
+  int envelopeSize() const;
+
+  /// Sets all the elements to 0
+  void clear();
+
+  /// Adds \a value to the element at the given row and column (in
+  /// the original ordering).
+  ///
+  /// Raises an InternalError if the element is outside of the
+  /// pattern given to the constructor.
+  void add(int row, int col, double value);
+
+  /// Decomposes the matrix in place. Returns false if the
+  /// decomposition failed because of a too small pivot.
+  bool decompose();
+
+  /// Solves A x = b in place, i.e. \a b holds x on exit. Only valid
+  /// after a successful decompose().
+  void solve(double * b) const;
+};
+
+#endif
@@ -395,53 +395,101 @@ Statistics::~Statistics()
     delete segs[i];
 }
 
-void Statistics::internalStats(ValueHash * overall, 
-                               QList<ValueHash> * byColumn,
-                               bool useNames)
+QList<QVariant> Statistics::values(const StatisticsValue * stat,
+                                   int col) const
 {
-  // We first sort the stats between global and not
+  // The global stats are cheap, and may depend on things that don't
+  // invalidate the cache, like the name.
+  if(col < 0)
+    return stat->values(source, col);
+
+  QPair<const StatisticsValue *, int> key(stat, col);
+  {
+    QMutexLocker l(&DataSet::cacheMutex);
+    QHash<QPair<const StatisticsValue *, int>, QList<QVariant> >::
+      const_iterator it = source->cache.statistics.constFind(key);
+    if(it != source->cache.statistics.constEnd())
+      return it.value();
+  }
+
+  // Computed outside of the lock, two threads may compute the same
+  // value, which is harmless.
+  QList<QVariant> rv = stat->values(source, col);
+  QMutexLocker l(&DataSet::cacheMutex);
+  source->cache.statistics[key] = rv;
+  return rv;
+}
+
+QList<Statistics::Entry> Statistics::entries(bool useNames) const
+{
+  QList<Entry> rv;
   if(! StatisticsValue::allStats)
-    return;
-  QList<StatisticsValue*> globalStats;
+    return rv;
+
+  // We first sort the stats between global and not
   QList<StatisticsValue*> localStats;
   for(int i = 0; i < StatisticsValue::allStats->size(); i++) {
     StatisticsValue * v = StatisticsValue::allStats->value(i);
-    if(v->global())
-      globalStats << v;
+    if(v->global()) {
+      if(v->available(source, -1)) {
+        QStringList ns = v->suffixes();
+        for(int j = 0; j < ns.size(); j++)
+          rv << Entry(ns[j], v, -1, j);
+      }
+    }
     else
       localStats << v;
   }
-  
-  // This is the real job.
-  /// @todo Cache this ? 
-  if(overall) {
-    for(int i = 0; i < globalStats.size(); i++) {
-      StatisticsValue * v = globalStats[i];
-      if(v->available(source, -1))
-        overall->multiAdd(v->suffixes(), v->values(source, -1));
-    }
-  }
 
   QStringList names = useNames ?
     source->mainColumnNames()
     : source->standardColumnNames();
   for(int i = 0; i < source->nbColumns(); i++) {
-    const QString & n = names[i];
-    ValueHash stats;
-
     for(int j = 0; j < localStats.size(); j++) {
       StatisticsValue * v = localStats[j];
       if(v->available(source, i)) {
         QStringList ns = v->suffixes();
-        ns.replaceInStrings(QRegExp("^"), n + "_");
-        stats.multiAdd(ns, v->values(source, i));
+        for(int k = 0; k < ns.size(); k++)
+          rv << Entry(names[i] + "_" + ns[k], v, i, k);
       }
     }
+  }
+  return rv;
+}
+
+void Statistics::internalStats(ValueHash * overall, 
+                               QList<ValueHash> * byColumn,
+                               bool useNames)
+{
+  QList<Entry> ents = entries(useNames);
+  QList<ValueHash> cols;
+  for(int i = 0; i < source->nbColumns(); i++)
+    cols << ValueHash();
+
+  // The entries of a given stat and column are contiguous, so we
+  // compute the values only when that changes
+  const StatisticsValue * cur = NULL;
+  int curCol = -2;
+  QList<QVariant> vals;
+  for(const Entry & e : ents) {
+    if(e.stat != cur || e.column != curCol) {
+      cur = e.stat;
+      curCol = e.column;
+      vals = values(cur, curCol);
+    }
+    if(e.column < 0) {
+      if(overall)
+        overall->append(e.name, vals.value(e.index));
+    }
+    else
+      cols[e.column].append(e.name, vals.value(e.index));
+  }
 
+  for(int i = 0; i < cols.size(); i++) {
     if(byColumn)
-      *byColumn << stats;
+      *byColumn << cols[i];
     if(overall)
-      overall->merge(stats);
+      overall->merge(cols[i]);
   }
 }
 
@@ -453,6 +501,49 @@ ValueHash Statistics::stats(bool useNames)
 }
 
 
+ValueHash Statistics::selectedStats(const QStringList & names,
+                                     bool useNames)
+{
+  QList<Entry> ents = entries(useNames);
+  QHash<QString, int> indices;
+  for(int i = 0; i < ents.size(); i++)
+    indices[ents[i].name] = i;
+
+  ValueHash ret;
+  for(const QString & n : names) {
+    if(! indices.contains(n))
+      continue;
+    const Entry & e = ents[indices[n]];
+    ret << n << values(e.stat, e.column).value(e.index);
+  }
+  return ret;
+}
+
+bool Statistics::namedStats(const QString & name, ValueHash * target,
+                            bool useNames)
+{
+  QList<Entry> ents = entries(useNames);
+  for(const Entry & e : ents) {
+    if(e.name != name)
+      continue;
+    QList<QVariant> vals = values(e.stat, e.column);
+    for(const Entry & o : ents) {
+      if(o.stat == e.stat && o.column == e.column)
+        target->append(o.name, vals.value(o.index));
+    }
+    return true;
+  }
+  return false;
+}
+
+QStringList Statistics::statsNames(bool useNames) const
+{
+  QStringList ret;
+  for(const Entry & e : entries(useNames))
+    ret << e.name;
+  return ret;
+}
+
 QList<ValueHash> Statistics::statsByColumns(ValueHash * overall, bool useNames)
 {
   QList<ValueHash> ret;
@@ -504,3 +595,176 @@ mrb_value Statistics::toRuby(bool useNames)
   }
   return hsh;
 }
+
+//////////////////////////////////////////////////////////////////////
+// Lazy statistics for Ruby
+
+#include <guarded.hh>
+#include <exceptions.hh>
+
+#include <mruby/data.h>
+#include <mruby/class.h>
+#include <mruby/variable.h>
+
+/// The dataset (and options) a LazyStats object refers to.
+class LazyStatsSource {
+public:
+  /// The dataset, that may be deleted before the Ruby object is
+  /// garbage-collected.
+  ConstGuardedPointer<DataSet> dataset;
+
+  /// Whether the real column names are used
+  bool useNames;
+
+  LazyStatsSource(const DataSet * ds, bool un) :
+    dataset(ds), useNames(un) {;};
+};
+
+static void ls_free(mrb_state * /*mrb*/, void * p)
+{
+  LazyStatsSource * src = static_cast<LazyStatsSource *>(p);
+  delete src;
+}
+
+static const struct mrb_data_type ls_data_type = {
+  "lazy-stats-source", ls_free,
+};
+
+static struct RClass * cLazyStats = NULL;
+static struct RClass * cLazyStatsSource = NULL;
+
+static const DataSet * ls_dataset(mrb_state * mrb, mrb_value self,
+                                  bool * useNames)
+{
+  mrb_value v = mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@__source__"));
+  if(mrb_nil_p(v))
+    return NULL;
+  LazyStatsSource * src =
+    static_cast<LazyStatsSource *>(mrb_data_get_ptr(mrb, v, &ls_data_type));
+  if(! src)
+    return NULL;
+  *useNames = src->useNames;
+  return src->dataset.target();
+}
+
+/// Computes the value for the given key and stores it in the hash,
+/// along with the other values computed at the same time.
+static mrb_value ls_compute(MRuby * mr, mrb_value self, const DataSet * ds,
+                            bool useNames, mrb_value key)
+{
+  // Segments
+  if(mrb_fixnum_p(key) || mrb_float_p(key)) {
+    int idx = mrb_fixnum_p(key) ? (int) mrb_fixnum(key) :
+      (int) mrb_float(key);
+    if(mrb_float_p(key) && mrb_float(key) != idx)
+      return mrb_nil_value();
+    if(idx < 0 || idx > ds->segments.size())
+      return mrb_nil_value();
+    ValueHash s;
+    if(ds->segments.size() > 0) {
+      QList<DataSet *> segs = ds->chopIntoSegments();
+      try {
+        Statistics st(segs[idx]);
+        s = st.stats(useNames);
+      }
+      catch(...) {
+        qDeleteAll(segs);
+        throw;
+      }
+      qDeleteAll(segs);
+    }
+    else {
+      Statistics st(ds);
+      s = st.stats(useNames);
+    }
+    mrb_value v = s.toRuby();
+    mr->hashSet(self, key, v);
+    return v;
+  }
+
+  if(! mrb_string_p(key))
+    return mrb_nil_value();
+
+  QString name = mr->toQString(key);
+  Statistics st(ds);
+  ValueHash group;
+  if(! st.namedStats(name, &group, useNames))
+    return mrb_nil_value();
+  
+  mrb_value rv = mrb_nil_value();
+  for(const QString & k : group.keys()) {
+    mrb_value v = ValueHash::variantToRuby(group[k]);
+    mr->hashSet(self, mr->fromQString(k), v);
+    if(k == name)
+      rv = v;
+  }
+  return rv;
+}
+
+static mrb_value ls_fetch(mrb_state * mrb, mrb_value self)
+{
+  mrb_value key;
+  mrb_get_args(mrb, "o", &key);
+
+  bool useNames = false;
+  const DataSet * ds = ls_dataset(mrb, self, &useNames);
+  if(! ds)
+    mrb_raise(mrb, mrb->eStandardError_class,
+              "The dataset these statistics refer to no longer exists");
+
+  QByteArray error;
+  mrb_value rv = mrb_nil_value();
+  try {
+    rv = ls_compute(MRuby::ruby(), self, ds, useNames, key);
+  }
+  catch(const Exception & er) {
+    error = er.message().toLocal8Bit();
+  }
+  if(! error.isEmpty())
+    mrb_raise(mrb, mrb->eStandardError_class, error.constData());
+  return rv;
+}
+
+static mrb_value ls_keys(mrb_state * mrb, mrb_value self)
+{
+  bool useNames = false;
+  const DataSet * ds = ls_dataset(mrb, self, &useNames);
+  if(! ds)
+    mrb_raise(mrb, mrb->eStandardError_class,
+              "The dataset these statistics refer to no longer exists");
+
+  MRuby * mr = MRuby::ruby();
+  Statistics st(ds);
+  mrb_value rv = mr->arrayFromStringList(st.statsNames(useNames));
+  for(int i = 0; i <= ds->segments.size(); i++) {
+    mr->arrayPush(rv, mr->newInt(i));
+    mr->arrayPush(rv, mr->newFloat(i));
+  }
+  return rv;
+}
+
+mrb_value Statistics::lazyRuby(const DataSet * ds, bool useNames)
+{
+  MRuby * mr = MRuby::ruby();
+  mrb_state * mrb = mr->mrb;
+  if(! cLazyStats) {
+    struct RClass * base = mrb_class_ptr(mr->getConstant("LazyHash"));
+    cLazyStats = mrb_define_class(mrb, "LazyStats", base);
+    mrb_define_method(mrb, cLazyStats, "__fetch__",
+                      &::ls_fetch, MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, cLazyStats, "__keys__",
+                      &::ls_keys, MRB_ARGS_NONE());
+
+    cLazyStatsSource = mrb_define_class(mrb, "LazyStatsSource",
+                                        mrb->object_class);
+    MRB_SET_INSTANCE_TT(cLazyStatsSource, MRB_TT_DATA);
+  }
+
+  MRubyArenaContext c(mr);
+  mrb_value rv = mrb_funcall(mrb, mrb_obj_value(cLazyStats), "new", 0);
+  LazyStatsSource * src = new LazyStatsSource(ds, useNames);
+  mrb_value sv = mrb_obj_value(Data_Wrap_Struct(mrb, cLazyStatsSource,
+                                                &ls_data_type, src));
+  mrb_iv_set(mrb, rv, mrb_intern_lit(mrb, "@__source__"), sv);
+  return rv;
+}
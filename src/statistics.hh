@@ -75,6 +75,10 @@ public:
 };
 
 /// Provides various statistics about a dataset.
+///
+/// The values of the column statistics are cached in the DataSet, so
+/// that they are computed only once as long as the dataset is not
+/// modified.
 class Statistics {
   /// The original dataset
   const DataSet * source;
@@ -83,6 +87,33 @@ class Statistics {
   /// source.
   QList<DataSet *> segs;
 
+  /// Locates a single statistics value
+  class Entry {
+  public:
+    /// The name of the value, i.e. the key in the hash
+    QString name;
+
+    /// The statistics object computing it
+    const StatisticsValue * stat;
+
+    /// The column (-1 for global stats)
+    int column;
+
+    /// The index in the values() of the stat object
+    int index;
+
+    Entry(const QString & n, const StatisticsValue * s, int c, int i) :
+      name(n), stat(s), column(c), index(i) {;};
+  };
+
+  /// Returns all the statistics entries available for the source, in
+  /// the order in which they appear in stats().
+  QList<Entry> entries(bool useNames) const;
+
+  /// Returns the values of the given stat for the given column,
+  /// using the cache of the dataset for column stats.
+  QList<QVariant> values(const StatisticsValue * stat, int col) const;
+
   /// Computes the statistics and store them in the given pointers
   /// (that may be NULL)
   void internalStats(ValueHash * overall, 
@@ -108,10 +139,28 @@ public:
                                    bool useNames = false);
 
 
+  /// Returns only the named statistics (in the order given). Only
+  /// the statistics needed are computed.
+  ValueHash selectedStats(const QStringList & names, bool useNames = false);
+
+  /// Computes the named statistics, along with all those computed
+  /// together with it (e.g. y_max with y_min), and stores them in @a
+  /// target. Returns false if there is no such statistics.
+  bool namedStats(const QString & name, ValueHash * target,
+                  bool useNames = false);
+
+  /// Returns the names of all the stats, in the same order as stats().
+  QStringList statsNames(bool useNames = false) const;
+
   /// Returns a Ruby hash containing the statistics (including
   /// sub-hashes containing stats by segments when applicable)
   mrb_value toRuby(bool useNames = false);
-  
+
+  /// Returns a Ruby hash that behaves like the one returned by
+  /// toRuby(), but in which the values are only computed when they
+  /// are accessed.
+  static mrb_value lazyRuby(const DataSet * ds, bool useNames = false);
+
 };
 
 #endif
@@ -0,0 +1,349 @@
+/*
+  taskscheduler.cc: implementation of the task scheduler
+  Copyright 2021 by CNRS/AMU
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <headers.hh>
+#include <taskscheduler.hh>
+
+#include <settings-templates.hh>
+#include <commandlineparser.hh>
+#include <exceptions.hh>
+#include <debug.hh>
+
+#include <QElapsedTimer>
+
+static SettingsValue<int> threadsSetting("general/threads", 0,
+                                         "number of worker threads, 0 or negative to use the number of cores minus that number");
+
+int TaskScheduler::requestedThreads = 0;
+
+static CommandLineOption thr("--threads", [](const QStringList & args) {
+    bool ok;
+    int nb = args[0].toInt(&ok);
+    if(! ok || nb < 1)
+      throw RuntimeError("Invalid number of threads: '%1'").arg(args[0]);
+    TaskScheduler::scheduler()->setThreadNumber(nb);
+  }, 1, "number of worker threads");
+
+
+/// The index+1 of the worker of the current thread, 0 if not a worker.
+static QThreadStorage<int> workerIndex;
+
+class TaskWorker : public QThread {
+public:
+  TaskScheduler * scheduler;
+
+  int index;
+
+  /// The queue of tasks of this worker
+  QList<TaskScheduler::Task *> tasks;
+
+  /// Protects the queue
+  QMutex mutex;
+
+  TaskWorker(TaskScheduler * s, int idx) : scheduler(s), index(idx) {
+  };
+
+  void run() override {
+    workerIndex.setLocalData(index + 1);
+    while(true) {
+      TaskScheduler::Task * t = scheduler->grab(index);
+      if(t) {
+        scheduler->execute(t);
+        continue;
+      }
+      QMutexLocker l(&scheduler->sleepMutex);
+      if(scheduler->stopping)
+        return;
+      if(scheduler->queued.load() > 0)
+        continue;
+      scheduler->wakeUp.wait(&scheduler->sleepMutex);
+    }
+  };
+};
+
+TaskScheduler * TaskScheduler::theScheduler = NULL;
+
+TaskScheduler::TaskScheduler() :
+  queued(0), stopping(false), nextQueue(0)
+{
+}
+
+TaskScheduler::~TaskScheduler()
+{
+  stopWorkers();
+}
+
+TaskScheduler * TaskScheduler::scheduler()
+{
+  if(! theScheduler)
+    theScheduler = new TaskScheduler;
+  return theScheduler;
+}
+
+void TaskScheduler::shutdown()
+{
+  if(theScheduler)
+    theScheduler->stopWorkers();
+}
+
+int TaskScheduler::currentWorker()
+{
+  if(! workerIndex.hasLocalData())
+    return -1;
+  return workerIndex.localData() - 1;
+}
+
+int TaskScheduler::threadNumber() const
+{
+  int nb = requestedThreads;
+  if(nb <= 0) {
+    nb = threadsSetting;
+    if(nb <= 0)
+      nb += QThread::idealThreadCount();
+  }
+  if(nb < 1)
+    nb = 1;
+  return nb;
+}
+
+void TaskScheduler::setThreadNumber(int nb)
+{
+  stopWorkers();
+  requestedThreads = nb;
+}
+
+void TaskScheduler::ensureStarted()
+{
+  {
+    QReadLocker l(&workersLock);
+    if(workers.size() > 0)
+      return;
+  }
+  QMutexLocker l(&lifecycleMutex);
+  QWriteLocker l2(&workersLock);
+  if(workers.size() > 0)
+    return;
+  int nb = threadNumber();
+  // One thread means no workers, we just run the tasks in the
+  // calling thread.
+  if(nb == 1)
+    return;
+  {
+    QMutexLocker l3(&sleepMutex);
+    stopping = false;
+  }
+  for(int i = 0; i < nb; i++)
+    workers << new TaskWorker(this, i);
+  for(TaskWorker * w : workers)
+    w->start();
+  if(Debug::debugLevel() > 0)
+    Debug::debug() << "Started " << nb << " worker threads" << endl;
+}
+
+void TaskScheduler::stopWorkers()
+{
+  QMutexLocker l(&lifecycleMutex);
+  QList<TaskWorker *> old;
+  {
+    // From now on, submit() and grab() don't see the workers anymore
+    QWriteLocker l2(&workersLock);
+    old.swap(workers);
+  }
+  if(old.size() == 0)
+    return;
+  {
+    QMutexLocker l2(&sleepMutex);
+    stopping = true;
+    wakeUp.wakeAll();
+  }
+  for(TaskWorker * w : old) {
+    w->wait();
+    // There should not be any task left, but still
+    for(Task * t : w->tasks)
+      execute(t);
+    delete w;
+  }
+  queued.store(0);
+}
+
+bool TaskScheduler::submit(Task * task)
+{
+  QReadLocker rl(&workersLock);
+  if(workers.size() == 0)
+    return false;
+  int idx = currentWorker();
+  if(idx < 0 || idx >= workers.size())
+    idx = (nextQueue.fetchAndAddRelaxed(1) & 0x7FFFFFFF) % workers.size();
+  TaskWorker * w = workers[idx];
+  {
+    QMutexLocker l(&w->mutex);
+    w->tasks.append(task);
+  }
+  queued.ref();
+  QMutexLocker l(&sleepMutex);
+  wakeUp.wakeOne();
+  return true;
+}
+
+TaskScheduler::Task * TaskScheduler::grab(int worker)
+{
+  if(queued.load() <= 0)
+    return NULL;
+  QReadLocker rl(&workersLock);
+  int nb = workers.size();
+  if(worker >= 0 && worker < nb) {
+    TaskWorker * w = workers[worker];
+    QMutexLocker l(&w->mutex);
+    if(w->tasks.size() > 0) {
+      queued.deref();
+      return w->tasks.takeLast();
+    }
+  }
+  // Steal from the others, starting from the next one
+  for(int i = 1; i <= nb; i++) {
+    TaskWorker * w = workers[(worker + i + nb) % nb];
+    QMutexLocker l(&w->mutex);
+    if(w->tasks.size() > 0) {
+      queued.deref();
+      return w->tasks.takeFirst();
+    }
+  }
+  return NULL;
+}
+
+void TaskScheduler::execute(Task * task)
+{
+  QElapsedTimer timer;
+  timer.start();
+  std::exception_ptr exc;
+  try {
+    task->function();
+  }
+  catch(...) {
+    exc = std::current_exception();
+  }
+  qint64 elapsed = timer.nsecsElapsed();
+  {
+    QMutexLocker l(&timingsMutex);
+    Timing & t = timings[task->group->name];
+    t.number += 1;
+    t.total += elapsed;
+    if(elapsed > t.longest)
+      t.longest = elapsed;
+  }
+  task->group->taskDone(exc);
+  delete task;
+}
+
+QHash<QString, TaskScheduler::Timing> TaskScheduler::taskTimings()
+{
+  QMutexLocker l(&timingsMutex);
+  return timings;
+}
+
+void TaskScheduler::clearTimings()
+{
+  QMutexLocker l(&timingsMutex);
+  timings.clear();
+}
+
+//////////////////////////////////////////////////////////////////////
+
+TaskGroup::TaskGroup(const QString & n, int mc) :
+  name(n), maxConcurrent(mc), pending(0), running(0)
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+  try {
+    wait();
+  }
+  catch(...) {
+    // Can't throw from a destructor
+  }
+}
+
+void TaskGroup::taskDone(std::exception_ptr exc)
+{
+  TaskScheduler::Task * next = NULL;
+  {
+    QMutexLocker l(&mutex);
+    if(exc && ! exception)
+      exception = exc;
+    --running;
+    if(held.size() > 0) {
+      next = held.takeFirst();
+      ++running;
+    }
+    --pending;
+    if(pending == 0)
+      done.wakeAll();
+  }
+  // The group is still alive, since next is pending.
+  if(next) {
+    TaskScheduler * s = TaskScheduler::scheduler();
+    if(! s->submit(next))
+      s->execute(next);
+  }
+}
+
+void TaskGroup::run(const TaskScheduler::Function & function)
+{
+  TaskScheduler * s = TaskScheduler::scheduler();
+  s->ensureStarted();
+  TaskScheduler::Task * t = new TaskScheduler::Task(function, this);
+  {
+    QMutexLocker l(&mutex);
+    ++pending;
+    if(maxConcurrent > 0 && running >= maxConcurrent) {
+      held << t;
+      return;
+    }
+    ++running;
+  }
+  if(! s->submit(t))
+    s->execute(t);
+}
+
+void TaskGroup::wait()
+{
+  TaskScheduler * s = TaskScheduler::scheduler();
+  int idx = TaskScheduler::currentWorker();
+  while(true) {
+    {
+      QMutexLocker l(&mutex);
+      if(pending == 0)
+        break;
+    }
+    // We help while there are tasks to run
+    TaskScheduler::Task * t = s->grab(idx);
+    if(t) {
+      s->execute(t);
+      continue;
+    }
+    QMutexLocker l(&mutex);
+    if(pending > 0)
+      done.wait(&mutex);
+  }
+  if(exception) {
+    std::exception_ptr exc = exception;
+    exception = std::exception_ptr();
+    std::rethrow_exception(exc);
+  }
+}
@@ -0,0 +1,230 @@
+/**
+   \file taskscheduler.hh
+   A process-wide, persistent, work-stealing pool of worker threads
+   Copyright 2021 by CNRS/AMU
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <headers.hh>
+#ifndef __TASKSCHEDULER_HH
+#define __TASKSCHEDULER_HH
+
+#include <exception>
+#include <QAtomicInt>
+
+class TaskGroup;
+class TaskWorker;
+
+/// The process-wide scheduler. It holds a number of worker threads
+/// that are started the first time a task is submitted and live
+/// until shutdown() is called, or until the number of threads is
+/// changed.
+///
+/// Each worker has its own queue of tasks. Workers pick the most
+/// recent task from their own queue, and steal the oldest tasks from
+/// the other queues when their queue is empty. Idle workers sleep
+/// until a task is submitted.
+///
+/// Tasks are always submitted through a TaskGroup, which is used to
+/// wait for their completion.
+class TaskScheduler {
+public:
+  typedef std::function<void ()> Function;
+
+  /// A task waiting for execution.
+  class Task {
+  public:
+    Function function;
+    TaskGroup * group;
+
+    Task(const Function & f, TaskGroup * g) : function(f), group(g) {
+    };
+  };
+
+  /// Timing information about all the tasks sharing the same name.
+  class Timing {
+  public:
+    /// Number of tasks run
+    qint64 number;
+
+    /// Total time spent, in nanoseconds
+    qint64 total;
+
+    /// Longest task, in nanoseconds
+    qint64 longest;
+
+    Timing() : number(0), total(0), longest(0) {
+    };
+  };
+
+protected:
+  friend class TaskWorker;
+  friend class TaskGroup;
+
+  /// The workers
+  QList<TaskWorker *> workers;
+
+  /// Protects the access to the workers list
+  QReadWriteLock workersLock;
+
+  /// Serializes the creation and destruction of the workers. It is
+  /// held while the workers finish, whereas workersLock is not, since
+  /// the workers need it to finish their tasks.
+  QMutex lifecycleMutex;
+
+  /// The mutex used by the workers to go to sleep
+  QMutex sleepMutex;
+
+  /// The condition on which idle workers wait
+  QWaitCondition wakeUp;
+
+  /// The number of tasks currently waiting in the queues
+  QAtomicInt queued;
+
+  /// Set when the workers should exit.
+  bool stopping;
+
+  /// The queue in which the next task submitted from outside of a
+  /// worker thread will go.
+  QAtomicInt nextQueue;
+
+  /// Timings, indexed by task name.
+  QHash<QString, Timing> timings;
+
+  /// Protects timings
+  QMutex timingsMutex;
+
+  /// The number of threads requested using setThreadNumber() (for
+  /// instance through the --threads command-line option), or 0 if
+  /// the general/threads setting should be used.
+  static int requestedThreads;
+
+  /// The global scheduler
+  static TaskScheduler * theScheduler;
+
+  TaskScheduler();
+
+  /// Makes sure the workers are running.
+  void ensureStarted();
+
+  /// Stops all the workers, and waits for them to finish.
+  void stopWorkers();
+
+  /// Queues the task. Returns false if there are no workers, in
+  /// which case the caller must run the task itself.
+  bool submit(Task * task);
+
+  /// Takes a task, first from the worker @a worker (from the end),
+  /// then from the others (from the beginning). @a worker can be -1.
+  ///
+  /// Returns NULL if there are no tasks anywhere.
+  Task * grab(int worker);
+
+  /// Runs the given task, and deletes it.
+  void execute(Task * task);
+
+public:
+
+  ~TaskScheduler();
+
+  /// Returns the global scheduler
+  static TaskScheduler * scheduler();
+
+  /// Stops the threads of the global scheduler, if there is one.
+  static void shutdown();
+
+  /// Returns the index of the worker the current thread is, or -1 if
+  /// the current thread is not a worker thread.
+  static int currentWorker();
+
+  /// The number of worker threads the scheduler uses (or will use
+  /// when started).
+  int threadNumber() const;
+
+  /// Sets the number of threads, overriding the general/threads
+  /// setting. 0 reverts to using the setting.
+  ///
+  /// This stops the current workers, so it must not be called while
+  /// tasks are running.
+  void setThreadNumber(int nb);
+
+  /// Returns the timings accumulated so far.
+  QHash<QString, Timing> taskTimings();
+
+  /// Clears the timings
+  void clearTimings();
+
+};
+
+/// A group of tasks one can wait for.
+///
+/// The group waits for all its tasks upon destruction. The first
+/// exception thrown by a task is stored and thrown again by wait().
+///
+/// The number of tasks of the group running at the same time can be
+/// limited, regardless of the number of threads of the scheduler: the
+/// tasks over the limit are only handed to the scheduler when
+/// the previous ones finish.
+class TaskGroup {
+protected:
+  friend class TaskScheduler;
+
+  /// The name of the group, used for timing
+  QString name;
+
+  /// The maximum number of tasks running concurrently, or 0 for no
+  /// limit.
+  int maxConcurrent;
+
+  /// The number of tasks not finished yet
+  int pending;
+
+  /// The number of tasks handed to the scheduler and not finished
+  /// yet
+  int running;
+
+  /// The tasks held back because of maxConcurrent
+  QList<TaskScheduler::Task *> held;
+
+  QMutex mutex;
+
+  QWaitCondition done;
+
+  /// The first exception raised by a task.
+  std::exception_ptr exception;
+
+  /// Called by the scheduler when a task is done.
+  void taskDone(std::exception_ptr exc);
+
+public:
+  /// Creates a group. At most @a maxConcurrent of its tasks run at
+  /// the same time, 0 meaning as many as there are threads.
+  explicit TaskGroup(const QString & name, int maxConcurrent = 0);
+  ~TaskGroup();
+
+  /// Submits a task. If the scheduler has no threads, the task is
+  /// run immediately.
+  void run(const TaskScheduler::Function & function);
+
+  /// Waits for all the tasks to finish. The waiting thread runs
+  /// pending tasks while waiting.
+  ///
+  /// Throws the exception raised by a task, if any.
+  void wait();
+};
+
+
+#endif
@@ -26,13 +26,86 @@
 
 static SettingsValue<int> maxLines("command/maxlines", 1000);
 
+static SettingsValue<int> refreshInterval("command/terminal-refresh", 100,
+                                          "interval between the updates of the terminal (in milliseconds)");
+
+/// Writes text to a device from a separate thread, so that writing
+/// the log never slows down the commands.
+class LogWriter : public QThread {
+  QIODevice * device;
+
+  QMutex mutex;
+  QWaitCondition wake;
+
+  /// The text not written yet
+  QString pending;
+
+  bool done;
+
+protected:
+  virtual void run() override {
+    QTextStream out(device);
+    QMutexLocker l(&mutex);
+    while(true) {
+      while(pending.isEmpty() && ! done)
+        wake.wait(&mutex);
+      if(pending.isEmpty())
+        break;                  // done, and all written
+      QString str;
+      str.swap(pending);
+      l.unlock();
+      out << str << flush;
+      l.relock();
+    }
+  };
+
+public:
+  explicit LogWriter(QIODevice * dev) : device(dev), done(false) {
+    start();
+  };
+
+  void append(const QString & str) {
+    QMutexLocker l(&mutex);
+    pending += str;
+    wake.wakeOne();
+  };
+
+  /// Writes all the remaining text before returning.
+  virtual ~LogWriter() {
+    {
+      QMutexLocker l(&mutex);
+      done = true;
+      wake.wakeOne();
+    }
+    wait();
+    delete device;
+  };
+};
+
 Terminal Terminal::out;
 
+QThreadStorage<QStringList *> Terminal::deferredOutput;
+
+/// Whether the current thread is the GUI one (or the only one, before
+/// the application is created).
+static bool inGUIThread()
+{
+  return ! qApp || QThread::currentThread() == qApp->thread();
+}
+
 Terminal::Terminal() :
-  buffer(""), appendCursor(NULL), deleteCursor(NULL),
-  totalLines(0), deletedLines(0)
+  spyTimer(NULL),
+  pendingLines(0), displayTimer(NULL), displayScheduled(false),
+  appendCursor(NULL), deleteCursor(NULL),
+  totalLines(0), deletedLines(0), directOutput(NULL)
 {
-  internalStream = new QTextStream(&buffer);
+}
+
+Terminal::ThreadBuffer * Terminal::localBuffer()
+{
+  if(! threadBuffers.hasLocalData())
+    threadBuffers.setLocalData(new ThreadBuffer);
+  return threadBuffers.localData();
 }
 
 void Terminal::initializeCursors()
@@ -46,47 +119,70 @@ void Terminal::initializeCursors()
   appendCursor->movePosition(QTextCursor::End);
   deleteCursor = new QTextCursor(CommandWidget::theCommandWidget->
                                  terminalDisplay->document());
+
+  // Never deleted, as the terminal itself
+  displayTimer = new QTimer;
+  displayTimer->setSingleShot(true);
+  QObject::connect(displayTimer, &QTimer::timeout, [this]() {
+      flushDisplay();
+    });
 }
 
 void Terminal::flushToTerminal()
 {
+  ThreadBuffer * local = localBuffer();
+  local->stream.flush();
   /// @todo If I want to use formatting with that, I need to use
   /// QTextDocumentFragment straight from here.
-  if(buffer.size() == 0)
+  if(local->text.size() == 0)
     return;                     // nothing to do Note that it means
                                 // that you can chain format
                                 // specifiers.
+  QString buffer;
+  buffer.swap(local->text);
+  QTextCharFormat format = local->format;
+  local->format = QTextCharFormat();
+
+  if(deferredOutput.hasLocalData() && deferredOutput.localData()) {
+    if(buffer.endsWith('\n'))
+      buffer.chop(1);
+    *deferredOutput.localData() << buffer.split('\n');
+    return;
+  }
 
-  if(! soas().isHeadless()) {
-    initializeCursors();
+  bool gui = inGUIThread();
+  QMutexLocker l(&mutex);
+  if(directOutput)
+    (*directOutput) << buffer << flush;
+  else if(! soas().isHeadless()) {
+    // The display can only be set up from the GUI thread
+    if(gui)
+      initializeCursors();
     if(appendCursor) {
-      QTextEdit * edit = CommandWidget::theCommandWidget->
-        terminalDisplay;
-      appendCursor->insertText(buffer, currentFormat);
-      currentFormat = QTextCharFormat();
-    
-      totalLines += buffer.count('\n');
-
-      // Remove lines at the beginning
-      int nbdel = totalLines - (::maxLines + deletedLines);
-      if(nbdel > 200) {         // Only remove them when there is a
-                                // lot of them.
-        deleteCursor->movePosition(QTextCursor::Start);
-        deleteCursor->movePosition(QTextCursor::Down,
-                                   QTextCursor::KeepAnchor,
-                                   nbdel);
-        deleteCursor->removeSelectedText();
-        deletedLines += nbdel;
+      int nb = buffer.count('\n');
+      pendingChunks << Chunk(buffer, format, nb);
+      pendingLines += nb;
+      totalLines += nb;
+
+      // Drop the text that would be deleted just after being
+      // inserted.
+      while(pendingChunks.size() > 1 &&
+            pendingLines - pendingChunks.first().lines >= ::maxLines) {
+        int dropped = pendingChunks.takeFirst().lines;
+        pendingLines -= dropped;
+        deletedLines += dropped;
+      }
+      if(! displayScheduled) {
+        displayScheduled = true;
+        int interval = ::refreshInterval;
+        // A timer can only be started from its own thread.
+        if(gui)
+          displayTimer->start(interval);
+        else
+          QMetaObject::invokeMethod(displayTimer, "start",
+                                    Qt::QueuedConnection,
+                                    Q_ARG(int, interval));
       }
-
-
-
-      // and scroll to the bottom
-      QScrollBar * sb = edit->verticalScrollBar();
-      sb->setSliderPosition(sb->maximum());
-
-      // Always clear undo stacks, we don't need those
-      edit->document()->clearUndoRedoStacks();
     }
     else {
       QTextStream o(stdout);
@@ -94,35 +190,126 @@ void Terminal::flushToTerminal()
     }
   }
 
+  for(LogWriter * w : logWriters)
+    w->append(buffer);
+
+  if(spies.isEmpty())
+    return;
+  pendingSpyText += buffer;
+  if(gui) {
+    l.unlock();
+    writeToSpies();
+  }
+  else if(qApp) {
+    if(! spyTimer) {
+      // Created here, and handed over to the GUI thread
+      spyTimer = new QTimer;
+      spyTimer->setSingleShot(true);
+      QObject::connect(spyTimer, &QTimer::timeout, [this]() {
+          writeToSpies();
+        });
+      spyTimer->moveToThread(qApp->thread());
+    }
+    QMetaObject::invokeMethod(spyTimer, "start",
+                              Qt::QueuedConnection,
+                              Q_ARG(int, 0));
+  }
+}
+
+void Terminal::writeToSpies()
+{
+  QString str;
+  {
+    QMutexLocker l(&mutex);
+    str.swap(pendingSpyText);
+  }
+  if(str.isEmpty())
+    return;
   for(int i = 0; i < spies.size(); i++)
-    (*spies[i]) << buffer << flush;
-  
-  buffer.clear();
+    (*spies[i]) << str << flush;
+}
+
+void Terminal::flushDisplay()
+{
+  if(displayTimer)
+    displayTimer->stop();
+  if(! CommandWidget::theCommandWidget)
+    return;
+
+  // The chunks are taken out, so that other threads are not blocked
+  // while the text is inserted.
+  QList<Chunk> chunks;
+  int nbdel;
+  {
+    QMutexLocker l(&mutex);
+    displayScheduled = false;
+    if(pendingChunks.isEmpty())
+      return;
+    chunks.swap(pendingChunks);
+    pendingLines = 0;
+    nbdel = totalLines - (::maxLines + deletedLines);
+    if(nbdel > 200)
+      deletedLines += nbdel;
+  }
+
+  QTextEdit * edit = CommandWidget::theCommandWidget->terminalDisplay;
+  appendCursor->beginEditBlock();
+  for(const Chunk & c : chunks)
+    appendCursor->insertText(c.text, c.format);
+  appendCursor->endEditBlock();
+
+  // Remove lines at the beginning
+  if(nbdel > 200) {         // Only remove them when there is a
+                            // lot of them.
+    deleteCursor->movePosition(QTextCursor::Start);
+    deleteCursor->movePosition(QTextCursor::Down,
+                               QTextCursor::KeepAnchor,
+                               nbdel);
+    deleteCursor->removeSelectedText();
+  }
+
+  // and scroll to the bottom
+  QScrollBar * sb = edit->verticalScrollBar();
+  sb->setSliderPosition(sb->maximum());
+
+  // Always clear undo stacks, we don't need those
+  edit->document()->clearUndoRedoStacks();
+}
+
+void Terminal::setDirectOutput()
+{
+  if(! directOutput)
+    directOutput = new QTextStream(stdout);
 }
 
 void Terminal::setBold()
 {
-  currentFormat.setFontWeight(QFont::ExtraBold);
+  localBuffer()->format.setFontWeight(QFont::ExtraBold);
 }
 
 void Terminal::setItalic()
 {
-  currentFormat.setFontItalic(true);
+  localBuffer()->format.setFontItalic(true);
 }
 
 void Terminal::setColor(const QColor & color)
 {
-  currentFormat.setForeground(color);
+  localBuffer()->format.setForeground(color);
 }
 
 void Terminal::setBackgroundColor(const QColor & color)
 {
-  currentFormat.setBackground(color);
+  localBuffer()->format.setBackground(color);
 }
 
 void Terminal::setAlternateBackground()
 {
-  if(totalLines % 2)
+  int lines;
+  {
+    QMutexLocker l(&mutex);
+    lines = totalLines;
+  }
+  if(lines % 2)
     setBackgroundColor(QColor(210, 210, 210));
 }
 
@@ -158,6 +345,8 @@ Terminal & Terminal::alternate(Terminal & term)
 
 void Terminal::addSpy(QTextStream * spy)
 {
+  // The spy only gets the text written from now on.
+  writeToSpies();
   spies << spy;
 }
 
@@ -168,9 +357,21 @@ void Terminal::addSpy(QIODevice * spy)
   ownedDevices << spy;
 }
 
+void Terminal::addLogFile(QIODevice * device)
+{
+  QMutexLocker l(&mutex);
+  logWriters << new LogWriter(device);
+}
+
+void Terminal::removeSpy(QTextStream * spy)
+{
+  writeToSpies();
+  spies.removeAll(spy);
+}
+
 Terminal & Terminal::operator<<(QTextStreamFunction t)
 {
-  (*internalStream) << t;
+  localBuffer()->stream << t;
   if(t == endl || t == flush)
     flushToTerminal();
   return *this;
@@ -183,17 +384,34 @@ Terminal & Terminal::operator<<(Terminal & fnc(Terminal &) )
   return *this;
 }
 
+void Terminal::shutdown()
+{
+  flushToTerminal();
+  writeToSpies();
+  QList<LogWriter *> writers;
+  {
+    QMutexLocker l(&mutex);
+    writers.swap(logWriters);
+  }
+  // Deleting the writers waits for them to write all the text.
+  for(LogWriter * w : writers)
+    delete w;
+  delete spyTimer;
+  spyTimer = NULL;
+}
+
 Terminal::~Terminal()
 {
-  if(! buffer.isEmpty())
-    flushToTerminal();
   delete appendCursor;
   delete deleteCursor;
-  delete internalStream;
+  delete directOutput;
   for(QTextStream * t : spies)
     delete t;
   for(QIODevice * d : ownedDevices)
     delete d;
+  // Normally none left, see shutdown()
+  for(LogWriter * w : logWriters)
+    delete w;
 }
 
 static CommandLineOption sto("--stdout", [](const QStringList & /*args*/) {
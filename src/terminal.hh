@@ -23,28 +23,95 @@
 #ifndef __TERMINAL_HH
 #define __TERMINAL_HH
 
+class LogWriter;
+
 /// This class embeds all the interaction with the Terminal.
+///
+/// The text is not inserted into the terminal display at every
+/// flush, which would be way too slow when scripts run many commands,
+/// but accumulated and inserted at regular intervals (see
+/// flushDisplay()).
+///
+/// Text can be written from any thread (for instance, from fits
+/// running in the background). Each thread builds up its own text,
+/// which is only handed over to the terminal when flushed (by endl or
+/// flush), so that lines from different threads do not mix. The
+/// display and the spies are only ever updated from the GUI thread.
 class Terminal {
 
+  /// Protects the shared members, since the text can come from other
+  /// threads than the GUI one.
+  QMutex mutex;
+
+  /// The text being written by a given thread, until it is flushed.
+  class ThreadBuffer {
+  public:
+    QString text;
+    QTextStream stream;
+    QTextCharFormat format;
+
+    ThreadBuffer() : stream(&text) {;};
+  };
 
-  /// The internal stream used to build up the string to be forwarded
-  /// to Log.
-  QTextStream * internalStream;
+  /// The buffers of all the threads.
+  QThreadStorage<ThreadBuffer *> threadBuffers;
 
-  /// A temporary buffer string.
-  QString buffer;
+  /// Returns the buffer of the current thread.
+  ThreadBuffer * localBuffer();
 
-  /// Flushes to the terminal.
+  /// Flushes the text of the current thread to the terminal.
   void flushToTerminal();
 
   /// A list of spies, i.e. streams that get a copy of the text sent
-  /// to the terminal.
+  /// to the terminal. Only used from the GUI thread.
   QList<QTextStream *>  spies;
 
   /// A list of IO devices owned by the object. They are taken
   /// ownership of when using addSpy with a QIODevice argument
   QList<QIODevice *> ownedDevices;
 
+  /// The text not written to the spies yet.
+  QString pendingSpyText;
+
+  /// The timer that writes pendingSpyText to the spies when the text
+  /// comes from other threads. It lives in the GUI thread.
+  QTimer * spyTimer;
+
+  /// Writes the pending text to the spies. Must be called from the
+  /// GUI thread.
+  void writeToSpies();
+
+  /// The log files, written to from other threads
+  QList<LogWriter *> logWriters;
+
+  /// A piece of text waiting to be inserted into the terminal display
+  class Chunk {
+  public:
+    QString text;
+    QTextCharFormat format;
+    /// The number of lines in the text
+    int lines;
+
+    Chunk(const QString & t, const QTextCharFormat & f, int l) :
+      text(t), format(f), lines(l) {;};
+  };
+
+  /// The text waiting to be inserted into the terminal display. It
+  /// never holds much more than the maximum number of lines of the
+  /// terminal, since the older lines would be deleted anyway.
+  QList<Chunk> pendingChunks;
+
+  /// The number of lines in pendingChunks
+  int pendingLines;
+
+  /// The timer triggering the insertion of the pending text. It
+  /// lives in the GUI thread.
+  QTimer * displayTimer;
+
+  /// Whether displayTimer was started (or is about to be started)
+  /// for the current pending chunks.
+  bool displayScheduled;
+
   /// We maintain two cursors: an "append" cursor that will always be
   /// used for text insert, and a "delete" cursor that will be at the
   /// beginning, slowly deleting stuff to avoid accumulation of too
@@ -59,13 +126,15 @@ class Terminal {
   /// Sets up the cursors for the first time.
   void initializeCursors();
 
-  QTextCharFormat currentFormat;
-
   /// The total number of lines since beginning
   int totalLines;
 
   /// The number of deleted lines
   int deletedLines;
+
+  /// If not NULL, the text is written straight to that stream rather
+  /// than to the terminal display.
+  QTextStream * directOutput;
   
   
 public:
@@ -74,7 +143,7 @@ public:
   ~Terminal();
 
   template<typename T> Terminal & operator<<(const T& t) {
-    (*internalStream) << t;
+    localBuffer()->stream << t;
     return *this;
   };
 
@@ -88,9 +157,37 @@ public:
   /// Add a spy to the stream. Terminal takes ownership of the spy.
   void addSpy(QIODevice * spy);
 
+  /// Adds a device to which all the output is written, from a
+  /// separate thread, so that the commands never wait for the
+  /// writing. Terminal takes ownership of the device.
+  void addLogFile(QIODevice * device);
+
+  /// Removes the given spy, and gives back the ownership to the
+  /// caller. The text written so far is written to the spy before.
+  void removeSpy(QTextStream * spy);
+
+  /// Writes all the pending output, and stops the threads writing the
+  /// log files. To be called from the GUI thread before the
+  /// application quits.
+  void shutdown();
+
   /// An alway open TextStream
   static Terminal out;
 
+  /// When set for the current thread, the text flushed by that thread
+  /// is appended to that list (one element per line), rather than
+  /// written, so that it can be written later from the main thread.
+  static QThreadStorage<QStringList *> deferredOutput;
+
+  /// Inserts the pending text into the terminal display right now,
+  /// rather than waiting for the next refresh.
+  void flushDisplay();
+
+  /// Writes all the output directly to the standard output, without
+  /// going through the terminal display, which need not even
+  /// exist. Used by the qsoas-batch executable.
+  void setDirectOutput();
+
   /// @name Formatting functions
   ///
   /// std::endl-like manipulators
@@ -0,0 +1,250 @@
+/*
+  thumbnailcache.cc: offscreen rendering and caching of dataset thumbnails
+  Copyright 2021 by CNRS/AMU
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <headers.hh>
+#include <thumbnailcache.hh>
+
+#include <dataset.hh>
+#include <soas.hh>
+#include <graphicssettings.hh>
+#include <settings-templates.hh>
+
+static SettingsValue<int> thumbnailCacheSize("browser/thumbnail-cache-size",
+                                             64);
+
+ThumbnailCache::Key::Key(const DataSet * ds, const QSize & sz) :
+  dataset(ds), data(ds->y().constData()), rows(ds->nbRows()), size(sz)
+{
+}
+
+bool ThumbnailCache::Key::operator==(const Key & other) const
+{
+  return dataset == other.dataset && data == other.data &&
+    rows == other.rows && size == other.size;
+}
+
+uint qHash(const ThumbnailCache::Key & key)
+{
+  return qHash(key.dataset) ^ qHash(key.data) ^
+    qHash(key.rows) ^ qHash((key.size.width() << 16) ^ key.size.height());
+}
+
+ThumbnailCache::Request::Request(const Key & k) :
+  key(k), wanted(new QAtomicInt(1))
+{
+}
+
+ThumbnailCache::ThumbnailCache() :
+  nextRequest(0), jobs("thumbnails")
+{
+  // The cost is in kilobytes, the setting in megabytes
+  thumbnails.setMaxCost(thumbnailCacheSize * 1024);
+}
+
+ThumbnailCache * ThumbnailCache::cache()
+{
+  // Never deleted, since the tasks may still be running at exit
+  static ThumbnailCache * theCache = new ThumbnailCache;
+  return theCache;
+}
+
+QImage ThumbnailCache::thumbnail(const DataSet * ds, const QSize & size)
+{
+  if(! ds || size.width() < 2 || size.height() < 2)
+    return QImage();
+  Key key(ds, size);
+  QImage * img = thumbnails.object(key);
+  if(img)
+    return *img;
+  int id = pendingByKey.value(key, -1);
+  if(id >= 0)
+    pending[id].wanted->storeRelease(1);
+  else
+    submit(ds, key);
+  return QImage();
+}
+
+void ThumbnailCache::submit(const DataSet * ds, const Key & key)
+{
+  int id = nextRequest++;
+  Request rq(key);
+  pending.insert(id, rq);
+  pendingByKey[key] = id;
+
+  // The vectors are implicitly shared, so this does not copy the
+  // data, but keeps it alive even if the dataset is deleted in the
+  // meantime.
+  Vector x = ds->x();
+  Vector y = ds->y();
+  QPen pen = soas().graphicsSettings().dataSetPen(0);
+  QSharedPointer<QAtomicInt> wanted = rq.wanted;
+  QSize size = key.size;
+  jobs.run([this, id, x, y, pen, wanted, size]() {
+      QImage img;
+      if(wanted->loadAcquire())
+        img = render(x, y, size, pen);
+      QMetaObject::invokeMethod(this, "renderingDone",
+                                Qt::QueuedConnection,
+                                Q_ARG(int, id), Q_ARG(QImage, img));
+    });
+}
+
+void ThumbnailCache::renderingDone(int id, const QImage & image)
+{
+  if(! pending.contains(id))
+    return;
+  Request rq = pending.take(id);
+  pendingByKey.remove(rq.key);
+  if(image.isNull()) {
+    // Skipped, but it may have been asked for again in the meantime,
+    // in which case the views will ask again when repainting.
+    if(rq.wanted->loadAcquire())
+      emit(thumbnailReady());
+    return;
+  }
+#if QT_VERSION >= QT_VERSION_CHECK(5,10,0)
+  qint64 bytes = image.sizeInBytes();
+#else
+  qint64 bytes = image.byteCount();
+#endif
+  thumbnails.insert(rq.key, new QImage(image),
+                    qMax<qint64>(1, bytes/1024));
+  emit(thumbnailReady());
+}
+
+void ThumbnailCache::dropPending()
+{
+  for(Request & rq : pending)
+    rq.wanted->storeRelease(0);
+}
+
+QImage ThumbnailCache::render(const Vector & x, const Vector & y,
+                              const QSize & size, const QPen & pen)
+{
+  QImage img(size, QImage::Format_ARGB32_Premultiplied);
+  img.fill(Qt::white);
+
+  int nb = std::min(x.size(), y.size());
+  double xmin = 0, xmax = 0, ymin = 0, ymax = 0;
+  bool first = true;
+  for(int i = 0; i < nb; i++) {
+    if(! (std::isfinite(x[i]) && std::isfinite(y[i])))
+      continue;
+    if(first) {
+      xmin = xmax = x[i];
+      ymin = ymax = y[i];
+      first = false;
+      continue;
+    }
+    xmin = std::min(xmin, x[i]);
+    xmax = std::max(xmax, x[i]);
+    ymin = std::min(ymin, y[i]);
+    ymax = std::max(ymax, y[i]);
+  }
+  if(first)
+    return img;                 // Nothing to draw
+
+  const int margin = 3;
+  double w = size.width() - 2 * margin - 1;
+  double h = size.height() - 2 * margin - 1;
+  double sx = xmax > xmin ? w/(xmax - xmin) : 0;
+  double sy = ymax > ymin ? h/(ymax - ymin) : 0;
+
+  QPainter p(&img);
+  p.setRenderHint(QPainter::Antialiasing);
+  p.setPen(pen);
+
+  // The points are grouped in runs of consecutive points in the same
+  // pixel column, and each run is drawn as a vertical line between
+  // the extrema of the run. Non-finite values break the line.
+  QPolygonF line;
+  int col = -1;
+  double rmin = 0, rmax = 0, rlast = 0;
+  auto flushRun = [&]() {
+    if(col < 0)
+      return;
+    line << QPointF(col, rmin) << QPointF(col, rmax)
+         << QPointF(col, rlast);
+  };
+  auto flushLine = [&]() {
+    flushRun();
+    col = -1;
+    if(line.size() > 1)
+      p.drawPolyline(line);
+    line.clear();
+  };
+  for(int i = 0; i < nb; i++) {
+    if(! (std::isfinite(x[i]) && std::isfinite(y[i]))) {
+      flushLine();
+      continue;
+    }
+    int c = margin + (int) ((x[i] - xmin) * sx + 0.5);
+    double py = margin + h - (y[i] - ymin) * sy;
+    if(c != col) {
+      flushRun();
+      col = c;
+      line << QPointF(col, py);
+      rmin = rmax = py;
+    }
+    rmin = std::min(rmin, py);
+    rmax = std::max(rmax, py);
+    rlast = py;
+  }
+  flushLine();
+  return img;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+ThumbnailView::ThumbnailView(QWidget * parent) :
+  QWidget(parent), dataset(NULL)
+{
+  connect(ThumbnailCache::cache(), SIGNAL(thumbnailReady()),
+          SLOT(update()));
+}
+
+void ThumbnailView::showDataSet(const DataSet * ds)
+{
+  dataset = ds;
+  update();
+}
+
+QSize ThumbnailView::sizeHint() const
+{
+  return QSize(200, 150);
+}
+
+void ThumbnailView::paintEvent(QPaintEvent * /*event*/)
+{
+  QPainter p(this);
+  p.fillRect(rect(), Qt::white);
+  if(! dataset)
+    return;
+
+  QImage img = ThumbnailCache::cache()->thumbnail(dataset, size());
+  if(img.isNull()) {
+    p.setPen(Qt::gray);
+    p.drawText(rect(), Qt::AlignCenter, "...");
+  }
+  else
+    p.drawImage(0, 0, img);
+
+  p.setPen(Qt::black);
+  p.drawText(rect().adjusted(4, 2, -4, -2), Qt::AlignTop | Qt::AlignLeft,
+             dataset->name);
+}
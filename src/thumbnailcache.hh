@@ -0,0 +1,164 @@
+/**
+   \file thumbnailcache.hh
+   Offscreen rendering and caching of dataset thumbnails
+   Copyright 2021 by CNRS/AMU
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <headers.hh>
+#ifndef __THUMBNAILCACHE_HH
+#define __THUMBNAILCACHE_HH
+
+#include <taskscheduler.hh>
+#include <QSharedPointer>
+
+class DataSet;
+class Vector;
+
+/// A process-wide cache of small images of datasets, used when many
+/// datasets have to be displayed at the same time (think
+/// browse-stack).
+///
+/// The thumbnails are rendered offscreen into QImage by the
+/// TaskScheduler workers, from the decimated data, and the
+/// thumbnailReady() signal is emitted when they become available. The
+/// cache should only be used from the GUI thread.
+class ThumbnailCache : public QObject {
+  Q_OBJECT;
+
+public:
+  /// What identifies a thumbnail
+  class Key {
+  public:
+    /// The dataset
+    const DataSet * dataset;
+
+    /// The Y data of the dataset, to detect datasets that were
+    /// modified or reallocated at the same place.
+    const double * data;
+
+    /// The number of rows
+    int rows;
+
+    /// The size of the thumbnail
+    QSize size;
+
+    Key(const DataSet * ds, const QSize & sz);
+
+    Key() : dataset(NULL), data(NULL), rows(0) {
+    };
+
+    bool operator==(const Key & other) const;
+  };
+
+protected:
+
+  /// A request being rendered
+  class Request {
+  public:
+    /// The key of the request
+    Key key;
+
+    /// Whether the thumbnail is still wanted. Shared with the worker
+    /// thread.
+    QSharedPointer<QAtomicInt> wanted;
+
+    explicit Request(const Key & k);
+
+    Request() {
+    };
+  };
+
+  /// The rendered thumbnails. The cost is in kilobytes.
+  QCache<Key, QImage> thumbnails;
+
+  /// The requests being processed, by ID
+  QHash<int, Request> pending;
+
+  /// The ID of pending requests by key
+  QHash<Key, int> pendingByKey;
+
+  /// The ID of the next request
+  int nextRequest;
+
+  /// The tasks rendering the thumbnails.
+  TaskGroup jobs;
+
+  /// Submits the rendering of the thumbnail of the given dataset
+  void submit(const DataSet * ds, const Key & key);
+
+  ThumbnailCache();
+
+protected slots:
+
+  /// Called when the rendering of the request @a id is done. The
+  /// image is null if the rendering was skipped.
+  void renderingDone(int id, const QImage & image);
+
+public:
+
+  /// Returns the global cache
+  static ThumbnailCache * cache();
+
+  /// Returns the thumbnail of the given size for the given dataset,
+  /// or a null image if it is not available yet, in which case the
+  /// rendering is started, and thumbnailReady() will be emitted when
+  /// it is done.
+  QImage thumbnail(const DataSet * ds, const QSize & size);
+
+  /// Marks all the requests currently being processed as not wanted
+  /// anymore, unless they are asked for again using
+  /// thumbnail(). This is used to skip the rendering of thumbnails
+  /// no longer visible, for instance when browsing quickly through
+  /// many pages.
+  void dropPending();
+
+  /// Renders a thumbnail of the given size for the given data,
+  /// decimating so that each pixel column is drawn only once for
+  /// each pass of the data through it. Can be called from any thread.
+  static QImage render(const Vector & x, const Vector & y,
+                       const QSize & size, const QPen & pen);
+
+signals:
+
+  /// Emitted when a new thumbnail is available.
+  void thumbnailReady();
+
+};
+
+uint qHash(const ThumbnailCache::Key & key);
+
+/// A widget that displays a thumbnail of a dataset, using the
+/// ThumbnailCache. It is a cheap replacement for CurveView when many
+/// datasets are shown at once.
+class ThumbnailView : public QWidget {
+  Q_OBJECT;
+
+  /// The dataset displayed
+  const DataSet * dataset;
+
+protected:
+  virtual void paintEvent(QPaintEvent * event) override;
+
+public:
+  explicit ThumbnailView(QWidget * parent = NULL);
+
+  /// Shows the given dataset
+  void showDataSet(const DataSet * ds);
+
+  virtual QSize sizeHint() const override;
+};
+
+#endif
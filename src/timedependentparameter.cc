@@ -174,6 +174,27 @@ public:
     return ret;
   };
 
+  /// Each bit only contributes after its own t0.
+  double realFirstDifference(const double * a,
+                             const double * b) const override {
+    bool common = false;
+    if(mode == Common)
+      common = a[baseIndex] != b[baseIndex];
+    if(mode == Linear) {
+      int last = baseIndex + 3 + 2*(number-1);
+      common = a[baseIndex + 2] != b[baseIndex + 2] ||
+        (number > 1 && a[last] != b[last]);
+    }
+    double ret = GSL_POSINF;
+    for(int i = 0; i < number; i++) {
+      int base = baseIndex + baseFor(i);
+      if(common || a[base] != b[base] || a[base + 1] != b[base + 1] ||
+         (mode == Independent && a[base + 2] != b[base + 2]))
+        ret = std::min(ret, std::min(a[base + 1], b[base + 1]));
+    }
+    return ret;
+  };
+
 };
 
 static TimeDependentParameter::TDPFactory ex("exp", [](int nb, const QStringList & extra) -> TimeDependentParameter * {
@@ -274,6 +295,22 @@ public:
     return ret;
   };
 
+  /// Each bit only contributes after its own t0.
+  double realFirstDifference(const double * a,
+                             const double * b) const override {
+    double ret = GSL_POSINF;
+    for(int i = 0; i < number; i++) {
+      int base = baseIndex + i*5;
+      for(int j = 0; j < 5; j++) {
+        if(a[base + j] != b[base + j]) {
+          ret = std::min(ret, std::min(a[base + 1], b[base + 1]));
+          break;
+        }
+      }
+    }
+    return ret;
+  };
+
 };
 
 static TimeDependentParameter::TDPFactory biex("biexp", [](int nb, const QStringList & extra) -> TimeDependentParameter * {
@@ -355,6 +392,20 @@ public:
     return ret;
   };
 
+  /// The value of a step is only used after its time.
+  double realFirstDifference(const double * a,
+                             const double * b) const override {
+    if(a[baseIndex] != b[baseIndex])
+      return GSL_NEGINF;
+    double ret = GSL_POSINF;
+    for(int i = 1; i < number; i++) {
+      int base = baseIndex + 2*i - 1;
+      if(a[base] != b[base] || a[base + 1] != b[base + 1])
+        ret = std::min(ret, std::min(a[base], b[base]));
+    }
+    return ret;
+  };
+
 };
 
 static TimeDependentParameter::TDPFactory steps("steps", [](int nb, const QStringList & /*extra*/) -> TimeDependentParameter * {
@@ -584,6 +635,22 @@ public:
     return ret;
   };
 
+  /// The parameters of a relaxation only matter after its t0.
+  double realFirstDifference(const double * a,
+                             const double * b) const override {
+    int initial = baseIndex + (independentBits ? 0 : 1);
+    if(a[initial] != b[initial])
+      return GSL_NEGINF;
+    bool common = (! independentBits) && a[baseIndex] != b[baseIndex];
+    double ret = GSL_POSINF;
+    for(int i = 0; i < number; i++) {
+      if(common || t0(a, i) != t0(b, i) || asympt(a, i) != asympt(b, i) ||
+         tau(a, i) != tau(b, i))
+        ret = std::min(ret, std::min(t0(a, i), t0(b, i)));
+    }
+    return ret;
+  };
+
 };
 
 
@@ -704,6 +771,29 @@ Vector TimeDependentParameter::discontinuities(const double * parameters) const
     return realDiscontinuities(parameters);
 }
 
+double TimeDependentParameter::realFirstDifference(const double * a,
+                                                  const double * b) const
+{
+  for(int i = 0; i < realParameterNumber(); i++)
+    if(a[baseIndex + i] != b[baseIndex + i])
+      return GSL_NEGINF;
+  return GSL_POSINF;
+}
+
+double TimeDependentParameter::firstDifference(const double * a,
+                                               const double * b) const
+{
+  if(baseTDP) {
+    double va[realParameterNumber()];
+    double vb[realParameterNumber()];
+    spliceParameters(a, va);
+    spliceParameters(b, vb);
+    return realFirstDifference(va-baseIndex, vb-baseIndex);
+  }
+  else
+    return realFirstDifference(a, b);
+}
+
 void TimeDependentParameter::spliceParameters(const double * parameters,
                                               double * target) const
 {
@@ -76,6 +76,14 @@ protected:
   /// Returns the time at which there are potential discontinuities
   virtual Vector realDiscontinuities(const double * parameters) const = 0;
 
+  /// Returns the earliest time at which the values computed using
+  /// the parameters \a a and \a b can differ.
+  ///
+  /// The default implementation is conservative: it returns
+  /// -infinity as soon as one of the parameters differs.
+  virtual double realFirstDifference(const double * a,
+                                     const double * b) const;
+
   /// @}
 
 
@@ -118,6 +126,11 @@ public:
   /// Returns the time at which there are potential discontinuities
   Vector discontinuities(const double * parameters) const;
 
+  /// Returns the earliest time at which the values computed using
+  /// the parameters \a a and \a b can differ, -infinity if they can
+  /// differ at any time, and +infinity if they are identical.
+  double firstDifference(const double * a, const double * b) const;
+
   /// Parses a spec for the time-based stuff. Takes a string of the form:
   /// x,type(,....), where x is a number and type 
   static TimeDependentParameter * parseFromString(const QString & str);
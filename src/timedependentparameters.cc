@@ -87,6 +87,14 @@ Vector TimeDependentParameters::discontinuities(const double * params) const
   return ret;
 }
 
+double TimeDependentParameters::firstDifference(const double * a,
+                                                const double * b) const
+{
+  double ret = GSL_POSINF;
+  for(const_iterator i = begin(); i != end(); ++i)
+    ret = std::min(ret, i.value()->firstDifference(a, b));
+  return ret;
+}
 
 void TimeDependentParameters::initialize(const double * params)
 {
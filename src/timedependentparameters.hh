@@ -78,6 +78,11 @@ public:
 
   /// Returns the list of discontinuities
   Vector discontinuities(const double * parameters) const;
+
+  /// Returns the earliest time at which the values computed using
+  /// the parameters \a a and \a b can differ, -infinity if they can
+  /// differ from the start, and +infinity if they are identical.
+  double firstDifference(const double * a, const double * b) const;
   
 };
 
@@ -258,42 +258,96 @@ QList<QList<Vector> > Vector::readFromStream(QTextStream * source,
                         comments);
 }
 
-/// @todo A lot of code duplication here.
-double Vector::min() const
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void Vector::minMax(double * min, double * max,
+                    double * finiteMin, double * finiteMax) const
 {
   int sz = size();
   const double * d = (sz > 0 ? data() : NULL);
-  while(sz > 0 && std::isnan(*d)) {
-    sz--;
-    d++;
+  const double inf = std::numeric_limits<double>::infinity();
+  double mn = inf, mx = -inf, fmn = inf, fmx = -inf;
+  bool anyNumber = false, anyFinite = false;
+  int i = 0;
+
+#ifdef __SSE2__
+  // Two values at a time. The comparisons are written so that NaNs
+  // are simply ignored: minpd and maxpd return the second operand
+  // when one of them is a NaN.
+  if(sz >= 2) {
+    const __m128d pinf = _mm_set1_pd(inf);
+    const __m128d minf = _mm_set1_pd(-inf);
+    const __m128d zero = _mm_setzero_pd();
+    __m128d vmn = pinf, vmx = minf, vfmn = pinf, vfmx = minf;
+    __m128d vnumber = zero, vfinite = zero;
+    for(; i + 1 < sz; i += 2) {
+      __m128d v = _mm_loadu_pd(d + i);
+      vmn = _mm_min_pd(v, vmn);
+      vmx = _mm_max_pd(v, vmx);
+      // x - x is 0 only for finite numbers
+      __m128d fin = _mm_cmpeq_pd(_mm_sub_pd(v, v), zero);
+      vnumber = _mm_or_pd(vnumber, _mm_cmpeq_pd(v, v));
+      vfinite = _mm_or_pd(vfinite, fin);
+      vfmn = _mm_min_pd(_mm_or_pd(_mm_and_pd(fin, v),
+                                  _mm_andnot_pd(fin, pinf)), vfmn);
+      vfmx = _mm_max_pd(_mm_or_pd(_mm_and_pd(fin, v),
+                                  _mm_andnot_pd(fin, minf)), vfmx);
+    }
+    double t[2];
+    _mm_storeu_pd(t, vmn);
+    mn = std::min(t[0], t[1]);
+    _mm_storeu_pd(t, vmx);
+    mx = std::max(t[0], t[1]);
+    _mm_storeu_pd(t, vfmn);
+    fmn = std::min(t[0], t[1]);
+    _mm_storeu_pd(t, vfmx);
+    fmx = std::max(t[0], t[1]);
+    anyNumber = _mm_movemask_pd(vnumber) != 0;
+    anyFinite = _mm_movemask_pd(vfinite) != 0;
   }
-  if(! sz)
-    return std::nan("");
-  double m = d[0];
-  for(int i = 1; i < sz; i++)
-    if(d[i] < m)
-      m = d[i];
-  return m;
+#endif
+
+  for(; i < sz; i++) {
+    double v = d[i];
+    if(v < mn)
+      mn = v;
+    if(v > mx)
+      mx = v;
+    if(v == v)
+      anyNumber = true;
+    if(v - v == 0) {
+      anyFinite = true;
+      if(v < fmn)
+        fmn = v;
+      if(v > fmx)
+        fmx = v;
+    }
+  }
+
+  if(min)
+    *min = anyNumber ? mn : std::nan("");
+  if(max)
+    *max = anyNumber ? mx : std::nan("");
+  if(finiteMin)
+    *finiteMin = anyFinite ? fmn : std::nan("");
+  if(finiteMax)
+    *finiteMax = anyFinite ? fmx : std::nan("");
+}
+
+double Vector::min() const
+{
+  double rv;
+  minMax(&rv, NULL);
+  return rv;
 }
 
 double Vector::finiteMin() const
 {
-  int sz = size();
-  const double * d = (sz > 0 ? data() : NULL);
-  while(sz > 0 && ! std::isfinite(*d)) {
-    sz--;
-    d++;
-  }
-  if(! sz)
-    return std::nan("");
-  double m = d[0];
-  for(int i = 1; i < sz; i++) {
-    if(! std::isfinite(d[i]))
-       continue;
-    if(d[i] < m)
-      m = d[i];
-  }
-  return m;
+  double rv;
+  minMax(NULL, NULL, &rv, NULL);
+  return rv;
 }
 
 bool Vector::allFinite() const
@@ -325,39 +379,16 @@ int Vector::whereMin() const
 
 double Vector::max() const
 {
-  int sz = size();
-  const double * d = (sz > 0 ? data() : NULL);
-  while(sz > 0 && std::isnan(*d)) {
-    sz--;
-    d++;
-  }
-  if(! sz)
-    return std::nan("");
-  double m = d[0];
-  for(int i = 1; i < sz; i++)
-    if(d[i] > m)
-      m = d[i];
-  return m;
+  double rv;
+  minMax(NULL, &rv);
+  return rv;
 }
 
 double Vector::finiteMax() const
 {
-  int sz = size();
-  const double * d = (sz > 0 ? data() : NULL);
-  while(sz > 0 && !std::isfinite(*d)) {
-    sz--;
-    d++;
-  }
-  if(! sz)
-    return std::nan("");
-  double m = d[0];
-  for(int i = 1; i < sz; i++) {
-    if(! std::isfinite(d[i]))
-       continue;
-    if(d[i] > m)
-      m = d[i];
-  }
-  return m;
+  double rv;
+  minMax(NULL, NULL, NULL, &rv);
+  return rv;
 }
 
 int Vector::whereMax() const
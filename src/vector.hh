@@ -107,6 +107,11 @@ public:
   /// The maximum  value, excluding all funny numbers
   double finiteMax() const;
 
+  /// Computes in a single pass the values of min(), max(),
+  /// finiteMin() and finiteMax(). Any of the pointers can be NULL.
+  void minMax(double * min, double * max,
+              double * finiteMin = NULL, double * finiteMax = NULL) const;
+
   /// The value most distant from 0
   double magnitude() const;
 
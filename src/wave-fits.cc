@@ -29,6 +29,7 @@
 #include <soas.hh>
 
 #include <fitdata.hh>
+#include <functions.hh>
 
 #include <gsl/gsl_const_mksa.h>
 
@@ -55,6 +56,66 @@ QList<ShapeApproximation> approxValues =
                     << Dispersion
                        << Full;
 
+/// Computes exp(\a factor * (x - \a e0)) for all the X values of
+/// the dataset.
+static Vector expTerms(const Vector & xv, double e0, double factor)
+{
+  int nb = xv.size();
+  Vector ret(nb, 0);
+  const double * x = xv.constData();
+  double * t = ret.data();
+  for(int i = 0; i < nb; i++)
+    t[i] = factor * (x[i] - e0);
+  Functions::expArray(t, t, nb);
+  return ret;
+}
+
+/// Computes the current of the wave for all the points, for the
+/// given approximation, with \a num the numerator (the limiting
+/// current times the bias term), and \a a and \a b the terms of the
+/// denominator.
+static void waveCurrent(ShapeApproximation approx,
+                        const Vector & num, const Vector & a,
+                        const Vector & b, double k2_k0, double bd0,
+                        gsl_vector * target)
+{
+  int nb = a.size();
+  const double * n = num.constData();
+  const double * av = a.constData();
+  const double * bv = b.constData();
+  Vector lg(nb, 0);
+  double * l = lg.data();
+
+  switch(approx) {
+  case Nernst:
+    for(int i = 0; i < nb; i++)
+      l[i] = n[i]/av[i];
+    break;
+  case SlowET:
+    for(int i = 0; i < nb; i++)
+      l[i] = n[i]/(av[i] + bv[i] * k2_k0);
+    break;
+  case Dispersion:
+    for(int i = 0; i < nb; i++)
+      l[i] = 1 + av[i]/(bv[i] * k2_k0);
+    Functions::logArray(l, l, nb);
+    for(int i = 0; i < nb; i++)
+      l[i] = n[i]/av[i] * l[i];
+    break;
+  case Full: {
+    double ebd0 = exp(bd0);
+    for(int i = 0; i < nb; i++)
+      l[i] = (av[i] + bv[i] * k2_k0)/(av[i] + bv[i] * k2_k0 * ebd0);
+    Functions::logArray(l, l, nb);
+    for(int i = 0; i < nb; i++)
+      l[i] = n[i]/av[i] * (1 + (1/bd0) * l[i]);
+    break;
+  }
+  }
+  for(int i = 0; i < nb; i++)
+    gsl_vector_set(target, i, l[i]);
+}
+
 /// Fits to the ECI model of electrochemical waves
 class ECIFit : public PerDatasetFit {
   class Storage : public FitInternalStorage {
@@ -165,7 +226,6 @@ public:
       if(bd0 < 0)
         throw RangeError("Negative bd0");
     }
-    double ebd0 = exp(bd0);
 
     if(s->isOxidation) {
       if(cur < 0)
@@ -175,38 +235,13 @@ public:
       if(cur > 0)
         throw RangeError("Positive reduction current");
 
-    for(int i = 0; i < xv.size(); i++) {
-      double x = xv[i];
-      x -= params[1];
-      if(s->isOxidation)
-        x = -x;
-      
-      double d1 = exp(0.5 * f * x);
-      double e1 = d1 * d1;
-      double a = 1 + e1;
-      double v;
-      if(s->approx == Nernst) {
-        v = cur/a;
-      }
-      else {
-        double b = d1;
-        switch(s->approx) {
-        case SlowET:
-          v = cur/(a + b * k2_k0);
-          break;
-        case Dispersion:
-          v = cur/a * log(1 + a/(b * k2_k0));
-          break;
-        case Full:
-          v = cur/a * (1 + (1/bd0) *
-                       log((a + b * k2_k0)/(a + b * k2_k0 * ebd0)));
-          break;
-        default:
-          ;
-        }
-      }
-      gsl_vector_set(target, i, v);
-    }
+    int nb = xv.size();
+    double sg = (s->isOxidation ? -0.5 : 0.5) * f;
+    Vector d1 = expTerms(xv, params[1], sg);
+    Vector a(nb, 0);
+    for(int i = 0; i < nb; i++)
+      a[i] = 1 + d1[i] * d1[i];
+    waveCurrent(s->approx, Vector(nb, cur), a, d1, k2_k0, bd0, target);
   };
 
 
@@ -392,7 +427,6 @@ public:
       if(bd0 < 0)
         throw RangeError("Negative bd0");
     }
-    double ebd0 = exp(bd0);
 
     if(s->isOxidation) {
       if(cur < 0)
@@ -402,40 +436,17 @@ public:
       if(cur > 0)
         throw RangeError("Positive reduction current");
 
-    for(int i = 0; i < xv.size(); i++) {
-      double x = xv[i];
-      x -= E1;
-
-      if(s->isOxidation)
-        x = -x;
-
-      double d1 = exp(0.5 * f * x);
-      double e1 = d1 * d1;
-      double a = 1 + e1;
-      double ap = k_m2_k2 * e1;
-      double v;
-      if(s->approx == Nernst) {
-        v = cur * (1 - ap)/a;
-      }
-      else {
-        double b = d1 * (1 + k_m2_k2);
-        switch(s->approx) {
-        case SlowET:
-          v = cur * (1 - ap)/(a + b * k2_k0);
-          break;
-        case Dispersion:
-          v = cur * (1 - ap)/a * log(1 + a/(b * k2_k0));
-          break;
-        case Full:
-          v = cur * (1 - ap)/a * (1 + (1/bd0) *
-                       log((a + b * k2_k0)/(a + b * k2_k0 * ebd0)));
-          break;
-        default:
-          ;
-        }
-      }
-      gsl_vector_set(target, i, v);
+    int nb = xv.size();
+    double sg = (s->isOxidation ? -0.5 : 0.5) * f;
+    Vector d1 = expTerms(xv, E1, sg);
+    Vector a(nb, 0), b(nb, 0), num(nb, 0);
+    for(int i = 0; i < nb; i++) {
+      double e1 = d1[i] * d1[i];
+      a[i] = 1 + e1;
+      num[i] = cur * (1 - k_m2_k2 * e1);
+      b[i] = d1[i] * (1 + k_m2_k2);
     }
+    waveCurrent(s->approx, num, a, b, k2_k0, bd0, target);
   };
 
 
@@ -607,7 +618,6 @@ public:
       if(bd0 < 0)
         throw RangeError("Negative bd0");
     }
-    double ebd0 = exp(bd0);
 
     if(s->isOxidation) {
       if(cur < 0)
@@ -617,53 +627,25 @@ public:
       if(cur > 0)
         throw RangeError("Positive reduction current");
 
-    for(int i = 0; i < xv.size(); i++) {
-      double x = xv[i];
-      x -= E1;                  // = E_OI
-      if(s->isOxidation)
-        x = -x;
-      double d1 = exp(0.5 * f * x);
-      double e1 = d1 * d1;
-
-      x = xv[i];
-      x -= E2;                  // = E_IR
-      if(s->isOxidation)
-        x = -x;
-      double d2 = exp(0.5 * f * x);
-      double e2 = d2 * d2;
-
-      // For the case of oxidation, e and d are already inverted
-      
-      double a = s->isOxidation ?
-        1 + e1*(1 + e2)
-        : 1 + e2*(1 + e1)
-        ;
-      double v;
-      if(s->approx == Nernst) {
-        v = cur/a;
+    // For the case of oxidation, e and d are inverted
+    int nb = xv.size();
+    double sg = (s->isOxidation ? -0.5 : 0.5) * f;
+    Vector d1 = expTerms(xv, E1, sg);   // E_OI
+    Vector d2 = expTerms(xv, E2, sg);   // E_IR
+    Vector a(nb, 0), b(nb, 0);
+    for(int i = 0; i < nb; i++) {
+      double e1 = d1[i] * d1[i];
+      double e2 = d2[i] * d2[i];
+      if(s->isOxidation) {
+        a[i] = 1 + e1*(1 + e2);
+        b[i] = d1[i]/k0oi_k0ir_hlf * (1 + e2) + k0oi_k0ir_hlf * d2[i];
       }
       else {
-        double b = s->isOxidation ?
-          d1/k0oi_k0ir_hlf * (1 + e2) + k0oi_k0ir_hlf * d2 
-          : 
-          d1/k0oi_k0ir_hlf + k0oi_k0ir_hlf * d2 * (1 + e1);
-        switch(s->approx) {
-        case SlowET:
-          v = cur/(a + b * k2_k0);
-          break;
-        case Dispersion:
-          v = cur/a * log(1 + a/(b * k2_k0));
-          break;
-        case Full:
-          v = cur/a * (1 + (1/bd0) *
-                       log((a + b * k2_k0)/(a + b * k2_k0 * ebd0)));
-          break;
-        default:
-          ;
-        }
+        a[i] = 1 + e2*(1 + e1);
+        b[i] = d1[i]/k0oi_k0ir_hlf + k0oi_k0ir_hlf * d2[i] * (1 + e1);
       }
-      gsl_vector_set(target, i, v);
     }
+    waveCurrent(s->approx, Vector(nb, cur), a, b, k2_k0, bd0, target);
   };
 
   virtual ArgumentList fitHardOptions() const override {
@@ -867,7 +849,6 @@ public:
       if(bd0 < 0)
         throw RangeError("Negative bd0");
     }
-    double ebd0 = exp(bd0);
 
     if(s->isOxidation) {
       if(cur < 0)
@@ -877,58 +858,28 @@ public:
       if(cur > 0)
         throw RangeError("Positive reduction current");
 
-    for(int i = 0; i < xv.size(); i++) {
-      double x = xv[i];
-      x -= E1;                  // = E_OI
-      if(s->isOxidation)
-        x = -x;
-      double d1 = exp(0.5 * f * x);
-      double e1 = d1 * d1;
-
-      x = xv[i];
-      x -= E2;                  // = E_IR
-      if(s->isOxidation)
-        x = -x;
-      double d2 = exp(0.5 * f * x);
-      double e2 = d2 * d2;
-
-      // For the case of oxidation, e and d are already inverted
-
-
-      double a = s->isOxidation ?
-        1 + e1*(1 + e2)
-        : 1 + e2*(1 + e1)
-        ;
-      double ap = k_bias * e1 * e2;
-      double v;
-      if(s->approx == Nernst) {
-        v = cur * (1 - ap)/a;
+    // For the case of oxidation, e and d are inverted
+    int nb = xv.size();
+    double sg = (s->isOxidation ? -0.5 : 0.5) * f;
+    Vector d1 = expTerms(xv, E1, sg);   // E_OI
+    Vector d2 = expTerms(xv, E2, sg);   // E_IR
+    Vector a(nb, 0), b(nb, 0), num(nb, 0);
+    for(int i = 0; i < nb; i++) {
+      double e1 = d1[i] * d1[i];
+      double e2 = d2[i] * d2[i];
+      num[i] = cur * (1 - k_bias * e1 * e2);
+      if(s->isOxidation) {
+        a[i] = 1 + e1*(1 + e2);
+        b[i] = d1[i]/k0oi_k0ir_hlf * (1 + (1 + k_bias) * e2) +
+          k0oi_k0ir_hlf * d2[i] * (1 + k_bias*(1+e1));
       }
       else {
-        double b = s->isOxidation ?
-          d1/k0oi_k0ir_hlf * (1 + (1 + k_bias) * e2) +
-          k0oi_k0ir_hlf * d2 * (1 + k_bias*(1+e1))
-          :
-          d1/k0oi_k0ir_hlf * (1 + k_bias*(1+e2)) +
-          k0oi_k0ir_hlf * d2 * (1 + (1 + k_bias) * e1);
-          ;
-        switch(s->approx) {
-        case SlowET:
-          v = cur * (1 - ap)/(a + b * k2_k0);
-          break;
-        case Dispersion:
-          v = cur * (1 - ap)/a * log(1 + a/(b * k2_k0));
-          break;
-        case Full:
-          v = cur * (1 - ap)/a * (1 + (1/bd0) *
-                       log((a + b * k2_k0)/(a + b * k2_k0 * ebd0)));
-          break;
-        default:
-          ;
-        }
+        a[i] = 1 + e2*(1 + e1);
+        b[i] = d1[i]/k0oi_k0ir_hlf * (1 + k_bias*(1+e2)) +
+          k0oi_k0ir_hlf * d2[i] * (1 + (1 + k_bias) * e1);
       }
-      gsl_vector_set(target, i, v);
     }
+    waveCurrent(s->approx, num, a, b, k2_k0, bd0, target);
   };
 
 